@@ -0,0 +1,76 @@
+#include "arena.hh"
+
+namespace rx {
+
+
+Arena::Arena(size_t firstChunkSize) : _nextChunkSize{firstChunkSize} {}
+
+
+Arena::~Arena() {
+  auto* c = _chunks;
+  while (c) {
+    auto* next = c->next;
+    ::free(c);
+    c = next;
+  }
+}
+
+
+void* Arena::allocSlow(size_t size, size_t align) {
+  size_t need = sizeof(Chunk) + size + align;
+  size_t chunkSize = _nextChunkSize;
+  bool dedicated = need > chunkSize / 4;
+  if (dedicated) {
+    chunkSize = need;
+  } else if (_nextChunkSize < kMaxChunkSize) {
+    _nextChunkSize *= 2;
+  }
+
+  auto* c = (Chunk*)::malloc(chunkSize);
+  c->size = chunkSize;
+  _reserved += chunkSize;
+  char* start = (char*)c + sizeof(Chunk);
+  char* p = (char*)(((uintptr_t)start + (align - 1)) & ~(uintptr_t)(align - 1));
+  _allocated += size;
+
+  if (dedicated && _chunks) {
+    // Keep bumping in the current chunk, which is the first in the list
+    c->next = _chunks->next;
+    _chunks->next = c;
+  } else {
+    c->next = _chunks;
+    _chunks = c;
+    _end = (char*)c + chunkSize;
+    _p = p + size;
+  }
+  return p;
+}
+
+
+void Arena::reset() {
+  Chunk* keep = nullptr;
+  auto* c = _chunks;
+  while (c) {
+    auto* next = c->next;
+    if (!keep || c->size > keep->size) {
+      if (keep) ::free(keep);
+      keep = c;
+    } else {
+      ::free(c);
+    }
+    c = next;
+  }
+  _chunks = keep;
+  _allocated = 0;
+  _reserved = 0;
+  _p = _end = nullptr;
+  if (keep) {
+    keep->next = nullptr;
+    _reserved = keep->size;
+    _p = (char*)keep + sizeof(Chunk);
+    _end = (char*)keep + keep->size;
+  }
+}
+
+
+} // namespace
@@ -0,0 +1,97 @@
+#pragma once
+namespace rx {
+
+// Bump allocator for memory that lives until some unit of work is done, e.g. resolving the
+// dependencies of a package. Allocating is usually just a pointer increment. Memory is never
+// freed piecemeal but all at once when the arena is reset or destroyed, so destructors of objects
+// placed in an arena are only called if the owner calls them.
+//
+// Not thread safe. Work spread over several threads should give each thread an arena of its own.
+//
+struct Arena {
+  enum : size_t { kDefaultChunkSize = 16 * 1024, kMaxChunkSize = 1024 * 1024 };
+
+  explicit Arena(size_t firstChunkSize=kDefaultChunkSize);
+  ~Arena();
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* alloc(size_t size, size_t align=alignof(std::max_align_t));
+    // Allocate `size` bytes. Chunks double in size as the arena grows. Large allocations get a
+    // chunk of their own so that they don't waste the remainder of the current one.
+  template <typename T, typename... Args> T* make(Args&&... args) {
+    return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+  void reset();
+    // Release everything allocated. The largest chunk is kept for reuse.
+
+  size_t allocated() const { return _allocated; } // bytes handed out since the last reset
+  size_t reserved() const { return _reserved; }   // bytes held in chunks
+
+private:
+  struct alignas(std::max_align_t) Chunk {
+    // Header of a chunk of memory, which is followed by the memory handed out
+    Chunk* next;
+    size_t size; // including this header
+  };
+  void* allocSlow(size_t size, size_t align);
+
+  char*  _p = nullptr;   // next free byte in the current chunk
+  char*  _end = nullptr; // end of the current chunk
+  Chunk* _chunks = nullptr;
+  size_t _nextChunkSize;
+  size_t _allocated = 0;
+  size_t _reserved = 0;
+};
+
+
+template <typename T>
+struct ArenaAllocator {
+  // Standard allocator which takes memory from an arena, for containers and strings that live no
+  // longer than the arena. Deallocating is a no-op. A default-constructed allocator has no arena
+  // and uses the heap.
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ArenaAllocator() noexcept : arena{nullptr} {}
+  ArenaAllocator(Arena* a) noexcept : arena{a} {}
+  template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+    : arena{other.arena} {}
+
+  T* allocate(size_t n) {
+    return arena ? (T*)arena->alloc(sizeof(T) * n, alignof(T))
+                 : (T*)::operator new(sizeof(T) * n);
+  }
+  void deallocate(T* p, size_t) noexcept {
+    if (!arena) ::operator delete((void*)p);
+  }
+
+  template <typename U> struct rebind { using other = ArenaAllocator<U>; };
+  template <typename U> bool operator==(const ArenaAllocator<U>& other) const {
+    return arena == other.arena;
+  }
+  template <typename U> bool operator!=(const ArenaAllocator<U>& other) const {
+    return arena != other.arena;
+  }
+
+  Arena* arena;
+};
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+
+// ================================================================================================
+
+inline void* Arena::alloc(size_t size, size_t align) {
+  char* p = (char*)(((uintptr_t)_p + (align - 1)) & ~(uintptr_t)(align - 1));
+  if (_p == nullptr || p > _end || (size_t)(_end - p) < size) {
+    return allocSlow(size, align);
+  }
+  _p = p + size;
+  _allocated += size;
+  return p;
+}
+
+} // namespace
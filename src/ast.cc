@@ -0,0 +1,116 @@
+#include "ast.hh"
+namespace rx {
+
+
+Ast::Ast() : _nodes{&_arena}, _lists{&_arena}, _strings{&_arena} {}
+
+
+const char* Ast::kindName(Kind k) {
+  switch (k) {
+    #define K(Name, ...) case Name: return #Name;
+    RX_AST_KINDS(K)
+    #undef K
+  }
+  return "?";
+}
+
+
+const char* Ast::opName(Op op) {
+  switch (op) {
+    case NoOp: return "";
+    #define O(Name, Repr) case Name: return Repr;
+    RX_AST_OPS(O)
+    #undef O
+  }
+  return "?";
+}
+
+
+size_t Ast::memoryUsage() const {
+  return _nodes.size() * sizeof(Node) + _lists.size() * sizeof(NodeID) + _strings.size();
+}
+
+
+string Ast::repr(NodeID id) const {
+  string s;
+  if (id < _nodes.size()) {
+    reprNode(s, id);
+  }
+  return s;
+}
+
+
+void Ast::reprNode(string& s, NodeID id) const {
+  auto& n = _nodes[id];
+  auto reprList = [&](const char* head, List l) {
+    s += '(';
+    s += head;
+    for (auto child : l) {
+      s += ' ';
+      reprNode(s, child);
+    }
+    s += ')';
+  };
+  switch (n.kind) {
+    case File:     reprList("file", list(n)); break;
+    case Block:    reprList("block", list(n)); break;
+    case Package:  s += "(package "; s += str(n); s += ')'; break;
+    case Import:   s += "(import \""; s += str(n); s += "\")"; break;
+    case Ident:    s += str(n); break;
+    case FloatLit: s += str(n); break;
+    case CharLit:  s += '\''; s += str(n); s += '\''; break;
+    case TextLit:  s += '"'; s += str(n); s += '"'; break;
+    case IntLit: {
+      s += (n.op == 16) ? "0x" : (n.op == 8) ? "0" : "";
+      s += str(n);
+      break;
+    }
+    case Func: {
+      auto l = list(n); // name, body, parameters...
+      s += "(func ";
+      reprNode(s, l[0]);
+      s += " (";
+      for (size_t i = 2; i != l.size(); ++i) {
+        if (i != 2) s += ' ';
+        reprNode(s, l[i]);
+      }
+      s += ") ";
+      reprNode(s, l[1]);
+      s += ')';
+      break;
+    }
+    case Return: {
+      s += "(return";
+      if (n.a) { s += ' '; reprNode(s, n.a); }
+      s += ')';
+      break;
+    }
+    case Label: {
+      s += "(label "; reprNode(s, n.a); s += ' '; reprNode(s, n.b); s += ')';
+      break;
+    }
+    case Unary: {
+      s += '('; s += opName((Op)n.op); s += ' '; reprNode(s, n.a); s += ')';
+      break;
+    }
+    case Binary: {
+      s += '('; s += opName((Op)n.op);
+      s += ' '; reprNode(s, n.a);
+      s += ' '; reprNode(s, n.b);
+      s += ')';
+      break;
+    }
+    case Call:     reprList("call", list(n)); break;
+    case Member: {
+      s += "(. "; reprNode(s, n.a); s += ' '; reprNode(s, n.b); s += ')';
+      break;
+    }
+    case Index: {
+      s += "(index "; reprNode(s, n.a); s += ' '; reprNode(s, n.b); s += ')';
+      break;
+    }
+  }
+}
+
+
+} // namespace
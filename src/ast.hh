@@ -0,0 +1,131 @@
+#pragma once
+#include "arena.hh"
+#include "error.hh"
+namespace rx {
+using std::string;
+
+#define RX_AST_KINDS(K) \
+  /* Name,     what `op`, `a` and `b` hold                   */ \
+  K( File,     /* list of declarations and statements        */ ) \
+  K( Package,  /* name: string                               */ ) \
+  K( Import,   /* path: string                               */ ) \
+  K( Func,     /* list: name, body, parameters...            */ ) \
+  K( Block,    /* list of statements                         */ ) \
+  K( Return,   /* a: value or 0                              */ ) \
+  K( Label,    /* a: Ident, b: value                         */ ) \
+  K( Ident,    /* string                                     */ ) \
+  K( IntLit,   /* digits: string, op: base                   */ ) \
+  K( FloatLit, /* string                                     */ ) \
+  K( CharLit,  /* UTF8 string                                */ ) \
+  K( TextLit,  /* UTF8 string                                */ ) \
+  K( Unary,    /* op, a: operand                             */ ) \
+  K( Binary,   /* op, a: left, b: right                      */ ) \
+  K( Call,     /* list: callee, arguments...                 */ ) \
+  K( Member,   /* a: operand, b: Ident                       */ ) \
+  K( Index,    /* a: operand, b: index                       */ )
+
+#define RX_AST_OPS(O) \
+  /* Name,   repr */ \
+  O( Assign, "="  ) \
+  O( Eq,     "==" ) \
+  O( Lt,     "<"  ) \
+  O( Gt,     ">"  ) \
+  O( Add,    "+"  ) \
+  O( Sub,    "-"  ) \
+  O( Mul,    "*"  ) \
+  O( Div,    "/"  )
+
+// Syntax tree of a source file. Nodes are 16-byte records kept in a single array and refer to
+// each other by 32-bit index, rather than being heap objects linked by pointers. What a node's
+// `a` and `b` fields hold depends on its kind, see RX_AST_KINDS:
+//
+// - "string" means a string in the tree's string table, `a` being its offset and `b` its size.
+// - "list" means a run of node IDs in the tree's list table, `a` being its start and `b` its
+//   length. Use `list(node)` to get at them.
+//
+// The node array, lists and strings are allocated in an arena owned by the tree, and sized up
+// front from the size of the source, so parsing a file usually allocates only a few times.
+//
+struct Ast {
+  using NodeID = uint32_t; // 0 is the File node, which no other node refers to, so 0 means none
+
+  enum Kind : uint8_t {
+    #define K(Name, ...) Name,
+    RX_AST_KINDS(K)
+    #undef K
+  };
+  enum Op : uint8_t {
+    NoOp,
+    #define O(Name, _) Name,
+    RX_AST_OPS(O)
+    #undef O
+  };
+
+  struct Node {
+    Kind     kind;
+    uint8_t  op;  // Op of Unary and Binary, base of IntLit (8, 10 or 16)
+    uint16_t _reserved;
+    uint32_t pos; // byte offset of the node's first token in the source
+    uint32_t a;
+    uint32_t b;
+  };
+  static_assert(sizeof(Node) == 16, "Ast::Node should be 16 bytes");
+
+  struct List {
+    const NodeID* b;
+    const NodeID* e;
+    const NodeID* begin() const { return b; }
+    const NodeID* end() const { return e; }
+    size_t size() const { return e - b; }
+    NodeID operator[](size_t i) const { return b[i]; }
+  };
+
+  Ast();
+  Ast(const Ast&) = delete;
+  Ast& operator=(const Ast&) = delete;
+
+  Error parse(const char* p, size_t z);
+    // Parse .rx source, replacing the current tree. The error message of a syntax error starts
+    // with the one-based "line:column:" it was found at.
+
+  NodeID root() const { return 0; }
+  size_t size() const { return _nodes.size(); } // number of nodes
+  const Node& operator[](NodeID id) const { return _nodes[id]; }
+  List list(const Node&) const;
+  string str(const Node&) const;
+  bool strEquals(const Node&, const char*) const;
+
+  string repr(NodeID=0) const;
+    // S-expression of a subtree, e.g. "(func f () (block (+ 1 2)))"
+  size_t memoryUsage() const;
+    // Bytes used by nodes, lists and strings
+
+  static const char* kindName(Kind);
+  static const char* opName(Op);
+
+private:
+  friend struct Parser;
+  void reprNode(string& s, NodeID) const;
+
+  Arena                                       _arena;
+  std::vector<Node, ArenaAllocator<Node>>     _nodes;
+  std::vector<NodeID, ArenaAllocator<NodeID>> _lists;
+  ArenaString                                 _strings;
+};
+
+
+// ================================================================================================
+
+inline Ast::List Ast::list(const Node& n) const {
+  return List{_lists.data() + n.a, _lists.data() + n.a + n.b};
+}
+
+inline string Ast::str(const Node& n) const {
+  return string{_strings.data() + n.a, n.b};
+}
+
+inline bool Ast::strEquals(const Node& n, const char* s) const {
+  return strlen(s) == n.b && memcmp(_strings.data() + n.a, s, n.b) == 0;
+}
+
+} // namespace
@@ -1,5 +1,7 @@
 #include "async.hh"
 #include "util.hh"
+#include "trace.hh"
+#include "asyncsemaphore.hh"
 
 using std::cerr;
 using std::endl;
@@ -31,10 +33,94 @@ Async& Async::main() {
 #endif
 
 
+struct PostQueue {
+  // Intrusive multi-producer single-consumer queue (Dmitry Vyukov's design.) Pushing is a single
+  // atomic exchange and never blocks, however many threads post at once. Only the loop thread
+  // pops.
+  struct Node {
+    Node() {}
+    Node(func<void()>&& fn) : fn{fwdarg(fn)} {}
+    func<void()> fn;
+    Node*        next = nullptr;
+  };
+
+  Node  stub;
+  Node* head = &stub; // most recently pushed. Shared by producers.
+  Node* tail = &stub; // next to pop. Owned by the consumer.
+
+  ~PostQueue() {
+    while (auto* n = pop()) delete n;
+  }
+
+  void push(Node* n) {
+    __atomic_store_n(&n->next, nullptr, __ATOMIC_RELAXED);
+    auto* prev = __atomic_exchange_n(&head, n, __ATOMIC_ACQ_REL);
+    // Between the exchange and this store the queue is briefly disconnected; `pop` sees that as
+    // empty, and the producer's wakeup that follows makes the consumer try again.
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+  }
+
+  Node* pop() {
+    auto* t = tail;
+    auto* next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+    if (t == &stub) {
+      if (next == nullptr) return nullptr;
+      tail = t = next;
+      next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != nullptr) {
+      tail = next;
+      return t;
+    }
+    if (t != __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+      return nullptr; // a push is in progress
+    }
+    push(&stub); // `t` is the last node; put the stub behind it so that we can take it
+    next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+    if (next != nullptr) {
+      tail = next;
+      return t;
+    }
+    return nullptr;
+  }
+};
+
+
 struct Async::Imp {
-  uv_loop_t uvloop;
+  uv_loop_t                 uvloop;
+  uv_async_t                uvasync;  // wakes up the loop to run posted functions
+  PostQueue                 posted;
+  volatile bool             signaled = false; // a wakeup is pending for `posted`
+  size_t                    refs = 0; // outstanding work from `ref()`
+  AsyncSemaphore*           files = nullptr; // created on first use
+
+  Imp() {
+    uv_loop_init(&uvloop);
+    uv_async_init(&uvloop, &uvasync, &Imp::postCB);
+    uvasync.data = (void*)this;
+    uv_unref((uv_handle_t*)&uvasync);
+  }
+
+  ~Imp() {
+    delete files;
+    uv_close((uv_handle_t*)&uvasync, nullptr);
+    uv_run(&uvloop, UV_RUN_NOWAIT);
+    uv_loop_close(&uvloop);
+  }
 
-  Imp() { uv_loop_init(&uvloop); }
+  static void postCB(uv_async_t* handle) {
+    auto* self = (Imp*)handle->data;
+    // Clear the flag before draining so that a post racing with us signals again rather than
+    // being left in the queue until some unrelated wakeup.
+    __atomic_store_n(&self->signaled, false, __ATOMIC_SEQ_CST);
+    while (auto* n = self->posted.pop()) {
+      {
+        trace::Scope ts{"loop", "post"};
+        n->fn();
+      }
+      delete n;
+    }
+  }
 };
 
 
@@ -49,5 +135,30 @@ void Async::run() {
   uv_run(&self->uvloop, UV_RUN_DEFAULT);
 }
 
+void Async::post(func<void()>&& fn) {
+  self->posted.push(new PostQueue::Node{fwdarg(fn)});
+  // Only the first post after the loop starts draining needs to wake it up. The rest are picked
+  // up by the same drain, so a burst of posts costs a single uv_async_send.
+  if (!__atomic_exchange_n(&self->signaled, true, __ATOMIC_SEQ_CST)) {
+    uv_async_send(&self->uvasync);
+  }
+}
+
+void Async::ref() {
+  if (self->refs++ == 0) uv_ref((uv_handle_t*)&self->uvasync);
+}
+
+void Async::unref() {
+  assert(self->refs != 0);
+  if (--self->refs == 0) uv_unref((uv_handle_t*)&self->uvasync);
+}
+
+AsyncSemaphore& Async::fileLimiter() {
+  if (self->files == nullptr) {
+    self->files = new AsyncSemaphore{AsyncSemaphore::fileLimit()};
+  }
+  return *self->files;
+}
+
 
 } // namespace
\ No newline at end of file
@@ -9,6 +9,8 @@
 
 namespace rx {
 
+struct AsyncSemaphore;
+
 struct Async {
   Async();
   ~Async();
@@ -17,12 +19,25 @@ struct Async {
   uv_loop_t* uvloop();
   void run();
 
+  void post(func<void()>&&);
+    // Call a function on the thread running this loop. Thread safe and lock free; functions are
+    // called in the order they were posted from any one thread. Posting by itself does not keep
+    // the loop running; use `ref` for work that will complete through `post`.
+  void ref();
+  void unref();
+    // Keep the loop running while there's outstanding work, e.g. on another thread, that will
+    // eventually `post` its result. Must be balanced and called on the loop's thread.
+
+  AsyncSemaphore& fileLimiter();
+    // Shared by everything on this loop that opens files, to keep the number of open files
+    // within `AsyncSemaphore::fileLimit()`. Must be used on the loop's thread.
+
 private:
   struct Imp; Imp* self;
 };
 
 inline Error UVError(int err) {
-  return (err < 0) ? Error{err, uv_strerror(err)} : Error{};
+  return (err < 0) ? Error{err} : Error{}; // message from uv_strerror
 }
 
 } // namespace
@@ -8,53 +8,155 @@ using std::endl;
 
 namespace rx {
 
+using Job = AsyncGroup::Job;
+using Slot = _AsyncGroupSlot;
+
 
 _AsyncGroup::~_AsyncGroup() {
   once(_endFlag, [&]{
-    if (!_jobs.empty()) {
-      _cb({"Some jobs did not end properly."
-           " Call `asyncGroup.end(job[, error])` to mark a job as completed"});
+    if (_outstanding != 0) {
+      static const Error::Static kJobsNotEnded{0, "Some jobs did not end properly."
+        " Call `asyncGroup.end(job[, error])` to mark a job as completed"};
+      _cb(kJobsNotEnded);
     } else {
       _cb(nullptr);
     }
   });
+  for (auto* chunk : _chunks) {
+    delete[] chunk;
+  }
+}
+
+
+Slot* _AsyncGroup::slot(uint32_t index) const {
+  uint64_t n = (uint64_t)index + kFirstChunkSize;
+  uint32_t c = (63 - __builtin_clzll(n)) - kFirstChunkShift;
+  auto* chunk = __atomic_load_n(&_chunks[c], __ATOMIC_ACQUIRE);
+  return chunk ? &chunk[n - ((uint64_t)kFirstChunkSize << c)] : nullptr;
 }
 
 
-const AsyncGroup::Job* AsyncGroup::begin() const {
-  auto jobID = self->_nextJobID++;
-  DBG("AS@"<<(void*)self<<" begin job #"<<jobID)
-  return &*self->_jobs.emplace(jobID).first;
+Slot* _AsyncGroup::allocJob() {
+  // Reuse a free slot if there is one. The tag in the upper half of `_freeList` changes with
+  // every update so that a pop racing with a pop-and-push of the same slot fails its CAS.
+  // `_nextFree` may be rewritten by a concurrent push of the same slot while we read it; the tag
+  // makes our CAS fail in that case.
+  uint64_t head = __atomic_load_n(&_freeList, __ATOMIC_ACQUIRE);
+  while ((uint32_t)head != 0) {
+    auto* job = slot((uint32_t)head - 1);
+    uint64_t next = (((head >> 32) + 1) << 32) |
+                    __atomic_load_n(&job->_nextFree, __ATOMIC_RELAXED);
+    if (__sync_bool_compare_and_swap(&_freeList, head, next)) {
+      return job;
+    }
+    head = __atomic_load_n(&_freeList, __ATOMIC_ACQUIRE);
+  }
+
+  // Otherwise take the next never-used slot, allocating its chunk if we're first to need it
+  auto index = __sync_fetch_and_add(&_nslots, 1);
+  uint64_t n = (uint64_t)index + kFirstChunkSize;
+  uint32_t c = (63 - __builtin_clzll(n)) - kFirstChunkShift;
+  assert(c < kMaxChunks);
+  if (__atomic_load_n(&_chunks[c], __ATOMIC_ACQUIRE) == nullptr) {
+    size_t size = (size_t)kFirstChunkSize << c;
+    auto* chunk = new Slot[size];
+    uint32_t first = (uint32_t)(((uint64_t)kFirstChunkSize << c) - kFirstChunkSize);
+    for (size_t i = 0; i != size; ++i) {
+      chunk[i]._index = first + (uint32_t)i;
+    }
+    if (!__sync_bool_compare_and_swap(&_chunks[c], (Slot*)nullptr, chunk)) {
+      delete[] chunk; // another thread beat us to it
+    }
+  }
+  return slot(index);
 }
 
 
-const AsyncGroup::Job& AsyncGroup::Job::operator=(AsyncCanceler&& canceler) const {
-  DBG("assign canceler to job #"<<_jobID)
-  const_cast<Job*>(this)->_canceler = fwdarg(canceler);
-  return *this;
+void _AsyncGroup::freeJob(Slot* job) {
+  uint64_t head, next;
+  do {
+    head = __atomic_load_n(&_freeList, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&job->_nextFree, (uint32_t)head, __ATOMIC_RELAXED);
+    next = (((head >> 32) + 1) << 32) | ((uint64_t)job->_index + 1);
+  } while (!__sync_bool_compare_and_swap(&_freeList, head, next));
 }
 
 
-const AsyncGroup::Job& AsyncGroup::Job::operator=(const AsyncCanceler& canceler) const {
-  DBG("assign canceler to job #"<<_jobID)
-  const_cast<Job*>(this)->_canceler = fwdarg(canceler);
-  return *this;
+Job AsyncGroup::begin() const {
+  __sync_add_and_fetch(&self->_outstanding, 1);
+  auto* slot = self->allocJob();
+  DBG("AS@"<<(void*)self<<" begin job #"<<slot->_index)
+  slot->_lock();
+  // If the group is canceled from here on, `cancelAllJobs` will see this job as active. If it was
+  // canceled before, the canceler must be called as soon as it's assigned.
+  bool canceled = __atomic_load_n(&self->_canceled, __ATOMIC_SEQ_CST);
+  slot->_state = (canceled ? Slot::CancelRequested : Slot::Active);
+  slot->_traceBegin = trace::enabled() ? trace::now() : 0;
+  Job job{slot->_index, slot->_gen};
+  slot->_unlock();
+  return job;
 }
 
 
-void AsyncGroup::end(const Job* job, Error err) const {
-  DBG("AS@"<<(void*)self<<" end job #"<<job->_jobID)
-  auto& jobs = self->_jobs;
-  auto I = jobs.find(*job);
+AsyncGroup::JobAccess AsyncGroup::operator[](Job job) const {
+  return JobAccess{self->slot(job._index), job._gen};
+}
+
 
-  if (I == jobs.end()) {
-    // Should never happen. If we have been canceled, then the job should have been canceled too.
-    err = {"Trying to end job #" + std::to_string(job->_jobID) + " that has already ended"};
+void AsyncGroup::JobAccess::operator=(AsyncCanceler&& canceler) const {
+  DBG("assign canceler to job #"<<_slot->_index)
+  AsyncCanceler cancelNow;
+  AsyncCanceler drop; // destroyed outside of the lock
+  _slot->_lock();
+  if (_slot->_gen != _gen) {
+    // The job ended before its operation returned a canceler, and the slot might have been
+    // reused since
+    drop = fwdarg(canceler);
   } else {
-    jobs.erase(I);
+    switch (_slot->_state) {
+      case Slot::Active:
+        drop = std::move(_slot->_canceler);
+        _slot->_canceler = fwdarg(canceler);
+        break;
+      case Slot::CancelRequested:
+        cancelNow = fwdarg(canceler);
+        _slot->_state = Slot::Canceled;
+        break;
+      case Slot::Free:
+      case Slot::Canceled:
+        drop = fwdarg(canceler);
+        break;
+    }
   }
+  _slot->_unlock();
+  if (cancelNow) {
+    cancelNow();
+  }
+}
+
 
-  if (err || jobs.empty()) {
+void AsyncGroup::end(Job job, Error err) const {
+  auto* slot = self->slot(job._index);
+  DBG("AS@"<<(void*)self<<" end job #"<<slot->_index)
+  AsyncCanceler canceler; // destroyed outside of the lock
+  slot->_lock();
+  bool stale = (slot->_gen != job._gen || slot->_state == Slot::Free);
+  if (!stale) {
+    if (slot->_traceBegin != 0 && trace::enabled()) {
+      trace::recordAsync("asyncgroup", "job", slot->_traceBegin, trace::now());
+    }
+    slot->_state = Slot::Free;
+    ++slot->_gen;
+    canceler = std::move(slot->_canceler);
+  }
+  slot->_unlock();
+  if (stale) {
+    return; // ended before; the slot might belong to another job by now
+  }
+
+  self->freeJob(slot);
+  bool done = (__sync_sub_and_fetch(&self->_outstanding, 1) == 0);
+  if (err || done) {
     once(self->_endFlag, [&]{
       if (err) self->cancelAllJobs();
       self->_cb(err);
@@ -65,10 +167,28 @@ void AsyncGroup::end(const Job* job, Error err) const {
 
 void _AsyncGroup::cancelAllJobs() {
   DBG("AS@"<<(void*)this<<" canceling all jobs")
-  for (auto& job : _jobs) {
-    if (job._canceler) {
-      DBG("AS@"<<(void*)this<<" canceling job #"<<job._jobID)
-      job._canceler();
+  // Sequentially consistent so that either we see a slot that `begin` is handing out, or `begin`
+  // sees `_canceled`
+  __atomic_store_n(&_canceled, 1L, __ATOMIC_SEQ_CST);
+  uint32_t nslots = __atomic_load_n(&_nslots, __ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i != nslots; ++i) {
+    // A slot without a chunk is being handed out by `begin`, which will see `_canceled`
+    auto* job = slot(i);
+    if (job == nullptr) continue;
+    AsyncCanceler canceler;
+    job->_lock();
+    if (job->_state == Slot::Active) {
+      if (job->_canceler) {
+        canceler = std::move(job->_canceler);
+        job->_state = Slot::Canceled;
+      } else {
+        job->_state = Slot::CancelRequested;
+      }
+    }
+    job->_unlock();
+    if (canceler) {
+      DBG("AS@"<<(void*)this<<" canceling job #"<<i)
+      canceler();
     }
   }
 }
@@ -95,4 +215,4 @@ AsyncCanceler AsyncGroup::canceler() {
 }
 
 
-} // namespace
\ No newline at end of file
+} // namespace
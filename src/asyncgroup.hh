@@ -3,6 +3,7 @@
 #include "once.hh"
 #include "error.hh"
 #include "asynccanceler.hh"
+#include "trace.hh"
 
 namespace rx {
 using std::string;
@@ -10,14 +11,16 @@ using std::string;
 // ----------------------------------------------------------------------------------------------
 
 struct _AsyncGroup;
+struct _AsyncGroupSlot;
 using AsyncGroupID = size_t;
 
 struct AsyncGroup : Ref<_AsyncGroup> {
-  struct Job; // opaque type that can be assigned AsyncCanceler
+  struct Job;       // handle to a job
+  struct JobAccess; // for assigning a canceler to a job
 
   AsyncGroup(func<void(Error)> cb);
   AsyncGroup(const AsyncGroup&);
-  AsyncGroup(AsyncGroup&&);
+  AsyncGroup(AsyncGroup&&) noexcept;
 
   bool cancel() const;
     // Cancel any incomplete job. Returns true if the call caused the set to be canceled.
@@ -30,11 +33,16 @@ struct AsyncGroup : Ref<_AsyncGroup> {
     // reference to this AsyncGroup until either disposed or called. Just like any AsyncCanceler,
     // subsequent calls have no effect.
 
-  const Job* begin() const;
-    // Start a new job
+  Job begin() const;
+    // Start a new job. Thread safe.
 
-  void end(const Job*, Error err=nullptr) const;
-    // End a job
+  void end(Job, Error err=nullptr) const;
+    // End a job. Thread safe. Ending a job that has already ended has no effect, and so has
+    // assigning a canceler to it.
+
+  JobAccess operator[](Job) const;
+    // For the `G[job] = canceler` idiom, which sets the function that cancels the job's
+    // operation, replacing any previous one. Thread safe.
 };
 
 
@@ -46,8 +54,8 @@ AsyncCanceler DoManyThingsAsync(Things things, func<void(Error)> cb) {
   AsyncGroup G{cb};
   for (auto& thing : things) {
     // Capture `job` in closure and assign DoThingAsync canceler to the job
-    auto* job = G.begin();
-    *job = DoThingAsync(thing, [=](Error err) {
+    auto job = G.begin();
+    G[job] = DoThingAsync(thing, [=](Error err) {
       G.end(job, err);
     });
   }
@@ -59,43 +67,80 @@ AsyncCanceler DoManyThingsAsync(Things things, func<void(Error)> cb) {
 
 // ===============================================================================================
 
+struct _AsyncGroupSlot {
+  // A slot in the group's slab. `begin` hands out a free slot and `end` returns it, so a group
+  // uses memory proportional to the most jobs it has had in flight at once. Every job that uses
+  // the slot gets a new generation, which tells a job's handle apart from those of earlier jobs
+  // in the same slot.
+  enum State : long {
+    Free,
+    Active,
+    CancelRequested, // canceled before a canceler was assigned. It's called when assigned.
+    Canceled,        // canceled and the canceler has been called
+  };
+
+  _AsyncGroupSlot() {}
+  _AsyncGroupSlot(const _AsyncGroupSlot&) = delete;
+
+  void _lock() const { while (__sync_lock_test_and_set(&_locked, 1L)) {} }
+  void _unlock() const { __sync_lock_release(&_locked); }
+
+  mutable volatile long _locked = 0; // guards _state, _gen and _canceler
+  State                 _state = Free;
+  uint32_t              _gen = 0;
+  uint32_t              _index = 0;
+  volatile uint32_t     _nextFree = 0; // index+1 of the next slot in the free list
+  uint64_t              _traceBegin = 0;
+  AsyncCanceler         _canceler;
+};
+
+
 struct AsyncGroup::Job {
-  Job() {}
-  Job(const Job&) = delete;
-  Job(Job&&) = default;
-  Job(size_t jobID) : _jobID{jobID} {}
-  const Job& operator=(AsyncCanceler&&) const;
-  const Job& operator=(const AsyncCanceler&) const;
-
-  size_t        _jobID = SIZE_MAX;
-  AsyncCanceler _canceler;
+  // The index of a slot and the generation of the job in it. Copies refer to the same job. A
+  // single word, since jobs are captured by the closures of nearly every operation in a group.
+  uint32_t _index;
+  uint32_t _gen;
+};
+
+static_assert(sizeof(AsyncGroup::Job) == 8, "AsyncGroup::Job should be a single word");
+
+
+struct AsyncGroup::JobAccess {
+  void operator=(AsyncCanceler&&) const;
+  _AsyncGroupSlot* _slot;
+  uint32_t         _gen;
 };
 
 
 struct _AsyncGroup : SafeRefCounted<_AsyncGroup> {
-  struct JobEQ {
-    constexpr bool operator()(const AsyncGroup::Job& lhs, const AsyncGroup::Job& rhs) const {
-      return lhs._jobID == rhs._jobID;
-    }
-  };
-  struct JobHash {
-    constexpr size_t operator()(const AsyncGroup::Job& v) const { return v._jobID; }
+  // Slots live in chunks that double in size and are never moved, so slot pointers stay valid
+  // for the life of the group. Chunk `c` holds kFirstChunkSize << c slots.
+  enum : uint32_t {
+    kFirstChunkShift = 6,
+    kFirstChunkSize  = 1 << kFirstChunkShift,
+    kMaxChunks       = 27, // enough for 2^32 slots
   };
-  using JobSet  = std::unordered_set<AsyncGroup::Job,JobHash,JobEQ>;
 
-  _AsyncGroup(func<void(Error)> cb) : _cb{cb} {}
+  _AsyncGroup(func<void(Error)>&& cb) : _cb{std::move(cb)} {}
   ~_AsyncGroup();
+
+  _AsyncGroupSlot* allocJob();
+  void freeJob(_AsyncGroupSlot*);
+  _AsyncGroupSlot* slot(uint32_t index) const; // nullptr if its chunk hasn't been allocated yet
   void cancelAllJobs();
 
-  func<void(Error)> _cb;
-  JobSet            _jobs;
-  size_t            _nextJobID = 0;
-  OnceFlag          _endFlag;
+  func<void(Error)>         _cb;
+  _AsyncGroupSlot* volatile  _chunks[kMaxChunks] = {};
+  volatile uint32_t         _nslots = 0;      // slots handed out from chunks so far
+  volatile uint64_t         _freeList = 0;    // (ABA tag << 32) | (index + 1), or 0 when empty
+  volatile long             _outstanding = 0; // jobs begun but not yet ended
+  volatile long             _canceled = 0;
+  OnceFlag                  _endFlag;
 };
 
-inline AsyncGroup::AsyncGroup(func<void(Error)> cb) : Ref{new _AsyncGroup{cb}} {}
+inline AsyncGroup::AsyncGroup(func<void(Error)> cb) : Ref{new _AsyncGroup{std::move(cb)}} {}
 inline AsyncGroup::AsyncGroup(const AsyncGroup& rhs) : Ref{rhs} {}
-inline AsyncGroup::AsyncGroup(AsyncGroup&& rhs) : Ref{rhs} {}
+inline AsyncGroup::AsyncGroup(AsyncGroup&& rhs) noexcept : Ref{std::move(rhs)} {}
 
 
-} // namespace
\ No newline at end of file
+} // namespace
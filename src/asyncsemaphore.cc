@@ -0,0 +1,124 @@
+#include "asyncsemaphore.hh"
+#include "executor.hh"
+#include "ref.hh"
+
+#include <sys/resource.h>
+
+namespace rx {
+
+
+struct Ticket : SafeRefCounted<Ticket> {
+  // Referenced by the release closure handed to an op, which the op may capture in closures that
+  // are destroyed on other threads, e.g. an Executor request's work when it's canceled before it
+  // runs. Only the count is shared; the fields are used on the loop thread.
+  enum State { Waiting, Running, Done };
+  Ticket(AsyncSemaphore::Op&& op) : op{fwdarg(op)} {}
+  AsyncSemaphore::Op op;
+  AsyncCanceler      canceler; // of the started operation
+  State              state = Waiting;
+};
+
+
+struct AsyncSemaphore::Imp {
+  size_t                   limit;
+  size_t                   inflight = 0;
+  size_t                   nwaiting = 0; // `queue` minus canceled tickets
+  std::deque<Ticket::Ref>  queue;
+  bool                     dispatching = false;
+
+  void start(const Ticket::Ref& t) {
+    t->state = Ticket::Running;
+    ++inflight;
+    auto op = std::move(t->op);
+    auto canceler = op([this, t]{ release(t.self); });
+    if (t->state == Ticket::Running) {
+      t->canceler = std::move(canceler);
+    } // else it has already completed
+  }
+
+  void release(Ticket* t) {
+    if (t->state != Ticket::Running) {
+      return; // already released, or canceled
+    }
+    t->state = Ticket::Done;
+    t->canceler = nullptr;
+    --inflight;
+    dispatch();
+  }
+
+  void dispatch() {
+    // Operations that complete right away release from within `start`. Rather than recursing
+    // once per queued operation we let the outermost call do the work.
+    if (dispatching) return;
+    dispatching = true;
+    while (inflight < limit && !queue.empty()) {
+      auto t = std::move(queue.front());
+      queue.pop_front();
+      if (t->state == Ticket::Waiting) {
+        --nwaiting;
+        start(t);
+      }
+    }
+    dispatching = false;
+  }
+
+  void cancel(Ticket* t) {
+    if (t->state == Ticket::Waiting) {
+      t->state = Ticket::Done;
+      t->op = nullptr;
+      --nwaiting; // removed from `queue` when it reaches the front
+    } else if (t->state == Ticket::Running) {
+      auto canceler = std::move(t->canceler);
+      release(t);
+      if (canceler) canceler();
+    }
+  }
+};
+
+
+AsyncSemaphore::AsyncSemaphore(size_t limit) : self{new Imp} {
+  assert(limit > 0);
+  self->limit = limit;
+}
+
+
+AsyncSemaphore::~AsyncSemaphore() {
+  delete self;
+  self = nullptr;
+}
+
+
+size_t AsyncSemaphore::limit() const { return self->limit; }
+size_t AsyncSemaphore::inflight() const { return self->inflight; }
+size_t AsyncSemaphore::waiting() const { return self->nwaiting; }
+
+
+AsyncCanceler AsyncSemaphore::run(Op&& op) {
+  Ticket::Ref t{new Ticket{fwdarg(op)}};
+  if (self->inflight < self->limit && self->nwaiting == 0) {
+    self->start(t);
+  } else {
+    self->queue.emplace_back(t);
+    ++self->nwaiting;
+  }
+  return [imp = self, t]{
+    if (t) {
+      imp->cancel(t.self);
+      t.resetSelf();
+    }
+  };
+}
+
+
+size_t AsyncSemaphore::fileLimit() {
+  size_t limit = 256;
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+    limit = std::max<size_t>(1, (size_t)rl.rlim_cur / 2);
+  }
+  // More than a handful of requests queued per thread doesn't make I/O any faster
+  return std::min(limit, Executor::io().size() * 8);
+}
+
+
+} // namespace
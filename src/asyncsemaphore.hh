@@ -0,0 +1,50 @@
+#pragma once
+#include "asynccanceler.hh"
+namespace rx {
+
+// Limits how many asynchronous operations are in flight at once. Operations beyond the limit
+// wait in FIFO order and are started as earlier ones release their slot.
+//
+// Not thread safe: use it, and call `release` and cancelers, on a single loop thread. A release
+// function may however be destroyed on any thread. The semaphore must outlive the operations
+// started through it.
+//
+struct AsyncSemaphore {
+  using Release = func<void()>;
+  using Op = func<AsyncCanceler(Release&&)>;
+
+  explicit AsyncSemaphore(size_t limit);
+  ~AsyncSemaphore();
+
+  AsyncCanceler run(Op&&);
+    // Call `op` once a slot is free, which might be right away. `op` starts some operation and
+    // returns its canceler, and must arrange for `release` to be called when the operation
+    // completes. Canceling a waiting op means it's never called; canceling a started one calls
+    // its canceler and releases its slot.
+
+  size_t limit() const;
+  size_t inflight() const; // started and not yet released
+  size_t waiting() const;  // waiting for a slot
+
+  static size_t fileLimit();
+    // A sensible limit for operations that each hold a file open: half of RLIMIT_NOFILE's soft
+    // limit, leaving room for the rest of the process, and no more than the I/O executor can
+    // keep busy.
+
+private:
+  struct Imp; Imp* self;
+};
+
+/* Example
+
+AsyncSemaphore& files = Async::main().fileLimiter();
+auto canceler = files.run([=](AsyncSemaphore::Release&& release) {
+  return fs::readfile(Async::main(), path, [=, release = std::move(release)](Error err, ...) {
+    release();
+    ...
+  });
+});
+
+*/
+
+} // namespace
@@ -0,0 +1,155 @@
+#include "buildhistory.hh"
+#include "fs.hh"
+
+namespace rx {
+
+static const char     kHeader[] = "rxbuildhistory 1\n";
+static const uint32_t kMaxAge = 50;
+  // Tasks that haven't run in this many builds are forgotten
+static const uint64_t kDefaultDuration = 100000000; // 100ms
+static const uint64_t kDefaultNsPerByte = 1000;
+  // Guesses for tasks of a kind that has never run before
+
+
+static bool ParseKind(const char* p, const char* e, TaskGraph::Kind& kind) {
+  for (size_t i = 0; i <= (size_t)TaskGraph::Kind::Link; ++i) {
+    auto* name = TaskGraph::kindName((TaskGraph::Kind)i);
+    if (strlen(name) == (size_t)(e - p) && memcmp(name, p, e - p) == 0) {
+      kind = (TaskGraph::Kind)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static bool ParseUInt(const char*& p, const char* e, uint64_t& v) {
+  // Parses a decimal number followed by a space
+  v = 0;
+  const char* start = p;
+  while (p != e && *p >= '0' && *p <= '9') {
+    v = v * 10 + (*p++ - '0');
+  }
+  if (p == start || p == e || *p != ' ') return false;
+  ++p;
+  return true;
+}
+
+
+void BuildHistory::parse(const char* p, size_t z) {
+  const char* e = p + z;
+  size_t hz = sizeof(kHeader) - 1;
+  if (z < hz || memcmp(p, kHeader, hz) != 0) {
+    return; // written by some other version
+  }
+  p += hz;
+  while (p != e) {
+    auto* nl = (const char*)memchr(p, '\n', e - p);
+    if (nl == nullptr) nl = e;
+    auto* sp = (const char*)memchr(p, ' ', nl - p);
+    Kind kind;
+    uint64_t size, age, duration;
+    if (sp != nullptr && ParseKind(p, sp, kind) &&
+        ParseUInt(++sp, nl, size) && ParseUInt(sp, nl, age) && ParseUInt(sp, nl, duration) &&
+        sp != nl)
+    {
+      // Every load is a new build, so everything ages by one until it's recorded again
+      put({kind, string{sp, nl}}, Entry{size, duration, (uint32_t)std::min<uint64_t>(age + 1,
+                                                                                    kMaxAge + 1)});
+    }
+    p = (nl == e) ? e : nl + 1;
+  }
+}
+
+
+Error BuildHistory::load(const string& filename) {
+  fs::Stat st;
+  auto err = fs::stat(filename, st);
+  if (err) return (err.code() == (Error::Code)UV_ENOENT) ? Error{} : err;
+  if (st.size == 0) return nullptr; // can't mmap an empty file
+  fs::FileData d;
+  err = fs::readfile(filename, st.size, d);
+  if (!err) parse(d.data(), d.size());
+  return err;
+}
+
+
+string BuildHistory::serialize() const {
+  string s{kHeader};
+  for (auto& kv : _entries) {
+    auto& ent = kv.second;
+    if (ent.age > kMaxAge) continue;
+    s += TaskGraph::kindName(kv.first.first);
+    s += ' ';
+    s += std::to_string(ent.size);
+    s += ' ';
+    s += std::to_string(ent.age);
+    s += ' ';
+    s += std::to_string(ent.duration);
+    s += ' ';
+    s += kv.first.second;
+    s += '\n';
+  }
+  return s;
+}
+
+
+Error BuildHistory::save(const string& filename) {
+  if (!_dirty) return nullptr;
+  auto s = serialize();
+  auto err = fs::writefile(filename, s.data(), s.size(), fs::FSync::None);
+  if (!err) _dirty = false;
+  return err;
+}
+
+
+void BuildHistory::addTotals(Kind kind, const Entry& ent, int sign) {
+  auto& t = _totals[(size_t)kind];
+  t.count += sign;
+  t.duration += sign * ent.duration;
+  if (ent.size != 0) {
+    t.sizedDuration += sign * ent.duration;
+    t.size += sign * ent.size;
+  }
+}
+
+
+void BuildHistory::put(const Key& key, const Entry& ent) {
+  auto r = _entries.emplace(key, ent);
+  if (!r.second) {
+    addTotals(key.first, r.first->second, -1);
+    r.first->second = ent;
+  }
+  addTotals(key.first, ent, 1);
+}
+
+
+uint64_t BuildHistory::estimate(Kind kind, const string& name, uint64_t sizeHint) const {
+  auto I = _entries.find(Key{kind, name});
+  if (I != _entries.end()) {
+    return I->second.duration;
+  }
+  auto& t = _totals[(size_t)kind];
+  if (sizeHint != 0 && t.size != 0) {
+    return (uint64_t)((double)sizeHint * ((double)t.sizedDuration / (double)t.size));
+  }
+  if (t.count != 0) {
+    return t.duration / t.count;
+  }
+  return kDefaultDuration + sizeHint * kDefaultNsPerByte;
+}
+
+
+void BuildHistory::record(Kind kind, const string& name, uint64_t sizeHint, uint64_t duration) {
+  Key key{kind, name};
+  auto I = _entries.find(key);
+  if (I != _entries.end()) {
+    // Moving average which gives the latest run a weight of 1/4
+    duration = (I->second.duration * 3 + duration) / 4;
+  }
+  put(key, Entry{sizeHint, duration, 0});
+  _dirty = true;
+}
+
+
+} // namespace
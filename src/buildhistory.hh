@@ -0,0 +1,63 @@
+#pragma once
+#include "taskgraph.hh"
+namespace rx {
+using std::string;
+
+// Remembers how long build tasks took, so that the next build can estimate how long each task
+// will take and start the longest chains of dependent tasks first. Kept in a small text file in
+// the package directory, one task per line:
+//
+//   <kind> <size> <age> <duration> <name>
+//
+// `size` is the task's size hint (e.g. bytes of source), `age` counts the builds since the task
+// last ran and `duration` is in nanoseconds. Durations are smoothed with an exponentially
+// weighted moving average, so a single slow run doesn't throw off future estimates.
+//
+// Not thread safe.
+//
+struct BuildHistory {
+  using Kind = TaskGraph::Kind;
+
+  Error load(const string& filename);
+    // Read a history file. A missing or unrecognized file is not an error.
+  Error save(const string& filename);
+    // Atomically replace the history file, dropping tasks that haven't run in a long while.
+    // Does nothing if nothing was recorded since the last load or save.
+  void parse(const char* p, size_t z);
+  string serialize() const;
+
+  uint64_t estimate(Kind, const string& name, uint64_t sizeHint) const;
+    // Expected duration of a task, in nanoseconds. Tasks that have run before are estimated from
+    // their history. New tasks are estimated from their size hint and how fast other tasks of the
+    // same kind processed their input, or from the average duration of the kind when there's no
+    // size to go by.
+  void record(Kind, const string& name, uint64_t sizeHint, uint64_t duration);
+    // Remember how long a task took to complete successfully.
+
+  size_t size() const { return _entries.size(); }
+  bool dirty() const { return _dirty; }
+
+private:
+  struct Entry {
+    uint64_t size;
+    uint64_t duration;
+    uint32_t age;
+  };
+  struct KindTotals {
+    // Sums over all entries of a kind, for estimating tasks without history
+    uint64_t count = 0;
+    uint64_t duration = 0;
+    uint64_t sizedDuration = 0; // of entries with a size
+    uint64_t size = 0;
+  };
+  using Key = std::pair<Kind,string>;
+
+  void put(const Key&, const Entry&);
+  void addTotals(Kind, const Entry&, int sign);
+
+  std::map<Key,Entry> _entries;
+  KindTotals          _totals[(size_t)Kind::Link + 1];
+  bool                _dirty = false;
+};
+
+} // namespace
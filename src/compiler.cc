@@ -3,6 +3,10 @@
 #include "join.hh"
 #include "time.hh"
 #include "deps.hh"
+#include "trace.hh"
+#include "taskgraph.hh"
+#include "buildhistory.hh"
+#include "executor.hh"
 
 using namespace llvm;
 using namespace clang;
@@ -24,6 +28,13 @@ struct Compiler::Imp {
   string             pkgDir;
     // Where compiled packages are stored for the current target configuration
 
+  fs::SyncBatch*     syncBatch = nullptr; // see setSyncBatch
+  const DepsDB*      depsDB = nullptr;    // see setDepsDB
+
+  BuildHistory       history;
+  bool               historyLoaded = false;
+    // How long building packages took, read from pkgDir the first time packages are imported
+
   Imp()
     : targetTriple{llvm::Triple::normalize(llvm::sys::getProcessTriple())}
     {}
@@ -38,6 +49,9 @@ Compiler::~Compiler() {
 
 
 Compiler::Compiler() : self{new Imp} {
+  // Packages are built concurrently by separate Compiler instances
+  RX_ONCE({ llvm::llvm_start_multithreaded(); });
+
   auto& compiler = self->compiler;
 
   // Diagnostics
@@ -188,20 +202,28 @@ Compiler::Compiler() : self{new Imp} {
 const string& Compiler::rxDir() const { return self->rxDir; }
 const string& Compiler::pkgDir() const { return self->pkgDir; }
 
-string Compiler::srcPathForPkg(const Pkg& pkg) {
-  return self->rxDir + "/src/" + pkg.name();
+fs::Path Compiler::srcPathForPkg(const Pkg& pkg) {
+  fs::Path path{self->rxDir};
+  path.append("src").append(pkg.name());
+  return path;
 }
 
-string Compiler::binPathForPkg(const Pkg& pkg) {
-  return self->pkgDir + "/" + pkg.name();
+fs::Path Compiler::binPathForPkg(const Pkg& pkg) {
+  fs::Path path{self->pkgDir};
+  path.append(pkg.name());
+  return path;
 }
 
-string Compiler::PCHPathForPkg(const Pkg& pkg) {
-  return binPathForPkg(pkg) + ".pch";
+fs::Path Compiler::PCHPathForPkg(const Pkg& pkg) {
+  auto path = binPathForPkg(pkg);
+  path.concat(".pch");
+  return path;
 }
 
-string Compiler::PCHPathForPkgUnionID(const PkgUnionID& pkgUnionID) {
-  return self->pkgDir + "/.union/" + pkgUnionID.toString() + ".pch";
+fs::Path Compiler::PCHPathForPkgUnionID(const PkgUnionID& pkgUnionID) {
+  fs::Path path{self->pkgDir};
+  path.append(".union").append(pkgUnionID.toString()).concat(".pch");
+  return path;
 }
 
 
@@ -250,34 +272,29 @@ void Compiler::clearOutputFiles() {
 }
 
 
-bool Compiler::setOutputFile(const string& filename) {
-  self->compiler.getFrontendOpts().OutputFile = filename;
-
-  // Track the output file and create any intermediate directories
-  string Error, OutputPathName, TempPathName;
-  llvm::raw_fd_ostream* OS = self->compiler.createOutputFile(
-    filename,
-    Error,
-    /*Binary=*/true,
-    /*RemoveFileOnSignal=*/true, // not thread-safe as it relies on signals (doh!)
-    /*InFile=*/"",
-    /*Extension=*/"",
-    /*UseTemporary=*/true,
-    /*CreateMissingDirectories=*/true,
-    &OutputPathName,
-    &TempPathName
-  );
-  if (!OS) {
-    self->compiler.getDiagnostics().Report(diag::err_fe_unable_to_open_output) << filename << Error;
-    clearOutputFiles();
+bool Compiler::writeOutputFile(const string& filename, const string& data) {
+  trace::Scope ts{"compiler", "writeOutput", filename.c_str()};
+  auto sync = self->syncBatch ? fs::FSync::Batch : fs::FSync::File;
+  auto err = fs::writefile(filename, data.data(), data.size(), sync, self->syncBatch);
+  if (err) {
+    self->compiler.getDiagnostics().Report(diag::err_fe_unable_to_open_output)
+      << filename << err.message();
     return false;
   }
-  self->compiler.addOutputFile({ (OutputPathName != "-") ? OutputPathName : "", TempPathName, OS });
-
   return true;
 }
 
 
+void Compiler::setSyncBatch(fs::SyncBatch* batch) {
+  self->syncBatch = batch;
+}
+
+
+void Compiler::setDepsDB(const DepsDB* db) {
+  self->depsDB = db;
+}
+
+
 void Compiler::setIncludePCH(const string& filename) {
   assert(self->compiler.getPreprocessorOpts().ImplicitPCHInclude.empty());
   self->compiler.getPreprocessorOpts().ImplicitPCHInclude = filename;
@@ -288,21 +305,50 @@ void Compiler::clearIncludePCH() {
 }
 
 
+namespace {
+struct BufferedPCHAction final : GeneratePCHAction {
+  // Generates a PCH into memory rather than into an output file created by clang, so that it can
+  // be written with Compiler::writeOutputFile. Otherwise the same as GeneratePCHAction.
+  string                   data;
+  llvm::raw_string_ostream os{data};
+
+  ASTConsumer* CreateASTConsumer(CompilerInstance& CI, StringRef InFile) override {
+    string sysroot = CI.getHeaderSearchOpts().Sysroot;
+    if (CI.getFrontendOpts().RelocatablePCH && sysroot.empty()) {
+      CI.getDiagnostics().Report(diag::err_relocatable_without_isysroot);
+      return nullptr;
+    }
+    if (!CI.getFrontendOpts().RelocatablePCH) {
+      sysroot.clear();
+    }
+    return new PCHGenerator(CI.getPreprocessor(), CI.getFrontendOpts().OutputFile, nullptr,
+                            sysroot, &os);
+  }
+
+  const string& finish() { os.flush(); return data; }
+};
+} // namespace
+
+
 bool Compiler::buildPCHFileFromSource(
     const string& outputFilename,
     const string& displayFilename,
     const string& source)
 {
-  setOutputFile(outputFilename);
-  GeneratePCHAction action;
-  return executeActionWithSource(action, displayFilename, source);
+  trace::Scope ts{"compiler", "buildPCH", displayFilename.c_str()};
+  BufferedPCHAction action;
+  self->compiler.getFrontendOpts().OutputFile = outputFilename; // recorded in the PCH
+  return executeActionWithSource(action, displayFilename, source) &&
+         writeOutputFile(outputFilename, action.finish());
 }
 
 
 bool Compiler::buildPCHFileFromFile(const string& outputFilename, const string& sourceFilename) {
-  setOutputFile(outputFilename);
-  GeneratePCHAction action;
-  return executeActionWithFile(action, sourceFilename);
+  trace::Scope ts{"compiler", "buildPCH", sourceFilename.c_str()};
+  BufferedPCHAction action;
+  self->compiler.getFrontendOpts().OutputFile = outputFilename;
+  return executeActionWithFile(action, sourceFilename) &&
+         writeOutputFile(outputFilename, action.finish());
 }
 
 
@@ -324,18 +370,19 @@ string Compiler::includeDirectivesForPkg(const Pkg& pkg) {
   // User packages
   // TODO: Locate in file system.
   // E.g. foo/a/bar might 
-  auto srcPath = srcPathForPkg(pkg) + ".h"; // e.g. "rxdir/src/foo/a/bar.h"
-  if (srcPath.empty()) {
+  auto srcPath = srcPathForPkg(pkg); // e.g. "rxdir/src/foo/a/bar"
+  srcPath.concat(".h");
+  if (srcPath.empty() || srcPath.overflow()) {
     cerr << "Unknown package '" << pkg << "'" << endl;
     return {};
   }
-  return "#include \"" + srcPath + "\"";
+  return "#include \"" + srcPath.str() + "\"";
 }
 
 
-static bool FileExists(const std::string& filename, Time* mtimeOut=nullptr) {
+static bool FileExists(const char* filename, Time* mtimeOut=nullptr) {
   struct stat st;
-  if (::stat(filename.c_str(), &st) == 0 &&
+  if (::stat(filename, &st) == 0 &&
      (((st.st_mode & S_IFMT) == S_IFREG) || ((st.st_mode & S_IFMT) == S_IFLNK)) )
   {
     if (mtimeOut) *mtimeOut = st.st_mtimespec;
@@ -345,11 +392,24 @@ static bool FileExists(const std::string& filename, Time* mtimeOut=nullptr) {
 }
 
 
+static uint64_t PkgSourceSize(Compiler& c, const Pkg& pkg) {
+  // A rough measure of the work needed to build a package's interface, used to estimate build
+  // times of packages that have no build history
+  auto* s = FindStdPkgSource(pkg);
+  if (s != nullptr) return s->size();
+  auto path = c.srcPathForPkg(pkg);
+  path.concat(".h");
+  fs::Stat st;
+  return (!path.overflow() && !fs::stat(path, st)) ? st.size : 0;
+}
+
+
 Compiler::PkgStatus Compiler::checkPkg(const Pkg& pkg/*, const Time& parentMTime*/) {
+  trace::Scope ts{"compiler", "checkPkg", pkg.name().c_str()};
   auto pkgPCH = PCHPathForPkg(pkg);
   cerr << "Checking package " << pkg << "  pch=" << pkgPCH << endl;
   Time mtime;
-  if (FileExists(pkgPCH, &mtime)) {
+  if (!pkgPCH.overflow() && FileExists(pkgPCH.c_str(), &mtime)) {
     cerr << "up-to-date" << endl;
     // TODO: check source for changes to interface and implementation
     return PkgStatus::UpToDate;
@@ -377,7 +437,7 @@ Compiler::PkgStatus Compiler::checkAndFixPkg(const Pkg& pkg, PkgFixes fixes) {
       if (fixes == PkgFixes::All) {
         // Rebuild interface
         auto pkgPCH = PCHPathForPkg(pkg);
-        if (!buildPkgInterface(pkg, pkgPCH)) {
+        if (!buildPkgInterface(pkg, pkgPCH.str())) {
           return PkgStatus::Error;
         }
       }
@@ -394,94 +454,151 @@ Compiler::PkgStatus Compiler::checkAndFixPkg(const Pkg& pkg, PkgFixes fixes) {
 }
 
 
+static const Error::Static kBuildFailed{0, "build failed"};
+  // Details have already been reported by clang's diagnostics
+
+
+static TaskGraph::Action BuildAction(Async& loop, fs::SyncBatch& batch,
+                                     func<bool(Compiler&)>&& build) {
+  // Runs `build` on the CPU executor with a Compiler of its own, since a clang CompilerInstance
+  // can only be used by one thread at a time. Output files are synced by `batch`.
+  return [&loop, &batch, build = fwdarg(build)](TaskGraph::Done&& done) mutable {
+    return Executor::cpu().run(loop, [&batch, build = std::move(build), done = std::move(done)]()
+                                     mutable -> func<void()> {
+      Compiler compiler;
+      compiler.setSyncBatch(&batch);
+      bool ok = build(compiler);
+      return [ok, done = std::move(done)]{
+        done(ok ? Error{} : Error{kBuildFailed});
+      };
+    });
+  };
+}
+
+
 bool Compiler::importPkgs(
     const PkgImports& packages,
     string&           PCHFilenameOut,
     string&           srcPreambleOut)
 {
   assert(!packages.empty());
-  // One day we will perform epic dependency resolution here...  :-o
-  // For now let's just do it the blunt and slow way.
-
-  // First of we need a single package interface (which might or might not be used in as the base
-  // of a union.) It's important that this PCH exists -- one might think that we should just check
-  // for a union PCH if we need a union PCH, but since union PCHs actually *reference* its base PCH,
-  // we require the base PCH to exist.
-  auto basePkg = *packages.cbegin();
-  auto basePkgStatus = checkAndFixPkg(basePkg, PkgFixes::All);
-  if (basePkgStatus == PkgStatus::Error) return false;
-
-  auto basePkgPCH = PCHPathForPkg(basePkg);
-
-  if (packages.size() > 1) {
-    // We need a package union interface.
-
-    // Check all packages in addition to the base package
-    std::vector<std::pair<const Pkg*,PkgStatus>> outdatedPkgs;
-    std::vector<const Pkg*>                      outdatedPkgInterfaces;
-    std::vector<const Pkg*>                      outdatedPkgImpls;
-
-    auto pkgI = packages.cbegin();
-    auto pkgE = packages.cend();
-    while (++pkgI != pkgE) {
-      // Fix only missing implementations
-      auto r = checkAndFixPkg(*pkgI, PkgFixes::BuildImpl);
-      switch (r) {
-        case PkgStatus::Error: return false;
-        case PkgStatus::Outdated: {
-          outdatedPkgs.emplace_back(&*pkgI, r);
-          outdatedPkgInterfaces.emplace_back(&*pkgI);
-          outdatedPkgImpls.emplace_back(&*pkgI);
-          break;
-        }
-        case PkgStatus::InterfaceOutdated: {
-          outdatedPkgs.emplace_back(&*pkgI, r);
-          outdatedPkgInterfaces.emplace_back(&*pkgI);
-          break;
-        }
-        case PkgStatus::ImplOutdated: {
-          outdatedPkgs.emplace_back(&*pkgI, r);
-          outdatedPkgImpls.emplace_back(&*pkgI);
-          break;
-        }
-        default: break;
+  trace::Scope ts{"compiler", "importPkgs"};
+  // Every outdated package gets a task building its interface, and one building its
+  // implementation after it when that's outdated too. A package's interface is built after the
+  // interfaces of the packages it imports, as scanned from its sources and recorded in the
+  // dependency database, and the union interface is built after all of them. Packages that don't
+  // depend on each other are built in parallel.
+  Async loop;
+  fs::SyncBatch syncBatch; // PCHs written by the graph's tasks, synced once they're all done
+  TaskGraph graph{loop};
+  auto historyFilename = self->pkgDir + "/.buildhistory";
+  if (!self->historyLoaded) {
+    self->historyLoaded = true;
+    auto err = self->history.load(historyFilename);
+    if (err) cerr << "Failed to read build history " << historyFilename << ": " << err << endl;
+  }
+  graph.setHistory(&self->history);
+
+  // Note that the first package is the base of a union. It's important that its PCH exists --
+  // one might think that we should just check for a union PCH if we need a union PCH, but since
+  // union PCHs actually *reference* their base PCH, we require the base PCH to exist. Its
+  // interface task, if any, is one of those the union task depends on.
+  std::unordered_map<string,TaskGraph::NodeID> interfaceNodes; // by package name
+  for (auto& pkg : packages) {
+    auto status = checkPkg(pkg);
+    if (status == PkgStatus::Error) return false;
+    if (status == PkgStatus::UpToDate) continue;
+    cerr << "[pkg check] outdated package " << pkg << ": "
+         << ((status == PkgStatus::InterfaceOutdated) ? "interface" :
+             (status == PkgStatus::ImplOutdated)      ? "implementation" :
+                                                        "interface & implementation")
+         << endl;
+    auto size = PkgSourceSize(*this, pkg);
+    bool buildInterface = (status != PkgStatus::ImplOutdated);
+    TaskGraph::NodeID interfaceNode = 0;
+    if (buildInterface) {
+      auto pkgPCH = PCHPathForPkg(pkg).str();
+      interfaceNode = graph.add(TaskGraph::Kind::Interface, pkg.name(), BuildAction(loop, syncBatch,
+        [=](Compiler& c) { return c.buildPkgInterface(pkg, pkgPCH); }),
+        size);
+      interfaceNodes.emplace(pkg.name(), interfaceNode);
+    }
+    if (status != PkgStatus::InterfaceOutdated) {
+      auto implNode = graph.add(TaskGraph::Kind::Compile, pkg.name(), BuildAction(loop, syncBatch,
+        [=](Compiler& c) {
+          return c.checkAndFixPkg(pkg, PkgFixes::BuildImpl) != PkgStatus::Error;
+        }),
+        size);
+      if (buildInterface) {
+        graph.depend(implNode, interfaceNode);
       }
     }
+  }
 
-    // debug print outdated interfaces
-    for (auto& p : outdatedPkgs) {
-      cerr << "[pkg union check] outdated package " << *p.first << ": "
-           << ((p.second == PkgStatus::InterfaceOutdated) ? "interface" :
-               (p.second == PkgStatus::ImplOutdated)      ? "implementation" :
-               (p.second == PkgStatus::Outdated)          ? "interface & implementation" :
-               "UNEXPECTED")
-           << endl;
+  if (self->depsDB && interfaceNodes.size() > 1) {
+    for (auto& pkg : packages) {
+      auto I = interfaceNodes.find(pkg.name());
+      if (I == interfaceNodes.end()) continue;
+      std::unordered_set<string> imports;
+      for (auto& pathname : self->depsDB->pathnames(pkg.name())) {
+        auto* file = self->depsDB->file(pathname);
+        imports.insert(file->imports.begin(), file->imports.end());
+      }
+      for (auto& name : imports) {
+        auto D = interfaceNodes.find(name);
+        if (D != interfaceNodes.end() && D != I) {
+          graph.depend(I->second, D->second);
+        }
+      }
     }
+  }
 
+  auto basePkgPCH = PCHPathForPkg(*packages.cbegin()).str();
+  if (packages.size() > 1) {
+    // We need a package union interface.
     PkgUnionID pkgUnionID(packages);
     auto pkgUnionPCH = PCHPathForPkgUnionID(pkgUnionID);
+    if (pkgUnionPCH.overflow()) {
+      cerr << "Package union path too long: " << pkgUnionPCH << endl;
+      return false;
+    }
 
-    if (basePkgStatus == PkgStatus::UpToDate) cerr << "Checking for " << pkgUnionPCH << endl; // DBG
-
-    if (basePkgStatus != PkgStatus::UpToDate ||
-        !outdatedPkgInterfaces.empty() ||
-        !FileExists(pkgUnionPCH))
-    {
-      // The base of the union has been modified, or the union interface doesn't exist.
+    if (!interfaceNodes.empty() || !FileExists(pkgUnionPCH.c_str())) {
+      // Some interface of the union has been modified, or the union interface doesn't exist.
       // In the future we should try to be clever and #include some packages.
-      if (!buildPkgUnionInterface(pkgUnionID, packages, pkgUnionPCH, basePkgPCH)) {
-        return false;
+      uint64_t unionSize = 0;
+      for (auto& pkg : packages) unionSize += PkgSourceSize(*this, pkg);
+      auto unionNode = graph.add(TaskGraph::Kind::UnionInterface, pkgUnionID.toString(),
+        BuildAction(loop, syncBatch, [=, pkgUnionPCH = pkgUnionPCH.str()](Compiler& c) {
+          return c.buildPkgUnionInterface(pkgUnionID, packages, pkgUnionPCH, basePkgPCH);
+        }),
+        unionSize);
+      for (auto& n : interfaceNodes) {
+        graph.depend(unionNode, n.second);
       }
     }
 
     // Union package
-    PCHFilenameOut.assign(pkgUnionPCH);
+    PCHFilenameOut.assign(pkgUnionPCH.c_str(), pkgUnionPCH.size());
 
   } else {
     // Single package
-    PCHFilenameOut.assign(basePkgPCH);
+    PCHFilenameOut = basePkgPCH;
   }
 
+  Error err;
+  graph.run([&](Error e) { err = e; });
+  loop.run();
+  auto syncErr = syncBatch.flush();
+  if (!err) err = syncErr;
+  auto historyErr = self->history.save(historyFilename);
+  if (historyErr) {
+    cerr << "Failed to write build history " << historyFilename << ": " << historyErr << endl;
+  }
+  if (err) {
+    cerr << "Failed to import packages: " << err << endl;
+    return false;
+  }
   return true;
 }
 
@@ -508,7 +625,7 @@ bool Compiler::buildPkgUnionInterface(
   cerr << "Building package union (" << join(pkgI, pkgE, ", ") << ")" << endl;
 
   // Set the base package interface as the PCH
-  assert(FileExists(basePkgPCHFilename)); // or we called this function w/o making sure it's built
+  assert(FileExists(basePkgPCHFilename.c_str())); // or we called this w/o making sure it's built
   setIncludePCH(basePkgPCHFilename);
 
   // Combine sources for all but the parent package through includes
@@ -552,6 +669,7 @@ llvm::Module* Compiler::buildLLVMModuleFromSource(
     const string& displayFilename,
     const string& source)
 {
+  trace::Scope ts{"compiler", "emitLLVM", displayFilename.c_str()};
   // Execute and check results
   // SyntaxOnlyAction action;
   EmitLLVMOnlyAction action{llvmContext};
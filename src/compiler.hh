@@ -1,5 +1,6 @@
 #pragma once
 #include "pkg.hh"
+#include "path.hh"
 // #include "clang/Frontend/FrontendAction.h"
 // #include "clang/Frontend/FrontendOptions.h"
 // #include "llvm/IR/LLVMContext.h"
@@ -8,6 +9,8 @@
 namespace rx {
 
 using std::string;
+namespace fs { struct SyncBatch; }
+struct DepsDB;
 
 
 struct Compiler final {
@@ -17,18 +20,27 @@ struct Compiler final {
   const string& rxDir() const;
   const string& pkgDir() const;
 
-  string srcPathForPkg(const Pkg&); // e.g. rxdir/src/foo/a/bar
-  string binPathForPkg(const Pkg&); // e.g. rxdir/pkg/target-config/foo/a/bar
-  string PCHPathForPkg(const Pkg&); // e.g. rxdir/pkg/target-config/foo/a/bar.pch
-  string PCHPathForPkgUnionID(const PkgUnionID&);
+  fs::Path srcPathForPkg(const Pkg&); // e.g. rxdir/src/foo/a/bar
+  fs::Path binPathForPkg(const Pkg&); // e.g. rxdir/pkg/target-config/foo/a/bar
+  fs::Path PCHPathForPkg(const Pkg&); // e.g. rxdir/pkg/target-config/foo/a/bar.pch
+  fs::Path PCHPathForPkgUnionID(const PkgUnionID&);
     // e.g. rxdir/pkg/target-config/.union/foo.a.bar+lol.cat.pch
 
   bool executeAction(clang::FrontendAction&, clang::FrontendInputFile&&);
   bool executeActionWithSource(clang::FrontendAction&, const string& filename, const string& s);
   bool executeActionWithFile(clang::FrontendAction&, const string& filename);
 
-  bool setOutputFile(const string& filename);
   void clearOutputFiles();
+  bool writeOutputFile(const string& filename, const string& data);
+    // Atomically replace `filename` with `data`, reporting failure through clang's diagnostics.
+    // Output is never written through clang's own output files, which rely on signal handlers that
+    // aren't thread safe, since packages are built concurrently.
+  void setSyncBatch(fs::SyncBatch*);
+    // Defer syncing output files to `batch`, which the caller flushes. Without a batch, output
+    // files are synced as they are written.
+  void setDepsDB(const DepsDB*);
+    // The database in which the imports of packages' sources are recorded. Imported packages'
+    // interfaces are then built before those of packages importing them.
 
   void setIncludePCH(const string& filename);
   void clearIncludePCH();
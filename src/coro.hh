@@ -0,0 +1,213 @@
+#pragma once
+#include "fs.hh"
+#include "ref.hh"
+#include "executor.hh"
+
+// Coroutine adapters for the async API. Only available when the compiler supports C++ coroutines;
+// check RX_HAVE_COROUTINES before using.
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define RX_HAVE_COROUTINES 1
+namespace rx {
+
+struct AsyncTask {
+  // Return type of a coroutine. The coroutine is created suspended and runs when `start` is
+  // called, on the calling thread, until its first co_await of an async operation.
+  //
+  //   AsyncTask loadConfig(Async& a, string path, func<void(Error)> cb) {
+  //     fs::Stat st;
+  //     auto err = co_await fs::statAsync(a, path, st);
+  //     if (!err) {
+  //       fs::FileData d;
+  //       err = co_await fs::readfileAsync(a, path, st.size, d);
+  //     }
+  //     cb(err);
+  //   }
+  //   auto canceler = loadConfig(Async::main(), "rx.conf", cb).start();
+  //
+  // Calling the canceler follows the usual AsyncCanceler semantics: any in-flight operation is
+  // canceled and the coroutine is destroyed instead of being resumed, so nothing after the
+  // pending co_await runs.
+  struct State : SafeRefCounted<State> {
+    volatile long           canceled = 0;
+    uv_req_t*               inflight = nullptr; // libuv request the coroutine is waiting for
+    AsyncCanceler           work;    // or executor work, which never resumes once canceled,
+    std::coroutine_handle<> waiting; // so canceling it destroys this coroutine
+  };
+
+  struct promise_type {
+    State::Ref state{new State};
+    AsyncTask get_return_object() {
+      return AsyncTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { abort(); }
+  };
+
+  AsyncTask(AsyncTask&& other) : _h{other._h} { other._h = nullptr; }
+  AsyncTask(const AsyncTask&) = delete;
+  ~AsyncTask() { if (_h) _h.destroy(); } // never started
+
+  AsyncCanceler start();
+
+private:
+  explicit AsyncTask(std::coroutine_handle<promise_type> h) : _h{h} {}
+  std::coroutine_handle<promise_type> _h;
+};
+
+
+template <typename Req>
+struct AsyncAwaiter {
+  // Base of awaiters for libuv requests. The request lives in the awaiter and thus in the
+  // coroutine frame, so no separate allocation is needed. Subclasses implement
+  // `int submit(uv_loop_t*)`, which starts the request with `Sub::complete` as the callback.
+  explicit AsyncAwaiter(Async& a) : async{a} { uvreq.data = (void*)this; }
+  AsyncAwaiter(const AsyncAwaiter&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  Error await_resume() { return std::move(err); }
+
+  template <typename Sub>
+  bool suspend(Sub* sub, std::coroutine_handle<AsyncTask::promise_type> h) {
+    handle = h;
+    state = h.promise().state.self;
+    if (state->canceled) {
+      h.destroy(); // Note: `this` is part of the frame and no longer valid
+      return true;
+    }
+    auto st = sub->submit(async.uvloop());
+    if (st != 0) {
+      err = UVError(st);
+      return false; // resume right away
+    }
+    state->inflight = (uv_req_t*)&uvreq;
+    return true;
+  }
+
+  void finish() {
+    // Called from the request's callback on the loop thread
+    state->inflight = nullptr;
+    if (state->canceled) {
+      handle.destroy();
+    } else {
+      handle.resume();
+    }
+  }
+
+  Async&                                        async;
+  Req                                           uvreq;
+  Error                                         err;
+  AsyncTask::State*                             state = nullptr; // owned by the promise
+  std::coroutine_handle<AsyncTask::promise_type> handle;
+};
+
+
+namespace fs {
+
+struct StatAwaiter : AsyncAwaiter<uv_fs_t> {
+  StatAwaiter(Async& a, const string& path, Stat& st, bool follow)
+    : AsyncAwaiter{a}, path{path}, st{st}, follow{follow} {}
+  bool await_suspend(std::coroutine_handle<AsyncTask::promise_type> h) { return suspend(this, h); }
+  int submit(uv_loop_t* loop) {
+    return follow ? uv_fs_stat(loop, &uvreq, path.c_str(), &complete) :
+                    uv_fs_lstat(loop, &uvreq, path.c_str(), &complete);
+  }
+  static void complete(uv_fs_t* r) {
+    auto* self = (StatAwaiter*)r->data;
+    self->err = UVError((int)r->result);
+    if (!self->err) self->st = Stat{*r};
+    uv_fs_req_cleanup(r);
+    self->finish();
+  }
+  const string& path; // kept alive by the caller's frame for the duration of co_await
+  Stat&         st;
+  bool          follow;
+};
+
+inline StatAwaiter statAsync(Async& a, const string& path, Stat& st) {
+  return {a, path, st, true};
+}
+inline StatAwaiter lstatAsync(Async& a, const string& path, Stat& st) {
+  return {a, path, st, false};
+}
+  // Awaitable equivalents of `stat` and `lstat`. Evaluates to an Error and stores the result in
+  // `st`: `auto err = co_await fs::statAsync(a, path, st);`
+
+
+struct ReadFileAwaiter {
+  // Reads on the I/O executor, like `readfile`. The worker only touches its own copies, never the
+  // coroutine frame, so the frame can be destroyed as soon as the read is canceled.
+  ReadFileAwaiter(Async& a, const string& path, size_t size, FileData& d)
+    : async{a}, path{path}, size{size}, data{d} {}
+  ReadFileAwaiter(const ReadFileAwaiter&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  Error await_resume() { return std::move(err); }
+  bool await_suspend(std::coroutine_handle<AsyncTask::promise_type> h) {
+    state = h.promise().state.self;
+    if (state->canceled) {
+      h.destroy();
+      return true;
+    }
+    state->waiting = h;
+    state->work = Executor::io().run(async, [self = this, path = path, size = size]()
+                                            -> func<void()> {
+      FileData d;
+      auto err = readfile(path, size, d);
+      return [=, d = std::move(d)]() mutable {
+        // On the loop thread, and only if not canceled
+        auto h = self->state->waiting;
+        self->state->waiting = nullptr;
+        self->state->work = nullptr;
+        self->err = err;
+        self->data = std::move(d);
+        h.resume();
+      };
+    });
+    return true;
+  }
+
+  Async&            async;
+  const string&     path;
+  size_t            size;
+  FileData&         data;
+  Error             err;
+  AsyncTask::State* state = nullptr; // owned by the promise
+};
+
+inline ReadFileAwaiter readfileAsync(Async& a, const string& path, size_t size, FileData& d) {
+  return {a, path, size, d};
+}
+inline ReadFileAwaiter readfileAsync(Async& a, const string& path, FileData& d) {
+  return {a, path, 0, d};
+}
+  // Awaitable equivalent of `readfile`: `auto err = co_await fs::readfileAsync(a, path, d);`
+
+} // namespace fs
+
+
+inline AsyncCanceler AsyncTask::start() {
+  assert(_h);
+  auto state = _h.promise().state;
+  auto h = _h;
+  _h = nullptr;
+  h.resume();
+  return [state]{
+    if (state && __sync_bool_compare_and_swap(&state->canceled, 0L, 1L)) {
+      if (state->inflight) {
+        uv_cancel(state->inflight);
+      } else if (state->work) {
+        auto work = std::move(state->work);
+        work();
+        auto h = state->waiting;
+        state->waiting = nullptr;
+        h.destroy();
+      }
+      state.resetSelf();
+    }
+  };
+}
+
+} // namespace
+#endif // __cpp_impl_coroutine
@@ -1,5 +1,9 @@
 #include "deps.hh"
 #include "time.hh"
+#include "asyncsemaphore.hh"
+#include "executor.hh"
+#include "importscan.hh"
+#include "pkgiface.hh"
 namespace rx {
 
 using std::cerr;
@@ -17,7 +21,8 @@ PkgDeps::PkgDeps(
   : _rxDir{rxDir}
   , _pkgDir{pkgDir}
   , _pkg{pkg}
-  , _resolveCB{resolveCB}
+  , _resolveCB{std::move(resolveCB)}
+  , _srcFiles{&_arena}
 {}
 
 
@@ -26,19 +31,25 @@ static const std::set<string> kSourceFileExts{string{"rx"}, string{"cc"}};
 
 
 AsyncCanceler PkgDeps::findSrcFilesAtDir(const string& path, func<void(Error,SrcFileSet&&)> cb) {
-  SrcFileSet* srcFiles = new SrcFileSet;
+  SrcFileSet* srcFiles = new SrcFileSet{&_arena};
+  fs::IgnoreRules ignore;
+  auto err = ignore.load(fs::pathJoin(path, ".rxignore"));
+    // Small enough that reading it synchronously is cheaper than a round-trip through the loop
+  if (err) DBG("ignoring unreadable .rxignore in " << path << ": " << err)
   return fs::scandir(
     path,
     Async::main(),
     /*depth=*/0,
+    std::move(ignore),
     [=](const string& dirname, const string& filename, const fs::Stat& st) mutable {
       auto ext = fs::pathExt(filename);
       if (st.isFile() && kSourceFileExts.find(ext) != kSourceFileExts.end()) {
-        srcFiles->emplace(_pkg, st, filename, ext);
+        srcFiles->emplace(_pkg, st, filename, ext, _arena);
       }
       return true;
     },
-    [=](Error err) mutable {
+    [=, cb = std::move(cb)](Error err) mutable {
+      srcFiles->sort();
       cb(err, SrcFileSet{std::move(*srcFiles)});
       delete srcFiles;
     }
@@ -46,30 +57,106 @@ AsyncCanceler PkgDeps::findSrcFilesAtDir(const string& path, func<void(Error,Src
 }
 
 
+static bool IsRxFile(const char* pathname) {
+  auto z = strlen(pathname);
+  return z > 3 && memcmp(pathname + z - 3, ".rx", 3) == 0;
+}
+
+
+bool PkgDeps::isUpToDate(const SrcFile& srcFile) const {
+  if (!_db) return false;
+  auto* rec = _db->file(srcFile.pathname());
+  return rec && rec->matches(srcFile.id(), srcFile.size(), srcFile.mtime());
+}
+
+
 AsyncCanceler PkgDeps::processSrcFiles(func<void(Error)> cb) {
-  AsyncGroup asyncGroup{cb};
-
-  auto I = _srcFiles.begin();
-  auto E = _srcFiles.end();
-
-  for (; I != E; ++I) {
-    SrcFile* srcFile = const_cast<SrcFile*>(&*I); // WTF?! Should be non-const already, right?
-    DBG("  - '" << srcFile->filename() <<
-        "' at '" << fs::pathJoin(_rxDir, "src", srcFile->pathname()) << "'");
-
-    auto* job = asyncGroup.begin();
-    *job = fs::readfile(
-      Async::main(),
-      fs::pathJoin(_rxDir, "src", srcFile->pathname()),
-      srcFile->stat().size,
-      [=](Error err, fs::FileData&& d) {
-        if (!err) {
+  AsyncGroup asyncGroup{std::move(cb)};
+
+  // The package's interface is made from all of its .rx files, so they are all parsed if any of
+  // them was added, changed or removed, or if the interface file is missing
+  _interfaceOutdated = !_db || !_db->package(_pkg.name());
+  if (!_interfaceOutdated) {
+    for (auto& f : _srcFiles) {
+      if (IsRxFile(f.pathname()) && !isUpToDate(f)) {
+        _interfaceOutdated = true;
+        break;
+      }
+    }
+  }
+  if (!_interfaceOutdated) {
+    for (auto& pathname : _db->pathnames(_pkg.name())) {
+      if (IsRxFile(pathname.c_str()) && !_srcFiles.find(pathname.c_str())) {
+        _interfaceOutdated = true;
+        break;
+      }
+    }
+  }
+  if (!_interfaceOutdated) {
+    fs::Stat st;
+    _interfaceOutdated = (bool)fs::stat(pkgInterfaceFile(), st);
+  }
+
+  for (auto& f : _srcFiles) {
+    SrcFile* srcFile = &f;
+    if (isUpToDate(f) && !(_interfaceOutdated && IsRxFile(f.pathname()))) {
+      for (auto& path : _db->file(f.pathname())->imports) {
+        _imports.insert(path);
+      }
+      continue;
+    }
+    auto path = srcFilePath(*srcFile);
+    DBG("  - '" << srcFile->filename() << "' at '" << path << "'");
+
+    // Reading every file of a large package at once would run out of file descriptors, so
+    // reads go through the loop's file limiter
+    auto job = asyncGroup.begin();
+    auto& limiter = Async::main().fileLimiter();
+    asyncGroup[job] = limiter.run([=, path = path.str()](AsyncSemaphore::Release&& rel) {
+      return fs::readfile(
+        Async::main(),
+        path,
+        srcFile->size(),
+        [=, rel = std::move(rel)](Error err, fs::FileData&& d) {
+          rel();
+          if (err) {
+            asyncGroup.end(job, err);
+            return;
+          }
           srcFile->setData(std::move(d));
-          err = srcFile->parse();
+          // Parsing is CPU bound, so files are parsed in parallel on the cpu executor. Each
+          // file's output is buffered and printed once the loop thread gets the result back.
+          // The file's imports are read by the pre-scanner, which also covers C++ sources. An .rx
+          // file that declares its package with directives ("#package") is written in C++ rather
+          // than rx, so it isn't parsed and doesn't contribute to the package's interface.
+          asyncGroup[job] = Executor::cpu().run(Async::main(), [=]() -> func<void()> {
+            string out;
+            importscan::Result header;
+            hash::B16 contentHash;
+            auto& data = srcFile->data();
+            hash::murmur3_128(data.data(), data.size(), contentHash);
+            auto err = importscan::scan(data.data(), data.size(), header);
+            if (err) {
+              err = Error{string{srcFile->pathname()} + ":" + err.message()};
+            } else if (!header.directives) {
+              err = srcFile->parse(out);
+            }
+            return [=, out = std::move(out), header = std::move(header)]() mutable {
+              cerr << out;
+              for (auto& path : header.imports) {
+                _imports.insert(path);
+              }
+              if (!err && _db) {
+                _db->putFile(srcFile->pathname(), DepsDB::File{
+                  srcFile->id(), srcFile->size(), srcFile->mtime(), contentHash,
+                  std::move(header.imports)});
+              }
+              asyncGroup.end(job, err);
+            };
+          });
         }
-        asyncGroup.end(job, err);
-      }
-    );
+      );
+    });
   }
 
   // asyncGroup.canceler()(); return nullptr;
@@ -86,15 +173,57 @@ void PkgDeps::resolve() {
   DBG("pkgObjFile(): '" << pkgObjFile() << "'")
 
   DBG("Locating source files for package " << _pkg)
-  findSrcFilesAtDir(srcDir(), [=](Error err, SrcFileSet&& srcFiles) {
+  findSrcFilesAtDir(srcDir().str(), [=](Error err, SrcFileSet&& srcFiles) {
     if (err) { _resolveCB(err); return; }
     _srcFiles = std::move(srcFiles);
     DBG("Processing source files for package " << _pkg)
-    processSrcFiles([](Error err) {
+    processSrcFiles([=](Error err) {
       DBG("ProcessSrcFiles completed. err=" << err)
+      DBG("Imports: " << join(_imports, ", "))
+      if (err || !_interfaceOutdated) {
+        if (!err && _db) recordPkg(nullptr);
+        _resolveCB(err);
+        return;
+      }
+      writeInterface([=](Error err) {
+        DBG("Wrote interface " << pkgInterfaceFile() << " err=" << err)
+        _resolveCB(err);
+      });
     });
   });
-  
+}
+
+
+AsyncCanceler PkgDeps::writeInterface(func<void(Error)> cb) {
+  PkgInterface::Writer w;
+  for (auto& srcFile : _srcFiles) {
+    if (srcFile.ast()) w.add(*srcFile.ast());
+  }
+  string data;
+  hash::B16 interfaceHash;
+  auto err = w.finish(data, interfaceHash);
+  if (err) {
+    cb(Error{_pkg.name() + ": " + err.message()});
+    return nullptr;
+  }
+  return fs::writefile(Async::main(), pkgInterfaceFile().str(), std::move(data), fs::FSync::None,
+                       nullptr, [=, cb = std::move(cb)](Error err) mutable {
+    if (!err && _db) recordPkg(&interfaceHash);
+    cb(err);
+  });
+}
+
+
+void PkgDeps::recordPkg(const hash::B16* interfaceHash) {
+  // Forget files that are gone, and record the interface when a new one was written
+  for (auto& pathname : _db->pathnames(_pkg.name())) {
+    if (!_srcFiles.find(pathname.c_str())) {
+      _db->removeFile(pathname);
+    }
+  }
+  if (interfaceHash) {
+    _db->putPackage(_pkg.name(), DepsDB::Package{*interfaceHash, {_pkg.name() + ".rxi"}});
+  }
 }
 
 
@@ -5,6 +5,7 @@
 #include "fs.hh"
 #include "asyncgroup.hh"
 #include "srcfile.hh"
+#include "depsdb.hh"
 namespace rx {
 using std::string;
 
@@ -17,16 +18,24 @@ struct PkgDeps {
     const Pkg&,
     ResolveCallback);
 
-  string srcDir() const;     // "~/rx/src/foo/bar"
-  string binFile() const;    // "~/rx/bin/bar"
-  string pkgPCHFile() const; // "~/rx/pkg/target/foo/bar.pch"
-  string pkgObjFile() const; // "~/rx/pkg/target/foo/bar.a"
+  fs::Path srcDir() const;     // "~/rx/src/foo/bar"
+  fs::Path binFile() const;    // "~/rx/bin/bar"
+  fs::Path pkgPCHFile() const; // "~/rx/pkg/target/foo/bar.pch"
+  fs::Path pkgObjFile() const; // "~/rx/pkg/target/foo/bar.a"
+  fs::Path pkgInterfaceFile() const; // "~/rx/pkg/target/foo/bar.rxi"
+  fs::Path srcFilePath(const SrcFile&) const; // "~/rx/src/foo/bar/baz.rx"
 
+  void setDB(DepsDB*);
+    // Files recorded in the database as unchanged are not read again, and what's learned about
+    // files that did change is recorded. Without a database every file is read.
   void resolve();
 
   AsyncCanceler findSrcFilesAtDir(const string& path, func<void(Error,SrcFileSet&&)>);
   AsyncCanceler processSrcFiles(func<void(Error)>);
   Error parseSrcFile(SrcFile&);
+  bool isUpToDate(const SrcFile&) const;
+  AsyncCanceler writeInterface(func<void(Error)>);
+  void recordPkg(const hash::B16* interfaceHash);
 
 private:
   string          _rxDir;
@@ -35,13 +44,44 @@ private:
   Pkg             _pkg;
   ResolveCallback _resolveCB;
 
+  Arena           _arena;
+    // Source files and their names live here and are freed together with the PkgDeps
   SrcFileSet      _srcFiles;
   PkgImports      _imports;
+  DepsDB*         _db = nullptr;
+  bool            _interfaceOutdated = true;
 };
 
-inline string PkgDeps::srcDir() const {     return  _rxDir + "/src/" + _pkg.name(); }
-inline string PkgDeps::binFile() const {    return  _rxDir + "/bin/" + _pkg.basename(); }
-inline string PkgDeps::pkgPCHFile() const { return _pkgDir + "/" + _pkg.name() + ".pch"; }
-inline string PkgDeps::pkgObjFile() const { return _pkgDir + "/" + _pkg.name() + ".a"; }
+inline void PkgDeps::setDB(DepsDB* db) { _db = db; }
+inline fs::Path PkgDeps::srcDir() const {
+  fs::Path path{_rxDir};
+  path.append("src").append(_pkg.name());
+  return path;
+}
+inline fs::Path PkgDeps::binFile() const {
+  fs::Path path{_rxDir};
+  path.append("bin").append(_pkg.basename());
+  return path;
+}
+inline fs::Path PkgDeps::pkgPCHFile() const {
+  fs::Path path{_pkgDir};
+  path.append(_pkg.name()).concat(".pch");
+  return path;
+}
+inline fs::Path PkgDeps::pkgObjFile() const {
+  fs::Path path{_pkgDir};
+  path.append(_pkg.name()).concat(".a");
+  return path;
+}
+inline fs::Path PkgDeps::pkgInterfaceFile() const {
+  fs::Path path{_pkgDir};
+  path.append(_pkg.name()).concat(".rxi");
+  return path;
+}
+inline fs::Path PkgDeps::srcFilePath(const SrcFile& srcFile) const {
+  fs::Path path{_rxDir};
+  path.append("src").append(srcFile.pathname(), srcFile.pathnameSize());
+  return path;
+}
 
 } // namespace
@@ -0,0 +1,397 @@
+#include "depsdb.hh"
+#include <fcntl.h>
+namespace rx {
+
+// File layout. Integers are in host byte order, as the file never leaves the machine.
+//
+//   file   = header record*
+//   header = "rxdeps" 0 <version>
+//   record = <size:u32> <check:u32> payload[size] padding
+//
+// `check` is a hash of the payload, and records are padded with zeros to a multiple of 8 bytes,
+// keeping the fixed-size part of every payload aligned in a mapped file. The first byte of a
+// payload is its type, see the *Rec structs below.
+
+static const uint8_t  kVersion = 1;
+static const char     kHeader[8] = {'r','x','d','e','p','s','\0',(char)kVersion};
+static const uint64_t kMinGarbage = 64 * 1024;
+  // The log is compacted when replaced records make up more than half of it, but not before
+  // there's at least this much to gain
+
+enum RecType : uint8_t {
+  kFileRec = 1,
+  kPkgRec,
+  kRemoveFileRec,
+};
+
+struct RecHeader {
+  uint32_t size;
+  uint32_t check;
+};
+
+struct FileRec {
+  // Followed by the pathname and the imports, each import prefixed with its u16 size
+  uint8_t   type;
+  uint8_t   _reserved;
+  uint16_t  nimports;
+  uint32_t  pathSize;
+  uint64_t  dev;
+  uint64_t  ino;
+  uint64_t  size;
+  uint64_t  mtime;
+  hash::B16 contentHash;
+};
+
+struct PkgRec {
+  // Followed by the name and the artifact keys, each key prefixed with its u16 size
+  uint8_t   type;
+  uint8_t   _reserved;
+  uint16_t  nartifacts;
+  uint32_t  nameSize;
+  hash::B16 interfaceHash;
+};
+
+struct RemoveFileRec {
+  // Followed by the pathname
+  uint8_t   type;
+  uint8_t   _reserved[3];
+  uint32_t  pathSize;
+};
+
+static_assert(sizeof(RecHeader) == 8 && sizeof(FileRec) == 56 && sizeof(PkgRec) == 24 &&
+              sizeof(RemoveFileRec) == 8, "DepsDB records should not have implicit padding");
+
+
+static uint32_t Check(const char* p, size_t z) {
+  hash::B16 h;
+  hash::murmur3_128(p, z, h, kVersion);
+  uint32_t v;
+  memcpy(&v, h.bytes, sizeof(v));
+  return v;
+}
+
+
+// ------------------------------------------------------------------------------------------------
+// Writing records
+
+static void Put(string& s, const void* p, size_t z) {
+  s.append((const char*)p, z);
+}
+
+
+static void PutStrings(string& s, const std::vector<string>& v) {
+  for (auto& str : v) {
+    assert(str.size() <= UINT16_MAX);
+    uint16_t z = (uint16_t)str.size();
+    Put(s, &z, sizeof(z));
+    s += str;
+  }
+}
+
+
+static size_t BeginRecord(string& s) {
+  auto start = s.size();
+  s.append(sizeof(RecHeader), '\0');
+  return start;
+}
+
+
+static uint32_t EndRecord(string& s, size_t start) {
+  // Fills in the header of the record at `start` and returns the size of the whole record
+  auto payload = start + sizeof(RecHeader);
+  RecHeader h{(uint32_t)(s.size() - payload), Check(s.data() + payload, s.size() - payload)};
+  memcpy(&s[start], &h, sizeof(h));
+  s.append((8 - (s.size() - start) % 8) % 8, '\0');
+  return (uint32_t)(s.size() - start);
+}
+
+
+static uint32_t PutFileRec(string& s, const string& pathname, const DepsDB::File& f) {
+  assert(f.imports.size() <= UINT16_MAX);
+  auto start = BeginRecord(s);
+  FileRec r{kFileRec, 0, (uint16_t)f.imports.size(), (uint32_t)pathname.size(),
+            f.id.dev, f.id.ino, f.size, (uint64_t)f.mtime, f.contentHash};
+  Put(s, &r, sizeof(r));
+  s += pathname;
+  PutStrings(s, f.imports);
+  return EndRecord(s, start);
+}
+
+
+static uint32_t PutPkgRec(string& s, const string& name, const DepsDB::Package& pkg) {
+  assert(pkg.artifacts.size() <= UINT16_MAX);
+  auto start = BeginRecord(s);
+  PkgRec r{kPkgRec, 0, (uint16_t)pkg.artifacts.size(), (uint32_t)name.size(), pkg.interfaceHash};
+  Put(s, &r, sizeof(r));
+  s += name;
+  PutStrings(s, pkg.artifacts);
+  return EndRecord(s, start);
+}
+
+
+static uint32_t PutRemoveFileRec(string& s, const string& pathname) {
+  auto start = BeginRecord(s);
+  RemoveFileRec r{kRemoveFileRec, {0,0,0}, (uint32_t)pathname.size()};
+  Put(s, &r, sizeof(r));
+  s += pathname;
+  return EndRecord(s, start);
+}
+
+
+// ------------------------------------------------------------------------------------------------
+// Reading records
+
+struct Reader {
+  const char* p;
+  const char* e;
+
+  template <typename T> bool read(T& v) {
+    if ((size_t)(e - p) < sizeof(T)) return false;
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+  }
+
+  bool read(string& s, size_t z) {
+    if ((size_t)(e - p) < z) return false;
+    s.assign(p, z);
+    p += z;
+    return true;
+  }
+
+  bool readStrings(std::vector<string>& v, size_t count) {
+    v.resize(count);
+    for (auto& s : v) {
+      uint16_t z;
+      if (!read(z) || !read(s, z)) return false;
+    }
+    return true;
+  }
+};
+
+
+size_t DepsDB::replay(const char* begin, size_t z) {
+  // Stops at the first record that's incomplete, fails its check or doesn't make sense, all of
+  // which are most likely the result of a write that was cut short
+  const char* p = begin;
+  const char* end = begin + z;
+  while ((size_t)(end - p) >= sizeof(RecHeader)) {
+    RecHeader h;
+    memcpy(&h, p, sizeof(h));
+    size_t recSize = sizeof(h) + ((h.size + 7) & ~(size_t)7);
+    if (h.size == 0 || recSize > (size_t)(end - p)) break;
+    Reader r{p + sizeof(h), p + sizeof(h) + h.size};
+    if (Check(r.p, h.size) != h.check) break;
+
+    string key;
+    switch ((RecType)*r.p) {
+      case kFileRec: {
+        FileRec rec;
+        File f;
+        if (!r.read(rec) || !r.read(key, rec.pathSize) || !r.readStrings(f.imports, rec.nimports)) {
+          return p - begin;
+        }
+        f.id = fs::FileID{rec.dev, rec.ino};
+        f.size = rec.size;
+        f.mtime = Time{rec.mtime};
+        f.contentHash = rec.contentHash;
+        put(_files, key, std::move(f), (uint32_t)recSize);
+        break;
+      }
+      case kPkgRec: {
+        PkgRec rec;
+        Package pkg;
+        if (!r.read(rec) || !r.read(key, rec.nameSize) ||
+            !r.readStrings(pkg.artifacts, rec.nartifacts)) {
+          return p - begin;
+        }
+        pkg.interfaceHash = rec.interfaceHash;
+        put(_pkgs, key, std::move(pkg), (uint32_t)recSize);
+        break;
+      }
+      case kRemoveFileRec: {
+        RemoveFileRec rec;
+        if (!r.read(rec) || !r.read(key, rec.pathSize)) {
+          return p - begin;
+        }
+        erase(_files, key, (uint32_t)recSize);
+        break;
+      }
+      default: {
+        return p - begin;
+      }
+    }
+    p += recSize;
+  }
+  return p - begin;
+}
+
+
+// ------------------------------------------------------------------------------------------------
+
+template <typename T>
+void DepsDB::put(std::map<string,Entry<T>>& m, const string& key, T&& value, uint32_t recSize) {
+  auto I = m.find(key);
+  if (I == m.end()) {
+    m.emplace(key, Entry<T>{std::move(value), recSize});
+  } else {
+    _garbage += I->second.recSize;
+    I->second = Entry<T>{std::move(value), recSize};
+  }
+}
+
+
+template <typename T>
+void DepsDB::erase(std::map<string,Entry<T>>& m, const string& key, uint32_t recSize) {
+  // The record that removes an entry is as useless as the entry's own record once applied
+  _garbage += recSize;
+  auto I = m.find(key);
+  if (I != m.end()) {
+    _garbage += I->second.recSize;
+    m.erase(I);
+  }
+}
+
+
+const DepsDB::File* DepsDB::file(const string& pathname) const {
+  auto I = _files.find(pathname);
+  return (I == _files.end()) ? nullptr : &I->second.value;
+}
+
+
+const DepsDB::Package* DepsDB::package(const string& name) const {
+  auto I = _pkgs.find(name);
+  return (I == _pkgs.end()) ? nullptr : &I->second.value;
+}
+
+
+std::vector<string> DepsDB::pathnames(const string& dir) const {
+  std::vector<string> v;
+  auto prefix = dir + '/';
+  for (auto I = _files.lower_bound(prefix); I != _files.end(); ++I) {
+    auto& pathname = I->first;
+    if (pathname.compare(0, prefix.size(), prefix) != 0) break;
+    if (pathname.find('/', prefix.size()) == string::npos) {
+      v.push_back(pathname);
+    }
+  }
+  return v;
+}
+
+
+void DepsDB::putFile(const string& pathname, File&& f) {
+  auto* cur = file(pathname);
+  if (cur && *cur == f) return;
+  auto recSize = PutFileRec(_pending, pathname, f);
+  put(_files, pathname, std::move(f), recSize);
+}
+
+
+void DepsDB::removeFile(const string& pathname) {
+  if (!file(pathname)) return;
+  erase(_files, pathname, PutRemoveFileRec(_pending, pathname));
+}
+
+
+void DepsDB::putPackage(const string& name, Package&& pkg) {
+  auto* cur = package(name);
+  if (cur && *cur == pkg) return;
+  auto recSize = PutPkgRec(_pending, name, pkg);
+  put(_pkgs, name, std::move(pkg), recSize);
+}
+
+
+// ------------------------------------------------------------------------------------------------
+
+Error DepsDB::load(const string& filename) {
+  _files.clear();
+  _pkgs.clear();
+  _pending.clear();
+  _logSize = _fileSize = _garbage = 0;
+  fs::Stat st;
+  auto err = fs::stat(filename, st);
+  if (err) return (err.code() == (Error::Code)UV_ENOENT) ? Error{} : err;
+  _fileSize = st.size;
+  if (st.size < sizeof(kHeader)) return nullptr; // can't mmap an empty file
+  fs::FileData d;
+  err = fs::readfile(filename, st.size, d);
+  if (err) return err;
+  if (memcmp(d.data(), kHeader, sizeof(kHeader)) != 0) {
+    return nullptr; // written by some other version, and replaced on save
+  }
+  _logSize = sizeof(kHeader) + replay(d.data() + sizeof(kHeader), d.size() - sizeof(kHeader));
+  return nullptr;
+}
+
+
+string DepsDB::serialize() const {
+  string s{kHeader, sizeof(kHeader)};
+  for (auto& kv : _pkgs) {
+    PutPkgRec(s, kv.first, kv.second.value);
+  }
+  for (auto& kv : _files) {
+    PutFileRec(s, kv.first, kv.second.value);
+  }
+  return s;
+}
+
+
+Error DepsDB::compact(const string& filename, fs::FSync sync, fs::SyncBatch* batch) {
+  auto s = serialize();
+  auto err = fs::writefile(filename, s.data(), s.size(), sync, batch);
+  if (!err) {
+    _pending.clear();
+    _logSize = _fileSize = s.size();
+    _garbage = 0;
+  }
+  return err;
+}
+
+
+Error DepsDB::save(const string& filename, fs::FSync sync, fs::SyncBatch* batch) {
+  if (_pending.empty()) return nullptr;
+  if (_logSize == 0 || (_garbage >= kMinGarbage && _garbage * 2 >= logSize())) {
+    return compact(filename, sync, batch);
+  }
+
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return compact(filename, sync, batch);
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || (uint64_t)st.st_size != _fileSize) {
+    ::close(fd);
+    return compact(filename, sync, batch);
+  }
+
+  // Cut off what's left of a record that was being written when an earlier process died, then
+  // append. Should we die while appending, the next load drops the partial record.
+  int r = (_fileSize != _logSize) ? ::ftruncate(fd, (off_t)_logSize) : 0;
+  size_t n = 0;
+  while (r == 0 && n != _pending.size()) {
+    auto w = ::pwrite(fd, _pending.data() + n, _pending.size() - n, (off_t)(_logSize + n));
+    if (w > 0) {
+      n += (size_t)w;
+    } else if (w == 0 || errno != EINTR) {
+      if (w == 0) errno = EIO;
+      r = -1;
+    }
+  }
+  if (r == 0 && sync == fs::FSync::File) {
+    r = ::fsync(fd); // the file already exists, so its directory needs no syncing
+  }
+  auto errnox = errno;
+  ::close(fd);
+  if (r != 0) {
+    _fileSize = UINT64_MAX; // unknown, so the next save writes the file from scratch
+    return UVError(-errnox);
+  }
+  if (sync == fs::FSync::Batch && batch) {
+    batch->add(filename);
+  }
+  _logSize += _pending.size();
+  _fileSize = _logSize;
+  _pending.clear();
+  return nullptr;
+}
+
+
+} // namespace
@@ -0,0 +1,104 @@
+#pragma once
+#include "fs.hh"
+#include "hash.hh"
+#include "time.hh"
+namespace rx {
+using std::string;
+
+// Remembers what was learned about source files and packages in earlier builds, so that a build
+// where nothing changed only needs to stat files: a file whose identity, size and modification
+// time match its record is neither read nor scanned again. Kept in a single file in the package
+// directory (".rxdeps") which is shared by all packages.
+//
+// The file is a log of binary records. Changes are appended to it when saving, a record replacing
+// any earlier record for the same file or package. Every record carries its size and a checksum,
+// so a record that was only partly written when the process died is detected on load and
+// dropped, together with anything after it. Once most of the log consists of replaced records
+// it's compacted by atomically replacing the file with one that holds only live records.
+//
+// Not thread safe.
+//
+struct DepsDB {
+  struct File {
+    fs::FileID          id;
+    uint64_t            size;
+    Time                mtime;
+    hash::B16           contentHash;
+    std::vector<string> imports; // packages imported, in the order they are declared
+
+    bool matches(const fs::FileID&, uint64_t size, const Time& mtime) const;
+      // True if the file on disk is most likely unchanged since it was recorded
+    bool operator==(const File&) const;
+  };
+
+  struct Package {
+    hash::B16           interfaceHash;
+    std::vector<string> artifacts; // keys of the artifacts last built from the interface
+    bool operator==(const Package&) const;
+  };
+
+  Error load(const string& filename);
+    // Read a database file, replacing anything recorded. A missing or unrecognized file is not an
+    // error, and neither is a partly written record at its end.
+  Error save(const string& filename, fs::FSync=fs::FSync::None, fs::SyncBatch* =nullptr);
+    // Append changes made since the last load or save to the file, or compact it. The file is
+    // written from scratch when it doesn't hold exactly what was loaded, e.g. because it was
+    // changed by someone else in the meantime. Does nothing if nothing changed.
+  Error compact(const string& filename, fs::FSync=fs::FSync::None, fs::SyncBatch* =nullptr);
+    // Atomically replace the file with one that holds only live records
+
+  const File* file(const string& pathname) const;       // nullptr if not recorded
+  const Package* package(const string& name) const;     // nullptr if not recorded
+  std::vector<string> pathnames(const string& dir) const;
+    // Pathnames of the files recorded directly inside `dir`, e.g. "foo/bar" -> {"foo/bar/bar.rx"}
+
+  void putFile(const string& pathname, File&&);
+  void removeFile(const string& pathname);
+  void putPackage(const string& name, Package&&);
+    // Putting a record that equals the current one does nothing
+
+  size_t fileCount() const { return _files.size(); }
+  size_t packageCount() const { return _pkgs.size(); }
+  bool dirty() const { return !_pending.empty(); }
+  uint64_t logSize() const { return _logSize + _pending.size(); } // bytes, once saved
+  uint64_t garbageSize() const { return _garbage; } // bytes of replaced records in the log
+
+private:
+  template <typename T> struct Entry {
+    T        value;
+    uint32_t recSize; // bytes taken up by its record in the log
+  };
+
+  size_t replay(const char* p, size_t z); // returns the number of bytes of valid records
+  template <typename T>
+  void put(std::map<string,Entry<T>>&, const string& key, T&&, uint32_t recSize);
+  template <typename T>
+  void erase(std::map<string,Entry<T>>&, const string& key, uint32_t recSize);
+  string serialize() const;
+
+  std::map<string,Entry<File>>    _files;
+  std::map<string,Entry<Package>> _pkgs;
+  string   _pending;      // records not yet written
+  uint64_t _logSize = 0;  // bytes of valid records in the file, including its header
+  uint64_t _fileSize = 0; // size of the file, which is larger than _logSize after a crash
+  uint64_t _garbage = 0;
+};
+
+
+// ================================================================================================
+
+inline bool DepsDB::File::matches(const fs::FileID& id2, uint64_t size2, const Time& mtime2) const {
+  return id == id2 && size == size2 && (uint64_t)mtime == (uint64_t)mtime2;
+}
+
+inline bool DepsDB::File::operator==(const File& other) const {
+  return matches(other.id, other.size, other.mtime) && imports == other.imports &&
+         memcmp(contentHash.bytes, other.contentHash.bytes, sizeof(contentHash.bytes)) == 0;
+}
+
+inline bool DepsDB::Package::operator==(const Package& other) const {
+  return artifacts == other.artifacts &&
+         memcmp(interfaceHash.bytes, other.interfaceHash.bytes, sizeof(interfaceHash.bytes)) == 0;
+}
+
+} // namespace
@@ -0,0 +1,22 @@
+#include "error.hh"
+#include "async.hh" // uv_strerror
+
+namespace rx {
+
+
+void Error::_set_state(Code code, const std::string& message) {
+  auto* h = (Heap*)::malloc(offsetof(Heap, message) + message.size() + 1);
+  h->refs = 1;
+  h->code = code;
+  memcpy(h->message, message.data(), message.size());
+  h->message[message.size()] = '\0';
+  _state = (uintptr_t)h;
+}
+
+
+const char* Error::_code_message(Code code) {
+  return ((int32_t)code < 0) ? uv_strerror((int)code) : "";
+}
+
+
+} // namespace
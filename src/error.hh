@@ -1,21 +1,35 @@
 #pragma once
 namespace rx {
 
-// Error type which has a very low cost when there's no error.
+// Error type which has a very low cost when there's no error, and a low cost when there is.
 //
-// - When representing "no error" (Error::OK()) the code generated is simply a pointer-sized int.
+// An Error is a single pointer-sized word:
 //
-// - When representing an error, a single memory allocation is incured at construction which itself
-//   represents both the error code (first byte) as well as any message (remaining bytes) terminated
-//   by a NUL sentinel byte.
+// - When representing "no error" (Error::OK()) it is zero.
+//
+// - An error with only a code holds the code inline in the word. Negative codes are libuv error
+//   codes (negated errno values on unix) and their message is looked up with uv_strerror.
+//
+// - An error with a message that never changes points to an `Error::Static`, which is defined
+//   once with static storage duration.
+//
+// - Only an error with a dynamic message allocates, once, at construction. That state is
+//   reference counted, so copying and moving errors through callbacks never allocates.
 //
 
 struct Error {
   using Code = uint32_t;
 
+  struct Static {
+    // E.g. `static const Error::Static kCanceled{0, "canceled"};` ... `return kCanceled;`
+    Code        code;
+    const char* message;
+  };
+
   static Error OK(); // == OK (no error)
   Error(Code);
   Error(int);
+  Error(const Static&);
   Error(Code, const std::string& error_message);
   Error(int, const std::string& error_message);
   Error(const std::string& error_message);
@@ -29,30 +43,57 @@ struct Error {
   const char* message() const;
   operator bool() const;    // == !ok() -- true when representing an error
 
-  Error(const Error& other);
-  Error(Error&& other);
-  Error& operator=(const Error& s);
-  Error& operator=(Error&& s);
+  Error(const Error& other) noexcept;
+  Error(Error&& other) noexcept;
+  Error& operator=(const Error& s) noexcept;
+  Error& operator=(Error&& s) noexcept;
 
 
 // ------------------------------------------------------------------------------------------------
 private:
+  enum : uintptr_t {
+    kTagMask   = 3,
+    kTagHeap   = 0, // pointer to Heap
+    kTagCode   = 1, // code << kTagBits
+    kTagStatic = 2, // pointer to Static
+    kTagBits   = 2,
+  };
+  struct Heap {
+    volatile uint32_t refs;
+    Code              code;
+    char              message[1]; // NUL terminated
+  };
+  static_assert(alignof(Static) > kTagMask && alignof(Heap) > kTagMask, "pointers need tag bits");
+
   void _set_state(Code code, const std::string& message);
-  static const char* _copy_state(const char* other);
-  // OK status has a NULL _state. Otherwise, _state is:
-  //   _state[0..sizeof(Code)]  == code
-  //   _state[sizeof(Code)..]   == message c-string
-  const char* _state;
+  void _retain() const;
+  void _release();
+  static const char* _code_message(Code);
+  uintptr_t _state;
 };
 
-inline Error::Error() noexcept : _state{NULL} {} // == OK
-inline Error::Error(std::nullptr_t _) noexcept : _state{NULL} {} // == OK
-inline Error::~Error() { if (_state) delete[] _state; }
+inline Error::Error() noexcept : _state{0} {} // == OK
+inline Error::Error(std::nullptr_t _) noexcept : _state{0} {} // == OK
+inline Error::~Error() { _release(); }
 inline Error Error::OK() { return Error{}; }
 inline bool Error::ok() const { return !_state; }
 inline Error::operator bool() const { return _state; }
-inline Error::Code Error::code() const { return _state ? *(Code*)_state : 0; }
-inline const char* Error::message() const { return _state ? &_state[sizeof(Code)] : ""; }
+
+inline Error::Code Error::code() const {
+  switch (_state & kTagMask) {
+    case kTagCode:   return (Code)(_state >> kTagBits);
+    case kTagStatic: return ((const Static*)(_state & ~kTagMask))->code;
+    default:         return _state ? ((const Heap*)_state)->code : 0;
+  }
+}
+
+inline const char* Error::message() const {
+  switch (_state & kTagMask) {
+    case kTagCode:   return _code_message((Code)(_state >> kTagBits));
+    case kTagStatic: return ((const Static*)(_state & ~kTagMask))->message;
+    default:         return _state ? ((const Heap*)_state)->message : "";
+  }
+}
 
 inline std::ostream& operator<< (std::ostream& os, const Error& e) {
   if (!e) {
@@ -62,45 +103,40 @@ inline std::ostream& operator<< (std::ostream& os, const Error& e) {
   }
 }
 
-inline const char* Error::_copy_state(const char* other) {
-  if (other == 0) {
-    return 0;
-  } else {
-    size_t size = strlen(&other[sizeof(Code)]) + sizeof(Code) + 1;
-    char* state = new char[size];
-    memcpy(state, other, size);
-    return state;
+inline void Error::_retain() const {
+  if (_state != 0 && (_state & kTagMask) == kTagHeap) {
+    __atomic_fetch_add(&((Heap*)_state)->refs, 1, __ATOMIC_RELAXED);
   }
 }
 
-inline void Error::_set_state(Code code, const std::string& message) {
-  char* state = new char[sizeof(Code) + message.size() + 1];
-  *(Code*)state = code;
-  // state[0] = static_cast<char>(code);
-  memcpy(state + sizeof(Code), message.data(), message.size());
-  state[sizeof(Code) + message.size()] = '\0';
-  _state = state;
+inline void Error::_release() {
+  if (_state != 0 && (_state & kTagMask) == kTagHeap &&
+      __atomic_sub_fetch(&((Heap*)_state)->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    ::free((void*)_state);
+  }
 }
 
-inline Error::Error(const Error& other) {
-  _state = _copy_state(other._state);
+inline Error::Error(const Error& other) noexcept : _state{other._state} {
+  _retain();
 }
 
-inline Error::Error(Error&& other) {
-  _state = nullptr;
-  std::swap(other._state, _state);
+inline Error::Error(Error&& other) noexcept : _state{other._state} {
+  other._state = 0;
 }
 
 inline Error::Error(Code code) {
-  char* state = new char[sizeof(Code)+1];
-  *(Code*)state = code;
-  // state[0] = static_cast<char>(code);
-  state[sizeof(Code)] = 0;
-  _state = state;
+  if (((uintptr_t)code >> (sizeof(uintptr_t) * 8 - kTagBits)) == 0) {
+    _state = ((uintptr_t)code << kTagBits) | kTagCode;
+  } else {
+    _set_state(code, _code_message(code)); // doesn't fit next to the tag on 32-bit systems
+  }
 }
 
 inline Error::Error(int code) : Error{(Error::Code)code} {}
 
+inline Error::Error(const Static& s) : _state{(uintptr_t)&s | kTagStatic} {}
+
 inline Error::Error(Code code, const std::string& msg) {
   _set_state(code, msg);
 }
@@ -111,15 +147,16 @@ inline Error::Error(const std::string& message) {
   _set_state(0, message);
 }
 
-inline Error& Error::operator=(const Error& other) {
+inline Error& Error::operator=(const Error& other) noexcept {
   if (_state != other._state) {
-    delete[] _state;
-    _state = _copy_state(other._state);
+    other._retain();
+    _release();
+    _state = other._state;
   }
   return *this;
 }
 
-inline Error& Error::operator=(Error&& other) {
+inline Error& Error::operator=(Error&& other) noexcept {
   if (_state != other._state) {
     std::swap(other._state, _state);
   }
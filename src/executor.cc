@@ -0,0 +1,267 @@
+#include "executor.hh"
+#include "ref.hh"
+#include "trace.hh"
+
+using std::cerr;
+using std::endl;
+#define DBG(...) cerr << "[" << rx::cx_basename(__FILE__) << "] " <<  __VA_ARGS__ << endl;
+// #define DBG(...)
+
+namespace rx {
+
+
+static size_t OnlineCPUs() {
+  auto ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  return (ncpu > 0) ? (size_t)ncpu : 1;
+}
+
+
+struct WorkQueue {
+  // Owned by one worker, which pushes and pops at the back (newest first, for cache locality.)
+  // Other workers steal from the front, taking the oldest and often largest piece of work.
+  // There's one deque per priority.
+  using Priority = Executor::Priority;
+  WorkQueue() { uv_mutex_init(&mu); }
+  ~WorkQueue() { uv_mutex_destroy(&mu); }
+
+  void push(Executor::Task&& task, Priority prio) {
+    uv_mutex_lock(&mu);
+    tasks[(size_t)prio].emplace_back(fwdarg(task));
+    uv_mutex_unlock(&mu);
+  }
+
+  bool pop(Executor::Task& task, Priority prio) {
+    uv_mutex_lock(&mu);
+    auto& q = tasks[(size_t)prio];
+    bool ok = !q.empty();
+    if (ok) {
+      task = std::move(q.back());
+      q.pop_back();
+    }
+    uv_mutex_unlock(&mu);
+    return ok;
+  }
+
+  bool steal(Executor::Task& task, Priority prio) {
+    uv_mutex_lock(&mu);
+    auto& q = tasks[(size_t)prio];
+    bool ok = !q.empty();
+    if (ok) {
+      task = std::move(q.front());
+      q.pop_front();
+    }
+    uv_mutex_unlock(&mu);
+    return ok;
+  }
+
+  uv_mutex_t                 mu;
+  std::deque<Executor::Task> tasks[Executor::kNumPriorities];
+};
+
+
+struct Executor::Imp {
+  struct Worker {
+    Imp*        imp;
+    size_t      index;
+    uv_thread_t thread;
+  };
+
+  const char*      name;
+  size_t           nthreads;
+  WorkQueue*       queues;  // [nthreads]
+  Worker*          workers; // [nthreads]
+  uv_key_t         workerKey; // Worker* of the calling thread, if it's one of ours
+  volatile size_t  nextQueue = 0; // round-robin for posts from other threads
+
+  uv_mutex_t       idleMu;
+  uv_cond_t        idleCond;
+  size_t           pending = 0;  // tasks queued but not yet taken. Guarded by idleMu.
+  bool             stopping = false;
+
+  bool take(size_t i, Task& task);
+  static void workerMain(void*);
+};
+
+
+bool Executor::Imp::take(size_t i, Task& task) {
+  while (true) {
+    bool found = false;
+    for (size_t p = 0; !found && p != kNumPriorities; ++p) {
+      auto prio = (Priority)p;
+      found = queues[i].pop(task, prio);
+      for (size_t n = 1; !found && n < nthreads; ++n) {
+        found = queues[(i + n) % nthreads].steal(task, prio);
+      }
+    }
+    uv_mutex_lock(&idleMu);
+    if (found) {
+      --pending;
+      uv_mutex_unlock(&idleMu);
+      return true;
+    }
+    // `pending` might be non-zero here if another worker has taken a task but not yet accounted
+    // for it, in which case we simply try again.
+    while (pending == 0 && !stopping) {
+      uv_cond_wait(&idleCond, &idleMu);
+    }
+    bool done = (pending == 0 && stopping);
+    uv_mutex_unlock(&idleMu);
+    if (done) return false;
+  }
+}
+
+
+void Executor::Imp::workerMain(void* arg) {
+  auto* w = (Worker*)arg;
+  uv_key_set(&w->imp->workerKey, (void*)w);
+  trace::setThreadName(w->imp->name);
+  Task task;
+  while (w->imp->take(w->index, task)) {
+    task();
+    task = nullptr; // release captured state before possibly going to sleep
+  }
+}
+
+
+Executor::Executor(size_t nthreads, const char* name) : self{new Imp} {
+  if (nthreads == 0) {
+    nthreads = OnlineCPUs();
+  }
+  self->name = name;
+  self->nthreads = nthreads;
+  self->queues = new WorkQueue[nthreads];
+  self->workers = new Imp::Worker[nthreads];
+  uv_key_create(&self->workerKey);
+  uv_mutex_init(&self->idleMu);
+  uv_cond_init(&self->idleCond);
+  for (size_t i = 0; i != nthreads; ++i) {
+    auto& w = self->workers[i];
+    w.imp = self;
+    w.index = i;
+    auto st = uv_thread_create(&w.thread, Imp::workerMain, (void*)&w);
+    assert(st == 0);
+  }
+}
+
+
+Executor::~Executor() {
+  uv_mutex_lock(&self->idleMu);
+  self->stopping = true;
+  uv_cond_broadcast(&self->idleCond);
+  uv_mutex_unlock(&self->idleMu);
+  for (size_t i = 0; i != self->nthreads; ++i) {
+    uv_thread_join(&self->workers[i].thread);
+  }
+  uv_cond_destroy(&self->idleCond);
+  uv_mutex_destroy(&self->idleMu);
+  uv_key_delete(&self->workerKey);
+  delete[] self->workers;
+  delete[] self->queues;
+  delete self;
+  self = nullptr;
+}
+
+
+static size_t gIOThreads = 0;  // set by configure
+static size_t gCPUThreads = 0;
+static Executor* gIOExecutor = nullptr;
+static Executor* gCPUExecutor = nullptr;
+static uv_once_t gIOExecutorOnce = UV_ONCE_INIT;
+static uv_once_t gCPUExecutorOnce = UV_ONCE_INIT;
+
+
+static size_t ThreadCount(size_t configured, const char* envname, size_t def) {
+  if (configured != 0) {
+    return configured;
+  }
+  const char* env = getenv(envname);
+  if (env != nullptr) {
+    auto n = strtoul(env, nullptr, 10);
+    if (n != 0) return (size_t)n;
+  }
+  return def;
+}
+
+
+void Executor::configure(size_t ioThreads, size_t cpuThreads) {
+  if (ioThreads != 0) gIOThreads = ioThreads;
+  if (cpuThreads != 0) gCPUThreads = cpuThreads;
+}
+
+
+Executor& Executor::io() {
+  uv_once(&gIOExecutorOnce, []{
+    gIOExecutor = new Executor{
+      ThreadCount(gIOThreads, "RX_IO_THREADS", std::max<size_t>(4, OnlineCPUs() * 2)), "io" };
+  });
+  return *gIOExecutor;
+}
+
+
+Executor& Executor::cpu() {
+  uv_once(&gCPUExecutorOnce, []{
+    gCPUExecutor = new Executor{
+      ThreadCount(gCPUThreads, "RX_CPU_THREADS", OnlineCPUs()), "cpu" };
+  });
+  return *gCPUExecutor;
+}
+
+
+size_t Executor::size() const {
+  return self->nthreads;
+}
+
+
+void Executor::post(Task&& task, Priority prio) {
+  if (trace::enabled()) {
+    // Time spent waiting in the queue is recorded too, which is what reveals a starved pool
+    task = [name = self->name, queued = trace::now(), task = std::move(task)] {
+      auto start = trace::now();
+      task();
+      trace::record(name, "task", queued, start, trace::now());
+    };
+  }
+  auto* w = (Imp::Worker*)uv_key_get(&self->workerKey);
+  size_t i = (w != nullptr) ? w->index :
+             __sync_fetch_and_add(&self->nextQueue, 1) % self->nthreads;
+  self->queues[i].push(fwdarg(task), prio);
+  uv_mutex_lock(&self->idleMu);
+  ++self->pending;
+  uv_cond_signal(&self->idleCond);
+  uv_mutex_unlock(&self->idleMu);
+}
+
+
+struct RunReq : SafeRefCounted<RunReq> {
+  RunReq(Executor::Work&& work) : work{fwdarg(work)} {}
+  Executor::Work work;
+  volatile long  canceled = 0;
+};
+
+
+AsyncCanceler Executor::run(Async& a, Work&& work, Priority prio) {
+  RunReq::Ref req{new RunReq{fwdarg(work)}};
+  a.ref(); // balanced by unref in the continuation
+  post([req, &a]() mutable {
+    func<void()> cb;
+    if (!__atomic_load_n(&req->canceled, __ATOMIC_RELAXED)) {
+      cb = req->work();
+    }
+    req->work = nullptr;
+    a.post([req = std::move(req), cb = std::move(cb), &a] {
+      a.unref();
+      if (!__atomic_load_n(&req->canceled, __ATOMIC_RELAXED) && cb) {
+        cb();
+      }
+    });
+  }, prio);
+  return [req = std::move(req)]{
+    if (req) {
+      __atomic_store_n(&req->canceled, 1, __ATOMIC_RELAXED);
+      req.resetSelf();
+    }
+  };
+}
+
+
+} // namespace
@@ -0,0 +1,73 @@
+#pragma once
+#include "async.hh"
+#include "asynccanceler.hh"
+namespace rx {
+
+// A pool of worker threads with work-stealing task queues. Each worker owns a queue; tasks posted
+// from a worker go to its own queue and are run newest-first, while tasks posted from any other
+// thread are spread over the queues. A worker that runs out of tasks steals the oldest task from
+// another worker's queue before going to sleep.
+//
+// Workers run plain tasks, not event loops. Results are handed back to a loop with `Async::post`,
+// or by using `run` which does that automatically.
+//
+// Tasks have a priority. Workers always take the highest-priority task available anywhere in the
+// pool, so background work only runs when nothing more urgent is queued.
+//
+// There are two shared executors: `io` for blocking system calls (open, mmap, read, write) and
+// `cpu` for computation like parsing. Keeping them apart means a burst of file I/O can't starve
+// the CPU-bound work, and vice versa.
+//
+struct Executor {
+  using Task = func<void()>;
+  using Work = func<func<void()>()>;
+
+  enum class Priority {
+    Interactive, // someone is waiting for the result, e.g. an editor asking about one file
+    Critical,    // needed by the current build. The default.
+    Background,  // speculative, e.g. warming caches
+  };
+  enum : size_t { kNumPriorities = 3 };
+
+  explicit Executor(size_t threads=0, const char* name="executor");
+    // Start `threads` worker threads. 0 means one per online CPU. `name` labels the workers and
+    // their tasks in traces and must be a string literal.
+  ~Executor();
+    // Runs any tasks still queued, then stops and joins all workers
+
+  static Executor& io();
+    // Shared executor for blocking I/O, started on first use. Defaults to twice the number of
+    // online CPUs (at least 4) since its workers spend most of their time waiting on the kernel.
+    // The RX_IO_THREADS environment variable overrides the default.
+  static Executor& cpu();
+    // Shared executor for CPU-bound work, started on first use. Defaults to one worker per online
+    // CPU. The RX_CPU_THREADS environment variable overrides the default.
+  static void configure(size_t ioThreads, size_t cpuThreads);
+    // Set the sizes of the shared executors, taking precedence over the environment. 0 keeps the
+    // default. Has no effect on an executor that has already been started.
+
+  size_t size() const; // number of worker threads
+
+  void post(Task&&, Priority=Priority::Critical);
+    // Run a task on any worker thread. Thread safe.
+
+  AsyncCanceler run(Async&, Work&&, Priority=Priority::Critical);
+    // Run `work` on any worker thread and then call the function it returns on `Async`'s loop
+    // thread. The loop is kept alive in between. Canceling prevents `work` from running if it
+    // hasn't started yet, and always prevents the returned function from being called.
+    // Must be called on `Async`'s loop thread.
+
+private:
+  struct Imp; Imp* self;
+};
+
+/* Example
+
+auto canceler = Executor::cpu().run(Async::main(), [=]() -> func<void()> {
+  auto result = expensiveComputation(); // runs on some worker thread
+  return [=]{ cb(result); };            // runs on the main loop thread
+});
+
+*/
+
+} // namespace
@@ -1,12 +1,21 @@
 #include "fs.hh"
 #include "ref.hh"
 #include "asyncgroup.hh"
+#include "executor.hh"
+#include "trace.hh"
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+  #include <linux/fs.h>  // FICLONE
+#elif defined(__APPLE__) && __has_include(<sys/clonefile.h>)
+  #include <sys/clonefile.h>
+  #define RX_HAVE_CLONEFILE 1
+#endif
 
 using std::cerr;
 using std::endl;
@@ -48,6 +57,7 @@ string pathJoin(std::initializer_list<const string> l) {
 
 struct Req {
   volatile long canceled = 0;
+  uint64_t      traceStart = 0; // when submitted, if tracing
   // virtual void finalize(uv_fs_t* r) = 0;
 };
 
@@ -58,8 +68,7 @@ struct FSReq : Req {
 
 
 template <typename T> AsyncCanceler makeReqCanceler(T* req) {
-  typename T::Ref reqR{req, /*add_ref=*/true};
-  return std::move([reqR]() {
+  return [reqR = typename T::Ref{req, /*add_ref=*/true}]() {
     if (reqR) {
       assert(reqR == true);
       assert(&reqR->uvreq != nullptr);
@@ -67,38 +76,68 @@ template <typename T> AsyncCanceler makeReqCanceler(T* req) {
       reqR->canceled = 1;
       reqR.resetSelf();
     }
-  });
+  };
 }
 
 
-struct StatReq final : FSReq, SafeRefCounted<StatReq> {
-  StatReq(StatCallback&& cb) : FSReq{}, cb{fwdarg(cb)} { this->uvreq.data = (void*)this; }
+// Requests are made and completed on the loop thread, so their reference counts are biased
+// towards it. Only a canceler used on another thread pays for atomic operations.
+
+struct StatReq final : FSReq, BiasedRefCounted<StatReq> {
+  StatReq(Async& a, StatCallback&& cb) : FSReq{}, BiasedRefCounted{a}, cb{fwdarg(cb)} {
+    this->uvreq.data = (void*)this;
+  }
   // virtual void finalize(uv_fs_t* r) final {  }
   StatCallback cb;
 };
 
 
-struct ReadDirReq final : FSReq, SafeRefCounted<ReadDirReq> {
-  ReadDirReq(ReadDirCallback&& cb) : FSReq{}, cb{fwdarg(cb)} { this->uvreq.data = (void*)this; }
+struct ReadDirReq final : FSReq, BiasedRefCounted<ReadDirReq> {
+  ReadDirReq(Async& a, ReadDirCallback&& cb) : FSReq{}, BiasedRefCounted{a}, cb{fwdarg(cb)} {
+    this->uvreq.data = (void*)this;
+  }
   ReadDirCallback cb;
 };
 
 
-struct ReadLinkReq final : FSReq, SafeRefCounted<ReadLinkReq> {
-  ReadLinkReq(ReadLinkCallback&& cb) : FSReq{}, cb{fwdarg(cb)} { this->uvreq.data = (void*)this; }
+struct ReadLinkReq final : FSReq, BiasedRefCounted<ReadLinkReq> {
+  ReadLinkReq(Async& a, ReadLinkCallback&& cb) : FSReq{}, BiasedRefCounted{a}, cb{fwdarg(cb)} {
+    this->uvreq.data = (void*)this;
+  }
   ReadLinkCallback cb;
 };
 
 
 inline Error UVError(ssize_t err) {
   // Specialized for ssize_t
-  return (err < 0) ? UVError((int)err) : Error{};
+  return (err < 0) ? rx::UVError((int)err) : Error{};
+}
+
+
+static Error ErrnoError(int e) {
+  // libuv's error codes are negated errno values, which makes this an inline, allocation free
+  // Error with the same message as uv_strerror
+  return rx::UVError(e != 0 ? -e : UV_EIO);
+}
+
+
+static const char* TraceName(uv_fs_type t) {
+  switch (t) {
+    case UV_FS_LSTAT:    return "lstat";
+    case UV_FS_STAT:     return "stat";
+    case UV_FS_READDIR:  return "readdir";
+    case UV_FS_READLINK: return "readlink";
+    default:             return "uv_fs";
+  }
 }
 
 
 template <typename ReqT>
 static void FinalizeAsyncReq(uv_fs_t* r) {
   auto* req = (ReqT*)r->data;
+  if (req->traceStart != 0 && trace::enabled()) {
+    trace::recordAsync("fs", TraceName(r->fs_type), req->traceStart, trace::now(), r->path);
+  }
   if (r->result != UV_ECANCELED && !req->canceled) {
     req->cb(UVError(r->result), {*r});
   }
@@ -122,17 +161,18 @@ static void AsyncFSCallBack(uv_fs_t* r) {
 
 template <typename ReqT, typename CB, typename UVF, typename... UVFArgs>
 inline AsyncCanceler _AsyncFSCall(
-    const string& path,
+    const char* path,
     Async&     a,
     CB&&       cb,
     UVF&&      uvcall,
     UVFArgs... uvargs)
 {
   // Note: We can perform the sync equivalent by passing NULL instead of AsyncFSCallBack
-  auto* req = new ReqT{fwdarg(cb)};
-  auto st = uvcall(a.uvloop(), &req->uvreq, path.c_str(), uvargs...);
+  auto* req = new ReqT{a, fwdarg(cb)};
+  if (trace::enabled()) req->traceStart = trace::now();
+  auto st = uvcall(a.uvloop(), &req->uvreq, path, uvargs...);
   if (st != 0) {
-    cb(UVError(st), {});
+    req->cb(UVError(st), {}); // `cb` has been moved into `req`
     delete req; //req->releaseRef();
     return []{};
   } else {
@@ -142,78 +182,67 @@ inline AsyncCanceler _AsyncFSCall(
 
 
 template <typename T, typename UVF, typename... UVFArgs>
-inline Error _SyncFSCall(const string& path, T& result, UVF&& uvcall, UVFArgs... uvargs) {
+inline Error _SyncFSCall(const char* path, T& result, UVF&& uvcall, UVFArgs... uvargs) {
   uv_fs_t r;
-  auto err = UVError(uvcall(Async::main().uvloop(), &r, path.c_str(), uvargs...));
+  auto err = UVError(uvcall(Async::main().uvloop(), &r, path, uvargs...));
   if (!err) result = T{r};
   return err;
 }
 
 
 template <typename ReqT, typename CB, typename UVF>
-inline AsyncCanceler AsyncFSCall(const string& path, Async& a, CB&& cb, UVF&& uvcall) {
+inline AsyncCanceler AsyncFSCall(const char* path, Async& a, CB&& cb, UVF&& uvcall) {
   return _AsyncFSCall<ReqT>(path, a, fwdarg(cb), fwdarg(uvcall), AsyncFSCallBack);
 }
 
 template <typename ReqT, typename CB, typename UVF, typename... UVFArgs>
 inline AsyncCanceler AsyncFSCall(
-    const string& path, Async& a, CB&& cb, UVF&& uvcall, UVFArgs... uvargs)
+    const char* path, Async& a, CB&& cb, UVF&& uvcall, UVFArgs... uvargs)
 {
   return _AsyncFSCall<ReqT>(path, a, fwdarg(cb), fwdarg(uvcall), uvargs..., AsyncFSCallBack);
 }
 
 
 template <typename T, typename UVF>
-inline Error SyncFSCall(const string& path, T& result, UVF&& uvcall) {
+inline Error SyncFSCall(const char* path, T& result, UVF&& uvcall) {
   return _SyncFSCall(path, result, fwdarg(uvcall), (uv_fs_cb)NULL);
 }
 
 template <typename T, typename UVF, typename... UVFArgs>
-inline Error SyncFSCall(const string& path, T& result, UVF&& uvcall, UVFArgs... uvargs) {
+inline Error SyncFSCall(const char* path, T& result, UVF&& uvcall, UVFArgs... uvargs) {
   return _SyncFSCall(path, result, fwdarg(uvcall), uvargs..., (uv_fs_cb)NULL);
 }
 
 
-// ------------------------------------------------------------------------------------------------
-
-struct CustomReq final : Req, SafeRefCounted<CustomReq> {
-  using Callback = func<void()>;
-  using MainFunc = func<Callback()>;
-  CustomReq(MainFunc&& main) : Req{}, main{fwdarg(main)} { this->uvreq.data = (void*)this; }
-  MainFunc  main;
-  Callback  cb;
-  uv_work_t uvreq;
-};
-
-
-static void UVWorkCB(uv_work_t* r) {
-  // Called in some thread to perform blocking work
-  auto* req = (CustomReq*)r->data;
-  if (!req->canceled) {
-    req->cb = req->main();
+template <typename ReqT, typename CB, typename... Args>
+inline AsyncCanceler AsyncFSCall(const Path& path, Async& a, CB&& cb, Args... args) {
+  if (path.overflow()) {
+    cb(path.error(), {});
+    return []{};
   }
+  return AsyncFSCall<ReqT>(path.c_str(), a, fwdarg(cb), args...);
 }
 
-static void UVAfterWorkCB(uv_work_t* r, int status) {
-  // Called in user-designated thread when work is complete
-  auto* req = (CustomReq*)r->data;
-  if (!req->canceled && req->cb) {
-    req->cb();
-  }
-  req->releaseRef();
+template <typename T, typename... Args>
+inline Error SyncFSCall(const Path& path, T& result, Args... args) {
+  return path.overflow() ? path.error() : SyncFSCall(path.c_str(), result, args...);
 }
 
 
-AsyncCanceler AsyncWork(Async& a, Error& err, func<func<void()>()> f) {
-  auto* req = new CustomReq{fwdarg(f)};
-  auto st = uv_queue_work(a.uvloop(), &req->uvreq, UVWorkCB, UVAfterWorkCB);
-  if (st != 0) {
-    err = UVError(st);
-    delete req;
-    return nullptr;
-  } else {
-    return makeReqCanceler(req);
+// ------------------------------------------------------------------------------------------------
+
+AsyncCanceler AsyncWork(Async& a, const char* name, const string& path, Executor::Work&& f) {
+  // Runs `f` on the I/O executor and then the function it returns in `a`'s thread. File I/O is
+  // kept off libuv's small shared thread pool, which is left to the uv_fs_* requests.
+  if (trace::enabled()) {
+    f = [=, queued = trace::now(), f = std::move(f)]() -> func<void()> {
+      auto start = trace::now();
+      auto cb = f();
+      trace::record("fs", name, queued, start, trace::now(), path.c_str());
+      return cb;
+    };
   }
+  return Executor::io().run(a, fwdarg(f));
 }
 
 
@@ -247,8 +276,11 @@ static char* MMapFileReadOnly(const char* path, size_t& size, int& fd) {
   }
 
   void* ptr = mmap(0, size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
+  auto errnox = errno;
+  ::close(fd); // the mapping outlives the descriptor, so don't tie one up per loaded file
+  fd = -1;
   if (ptr == MAP_FAILED) {
-    ::close(fd);
+    errno = errnox;
     return nullptr;
   }
 
@@ -257,22 +289,19 @@ static char* MMapFileReadOnly(const char* path, size_t& size, int& fd) {
 
 
 AsyncCanceler readfile(Async& a, const string& path, size_t size, ReadFileCallback&& cb) {
-  Error err;
-  auto ac = AsyncWork(a, err, [=]() -> CustomReq::Callback {
+  return AsyncWork(a, "readfile", path, [=, cb = fwdarg(cb)]() mutable -> func<void()> {
     int fd;
     size_t z = size;
     char* ptr = MMapFileReadOnly(path.c_str(), z, fd);
     auto errnox = errno;
-    return [=]{
+    return [=, cb = std::move(cb)]{
       if (ptr == nullptr) {
-        cb(Error(strerror(errnox)), {});
+        cb(ErrnoError(errnox), {});
       } else {
         cb(nullptr, {ptr, z, fd});
       }
     };
   });
-  if (!ac) cb(err, {});
-  return std::move(ac);
 }
 
 
@@ -280,7 +309,7 @@ Error readfile(const string& path, size_t size, FileData& result) {
   int fd;
   char* ptr = MMapFileReadOnly(path.c_str(), size, fd);
   if (ptr == nullptr) {
-    return Error(strerror(errno));
+    return ErrnoError(errno);
   } else {
     result.p = ptr;
     result.z = size;
@@ -293,13 +322,371 @@ Error readfile(const string& path, size_t size, FileData& result) {
 // ------------------------------------------------------------------------------------------------
 
 
+static string pathDir(const string& path) {
+  auto i = path.rfind('/');
+  return (i == string::npos) ? string{"."} : (i == 0) ? string{"/"} : path.substr(0, i);
+}
+
+
+static int mkdirs(const string& dir) {
+  // Like `mkdir -p`. Returns 0 on success or -1 with errno set.
+  if (::mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST) return 0;
+  if (errno != ENOENT) return -1;
+  auto parent = pathDir(dir);
+  if (parent == dir || mkdirs(parent) != 0) return -1;
+  return (::mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST) ? 0 : -1;
+}
+
+
+static int fsyncPath(const string& path) {
+  // Directories can't be opened for writing, so we open everything read-only.
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return -1;
+  int st = ::fsync(fd);
+  auto errnox = errno;
+  ::close(fd);
+  errno = errnox;
+  return st;
+}
+
+
+AtomicWriter::AtomicWriter(const string& path, FSync sync, SyncBatch* batch)
+  : _path{path}, _sync{sync}, _batch{batch}
+{
+  assert(_sync != FSync::Batch || _batch != nullptr);
+}
+
+
+AtomicWriter::~AtomicWriter() {
+  discard();
+}
+
+
+Error AtomicWriter::open() {
+  assert(_fd == -1);
+  // The temporary file lives in the destination directory so that rename(2) is atomic
+  auto dir = pathDir(_path);
+  auto name = (dir.size() < _path.size()) ? _path.substr(_path.rfind('/')+1) : _path;
+  _tmppath = pathJoin(dir, "." + name + ".XXXXXX");
+  _fd = ::mkstemp((char*)_tmppath.data());
+  if (_fd < 0 && errno == ENOENT && mkdirs(dir) == 0) {
+    _tmppath = pathJoin(dir, "." + name + ".XXXXXX");
+    _fd = ::mkstemp((char*)_tmppath.data());
+  }
+  if (_fd < 0) {
+    auto errnox = errno;
+    _tmppath.clear();
+    return ErrnoError(errnox);
+  }
+  ::fchmod(_fd, 0644); // mkstemp creates files with mode 0600
+  return nullptr;
+}
+
+
+Error AtomicWriter::write(const char* p, size_t z) {
+  iovec iov{(void*)p, z};
+  return write(&iov, 1);
+}
+
+
+Error AtomicWriter::write(const iovec* iovp, int iovcnt) {
+  assert(_fd != -1);
+  // Copy the vector as we need to adjust entries on partial writes
+  std::vector<iovec> iov{iovp, iovp + iovcnt};
+  auto I = iov.begin();
+  auto E = iov.end();
+  while (I != E) {
+    ssize_t n = ::writev(_fd, &*I, (int)std::min<ptrdiff_t>(E - I, IOV_MAX));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return ErrnoError(errno);
+    }
+    // Skip fully written buffers and adjust a partially written one
+    while (I != E && (size_t)n >= I->iov_len) {
+      n -= I->iov_len;
+      ++I;
+    }
+    if (n) {
+      I->iov_base = (char*)I->iov_base + n;
+      I->iov_len -= n;
+    }
+  }
+  return nullptr;
+}
+
+
+Error AtomicWriter::commit() {
+  assert(_fd != -1);
+  if (_sync == FSync::File && ::fsync(_fd) != 0) {
+    return ErrnoError(errno);
+  }
+  if (::close(_fd) != 0) {
+    _fd = -1;
+    return ErrnoError(errno);
+  }
+  _fd = -1;
+  if (::rename(_tmppath.c_str(), _path.c_str()) != 0) {
+    return ErrnoError(errno);
+  }
+  _tmppath.clear();
+  switch (_sync) {
+    case FSync::None: break;
+    case FSync::File: {
+      // Make the rename itself durable
+      if (fsyncPath(pathDir(_path)) != 0) return ErrnoError(errno);
+      break;
+    }
+    case FSync::Batch: {
+      _batch->add(_path);
+      break;
+    }
+  }
+  return nullptr;
+}
+
+
+void AtomicWriter::discard() {
+  if (_fd != -1) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  if (!_tmppath.empty()) {
+    ::unlink(_tmppath.c_str());
+    _tmppath.clear();
+  }
+}
+
+
+Error writefile(const string& path, const iovec* iov, int iovcnt, FSync sync, SyncBatch* batch) {
+  AtomicWriter w{path, sync, batch};
+  auto err = w.open();
+  if (!err) err = w.write(iov, iovcnt);
+  if (!err) err = w.commit();
+  return err;
+}
+
+
+Error writefile(const string& path, const char* p, size_t z, FSync sync, SyncBatch* batch) {
+  iovec iov{(void*)p, z};
+  return writefile(path, &iov, 1, sync, batch);
+}
+
+
+AsyncCanceler writefile(
+    Async&              a,
+    const string&       path,
+    std::vector<iovec>&& bufs,
+    FSync               sync,
+    SyncBatch*          batch,
+    WriteFileCallback&& cb)
+{
+  return AsyncWork(a, "writefile", path, [=, bufs = std::move(bufs), cb = fwdarg(cb)]() mutable
+                      -> func<void()> {
+    auto err = writefile(path, bufs.data(), (int)bufs.size(), sync, batch);
+    return [err, cb = std::move(cb)]{ cb(err); };
+  });
+}
+
+
+AsyncCanceler writefile(
+    Async&              a,
+    const string&       path,
+    string&&            data,
+    FSync               sync,
+    SyncBatch*          batch,
+    WriteFileCallback&& cb)
+{
+  return AsyncWork(a, "writefile", path, [=, data = std::move(data), cb = fwdarg(cb)]() mutable
+                      -> func<void()> {
+    auto err = writefile(path, data.data(), data.size(), sync, batch);
+    return [err, cb = std::move(cb)]{ cb(err); };
+  });
+}
+
+
+// ------------------------------------------------------------------------------------------------
+
+
+static string tempSiblingPath(const string& path) {
+  // A name in the same directory as `path` which isn't used by anyone else in this process
+  static volatile long counter = 0;
+  auto i = path.rfind('/');
+  auto dir = (i == string::npos) ? string{} : path.substr(0, i+1);
+  auto name = (i == string::npos) ? path : path.substr(i+1);
+  return dir + "." + name + "." + std::to_string(::getpid()) + "-" +
+         std::to_string(__sync_add_and_fetch(&counter, 1));
+}
+
+
+static bool reflinkFile(int srcfd, AtomicWriter& w) {
+  // True if `w` now holds a copy-on-write clone of the file at `srcfd`
+  #if defined(FICLONE)
+  return ::ioctl(w.fd(), FICLONE, srcfd) == 0;
+  #else
+  return false;
+  #endif
+}
+
+
+static int copyFileData(int srcfd, int dstfd, size_t size) {
+  // Returns 0 on success or -1 with errno set
+  #if defined(__linux__)
+  // In-kernel copy. Might still share blocks on file systems which support it (e.g. NFS, XFS).
+  size_t remaining = size;
+  while (remaining) {
+    auto n = ::copy_file_range(srcfd, nullptr, dstfd, nullptr, remaining, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (remaining == size && (errno == ENOSYS || errno == EXDEV || errno == EINVAL)) {
+        break; // not supported for these files; fall back to read+write
+      }
+      return -1;
+    }
+    if (n == 0) return 0; // src shrunk while copying
+    remaining -= n;
+  }
+  if (remaining == 0) return 0;
+  #endif
+
+  char buf[64 * 1024];
+  while (true) {
+    auto n = ::read(srcfd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) return 0;
+    for (ssize_t w = 0; w < n; ) {
+      auto wn = ::write(dstfd, buf + w, n - w);
+      if (wn < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      w += wn;
+    }
+  }
+}
+
+
+Error materialize(const string& src, const string& dst, Materialize mode) {
+  struct stat srcst, dstst;
+  if (::stat(src.c_str(), &srcst) != 0) return ErrnoError(errno);
+  if (::stat(dst.c_str(), &dstst) == 0 &&
+      dstst.st_dev == srcst.st_dev && dstst.st_ino == srcst.st_ino) {
+    return nullptr; // already linked
+  }
+
+  #if RX_HAVE_CLONEFILE
+  {
+    auto tmppath = tempSiblingPath(dst);
+    if (::clonefile(src.c_str(), tmppath.c_str(), 0) == 0) {
+      if (::rename(tmppath.c_str(), dst.c_str()) == 0) return nullptr;
+      ::unlink(tmppath.c_str());
+    }
+  }
+  #endif
+
+  int srcfd = ::open(src.c_str(), O_RDONLY);
+  if (srcfd < 0) return ErrnoError(errno);
+
+  AtomicWriter w{dst};
+  auto err = w.open();
+  if (!err) {
+    if (reflinkFile(srcfd, w)) {
+      ::fchmod(w.fd(), srcst.st_mode & 07777);
+      err = w.commit();
+      ::close(srcfd);
+      return err;
+    }
+    if (mode == Materialize::Link) {
+      // Hardlink to a temporary name and then rename over `dst` to keep replacement atomic
+      auto tmppath = tempSiblingPath(dst);
+      if (::link(src.c_str(), tmppath.c_str()) == 0) {
+        if (::rename(tmppath.c_str(), dst.c_str()) == 0) {
+          ::close(srcfd);
+          return nullptr; // `w` discards its temporary file
+        }
+        ::unlink(tmppath.c_str());
+      }
+    }
+    if (copyFileData(srcfd, w.fd(), srcst.st_size) != 0) {
+      err = ErrnoError(errno);
+    } else {
+      ::fchmod(w.fd(), srcst.st_mode & 07777);
+      err = w.commit();
+    }
+  }
+  ::close(srcfd);
+  return err;
+}
+
+
+AsyncCanceler materialize(
+    Async&                a,
+    const string&         src,
+    const string&         dst,
+    Materialize           mode,
+    MaterializeCallback&& cb)
+{
+  return AsyncWork(a, "materialize", dst, [=, cb = fwdarg(cb)]() mutable -> func<void()> {
+    auto err = materialize(src, dst, mode);
+    return [err, cb = std::move(cb)]{ cb(err); };
+  });
+}
+
+
+// ------------------------------------------------------------------------------------------------
+
+
+SyncBatch::SyncBatch() { uv_mutex_init(&_mu); }
+SyncBatch::~SyncBatch() { uv_mutex_destroy(&_mu); }
+
+
+void SyncBatch::add(const string& filename) {
+  uv_mutex_lock(&_mu);
+  _files.emplace_back(filename);
+  uv_mutex_unlock(&_mu);
+}
+
+
+Error SyncBatch::flush() {
+  std::vector<string> files;
+  uv_mutex_lock(&_mu);
+  std::swap(files, _files);
+  uv_mutex_unlock(&_mu);
+
+  // File data first, then each directory entry. Many files usually share a few directories.
+  Error err;
+  std::set<string> dirs;
+  for (auto& filename : files) {
+    if (fsyncPath(filename) != 0 && !err) err = ErrnoError(errno);
+    dirs.emplace(pathDir(filename));
+  }
+  for (auto& dir : dirs) {
+    if (fsyncPath(dir) != 0 && !err) err = ErrnoError(errno);
+  }
+  return err;
+}
+
+
+AsyncCanceler SyncBatch::flush(Async& a, func<void(Error)>&& cb) {
+  return AsyncWork(a, "syncbatch", {}, [this, cb = fwdarg(cb)]() mutable -> func<void()> {
+    auto err = flush();
+    return [err, cb = std::move(cb)]{ cb(err); };
+  });
+}
+
+
+// ------------------------------------------------------------------------------------------------
+
+
 AsyncCanceler readlink(const string& path, Async& a, ReadLinkCallback&& cb) {
-  return AsyncFSCall<ReadLinkReq>(path, a, fwdarg(cb), uv_fs_readlink);
+  return AsyncFSCall<ReadLinkReq>(path.c_str(), a, fwdarg(cb), uv_fs_readlink);
 }
 
 
 Error readlink(const string& path, SymLink& result) {
-  return SyncFSCall(path, result, uv_fs_readlink);
+  return SyncFSCall(path.c_str(), result, uv_fs_readlink);
 }
 
 
@@ -307,11 +694,19 @@ Error readlink(const string& path, SymLink& result) {
 
 
 AsyncCanceler readdir(const string& path, Async& a, ReadDirCallback&& cb) {
-  return AsyncFSCall<ReadDirReq>(path, a, fwdarg(cb), uv_fs_readdir, O_RDONLY);
+  return AsyncFSCall<ReadDirReq>(path.c_str(), a, fwdarg(cb), uv_fs_readdir, O_RDONLY);
 }
 
 
 Error readdir(const string& path, DirEnts& result) {
+  return SyncFSCall(path.c_str(), result, uv_fs_readdir, O_RDONLY);
+}
+
+AsyncCanceler readdir(const Path& path, Async& a, ReadDirCallback&& cb) {
+  return AsyncFSCall<ReadDirReq>(path, a, fwdarg(cb), uv_fs_readdir, O_RDONLY);
+}
+
+Error readdir(const Path& path, DirEnts& result) {
   return SyncFSCall(path, result, uv_fs_readdir, O_RDONLY);
 }
 
@@ -384,18 +779,34 @@ DirEnts& DirEnts::operator=(DirEnts&& other) {
 // ------------------------------------------------------------------------------------------------
 
 AsyncCanceler stat(const string& path, Async& a, StatCallback&& cb) {
-  return AsyncFSCall<StatReq>(path, a, fwdarg(cb), uv_fs_stat);
+  return AsyncFSCall<StatReq>(path.c_str(), a, fwdarg(cb), uv_fs_stat);
 }
 
 Error stat(const string& path, Stat& result) {
-  return SyncFSCall(path, result, uv_fs_stat);
+  return SyncFSCall(path.c_str(), result, uv_fs_stat);
 }
 
 AsyncCanceler lstat(const string& path, Async& a, StatCallback&& cb) {
-  return AsyncFSCall<StatReq>(path, a, fwdarg(cb), uv_fs_lstat);
+  return AsyncFSCall<StatReq>(path.c_str(), a, fwdarg(cb), uv_fs_lstat);
 }
 
 Error lstat(const string& path, Stat& result) {
+  return SyncFSCall(path.c_str(), result, uv_fs_lstat);
+}
+
+AsyncCanceler stat(const Path& path, Async& a, StatCallback&& cb) {
+  return AsyncFSCall<StatReq>(path, a, fwdarg(cb), uv_fs_stat);
+}
+
+Error stat(const Path& path, Stat& result) {
+  return SyncFSCall(path, result, uv_fs_stat);
+}
+
+AsyncCanceler lstat(const Path& path, Async& a, StatCallback&& cb) {
+  return AsyncFSCall<StatReq>(path, a, fwdarg(cb), uv_fs_lstat);
+}
+
+Error lstat(const Path& path, Stat& result) {
   return SyncFSCall(path, result, uv_fs_lstat);
 }
 
@@ -422,23 +833,59 @@ Stat::Stat(const uv_fs_t& r)
 // ===============================================================================================
 
 
-struct ScanDirCtx : SafeRefCounted<ScanDirCtx> {
-  string         basedir;
-  Async&         async;
-  size_t         depthLimit;
-  ScanDirFunc    eachFunc;
-  ScanDirCB      cb;
-  AsyncGroup     asyncGroup;
+struct ScanDirCtx : BiasedRefCounted<ScanDirCtx> {
+  struct Entry {
+    // Kept small so that closures capturing an entry fit in a func without allocating; see the
+    // static_asserts in dispatchStat and dispatchLinkStat.
+    const string* dirname;  // interned in `dirnames`
+    const string* filename; // owned by `filenames`
+    uint32_t      depth;
+    bool          recheck;  // match ignore rules again once we know if it's a directory
+  };
+
+  struct AliasEnt {
+    string   dirname;
+    string   filename;
+    fs::Stat st;
+    uint32_t depth = 0; // for directories
+    bool operator<(const AliasEnt& other) const {
+      return (dirname == other.dirname) ? filename < other.filename : dirname < other.dirname;
+    }
+  };
 
-  ScanDirCtx(const string& basedir, Async& async, size_t depth, ScanDirFunc&& f, ScanDirCB&& cb)
-    : basedir{basedir}
+  string                     basedir;
+  Async&                     async;
+  size_t                     depthLimit;
+  IgnoreRules                ignore;
+  ScanDirFunc                eachFunc;
+  ScanDirCB                  cb;
+  AsyncGroup                 asyncGroup;
+  std::unordered_set<string> dirnames; // relative to basedir. Node-based; pointers are stable.
+  std::deque<string>         filenames; // of entries. Pointers are stable as we only append.
+  FileIDSet                  visitedDirs;
+  FileIDSet                  visitedFiles;
+  std::vector<AliasEnt>      aliases; // files reached through a symlink or with multiple links
+  std::vector<AliasEnt>      linkedDirs; // directories reached through a symlink, not yet read
+  size_t                     activeJobs = 0;
+
+  ScanDirCtx(
+      const string& basedir,
+      Async&        async,
+      size_t        depth,
+      IgnoreRules&& ignore,
+      ScanDirFunc&& f,
+      ScanDirCB&&   cb)
+    : BiasedRefCounted{async}
+    , basedir{basedir}
     , async{async}
     , depthLimit{depth}
-    , eachFunc{f}
-    , cb{cb}
+    , ignore{std::move(ignore)}
+    , eachFunc{fwdarg(f)}
+    , cb{fwdarg(cb)}
     , asyncGroup{
-      [=](Error err) {
-        cb(err);
+      [this](Error err) {
+        if (!err) visitAliases();
+        this->cb(err);
         this->releaseRef();
       }
     }
@@ -453,54 +900,202 @@ struct ScanDirCtx : SafeRefCounted<ScanDirCtx> {
     }
   }
 
-  bool considerDirEntry(const string& dirname, const string& filename, fs::Stat&& st, size_t depth) {
-    assert(!st.isSymlink()); // because we're using fs::stat, not fs::lstat
-    if (!eachFunc(dirname, filename, st)) {
+  AsyncGroup::Job beginJob() {
+    ++activeJobs;
+    return asyncGroup.begin();
+  }
+
+  void endJob(AsyncGroup::Job job, Error err=nullptr) {
+    // When the last job ends, directories reached through symlinks are read before the group is
+    // allowed to end
+    if (--activeJobs == 0 && !err && !linkedDirs.empty() && !visitLinkedDirs()) {
+      return; // canceled
+    }
+    asyncGroup.end(job, fwdarg(err));
+  }
+
+  bool considerDirEntry(const Entry& ent, fs::Stat&& st) {
+    assert(!st.isSymlink()); // because links are resolved before we get here
+    if (!eachFunc(*ent.dirname, *ent.filename, st)) {
       // eachFunc returned false to signal that we should stop digging
       return false;
-    } else if (depth < depthLimit && st.isDir()) {
-      dispatchReadDir(pathJoin(dirname,filename), depth+1);
+    } else if (ent.depth < depthLimit && st.isDir()) {
+      Path path{*ent.dirname};
+      path.append(*ent.filename);
+      dispatchReadDir(path, ent.depth+1);
     }
     return true;
   }
 
-  void dispatchStat(const string& dirname, const string& filename, size_t depth) {
-    auto path = pathJoin(basedir,dirname,filename);
-    auto job = asyncGroup.begin();
-    *job = fs::stat(path, async, [=](Error err, fs::Stat&& st) {
-      if (!err) {
-        if (considerDirEntry(dirname, filename, fwdarg(st), depth)) {
-          asyncGroup.end(job); // Task completed.
-        } else {
-          // eachFunc signalled "abort!"
-          // Note that we should _not_ mark the job as completed as it's about to be canceled.
-          cancel();
-        }
+  bool visitLinkedDirs() {
+    // Directories reached through a symlink are read only once every directory with a real name
+    // has been, and in a stable order, so that which name a directory is visited under doesn't
+    // depend on the order in which I/O completes. Reading them might turn up more links, which
+    // are read in another round.
+    auto dirs = std::move(linkedDirs);
+    linkedDirs.clear();
+    std::sort(dirs.begin(), dirs.end());
+    for (auto& ent : dirs) {
+      if (!visitedDirs.emplace(ent.st.id()).second) {
+        continue; // already visited through another name, or a symlink cycle
+      }
+      if (!eachFunc(ent.dirname, ent.filename, ent.st)) {
+        cancel();
+        return false;
+      }
+      if (ent.depth < depthLimit) {
+        Path path{ent.dirname};
+        path.append(ent.filename);
+        dispatchReadDir(path, ent.depth+1);
+      }
+    }
+    return true;
+  }
+
+  void visitAliases() {
+    // Files which might have been visited under another name are considered last, once we know
+    // all the regular names, and in a stable order.
+    std::sort(aliases.begin(), aliases.end());
+    for (auto& ent : aliases) {
+      if (!visitedFiles.emplace(ent.st.id()).second) {
+        continue; // already visited through another name
+      }
+      if (!eachFunc(ent.dirname, ent.filename, ent.st)) {
+        break;
+      }
+    }
+    aliases.clear();
+  }
+
+  void statEntry(AsyncGroup::Job job, Error err, const Entry& ent, fs::Stat&& st, bool isLink) {
+    if (err) {
+      // Task completed. We ignore stat errors, including dangling symlinks.
+      endJob(job);
+      return;
+    }
+    if (ent.recheck) {
+      Path relpath{*ent.dirname};
+      relpath.append(*ent.filename);
+      auto kind = st.isDir() ? IgnoreRules::Kind::Dir : IgnoreRules::Kind::File;
+      if (ignore.match(relpath.c_str(), relpath.size(), kind) == IgnoreRules::Match::Ignore) {
+        // Excluded by a directory-only rule
+        endJob(job);
+        return;
+      }
+    }
+    if (st.isDir()) {
+      if (isLink) {
+        linkedDirs.push_back({*ent.dirname, *ent.filename, fwdarg(st), ent.depth});
+        endJob(job);
+        return;
+      }
+      if (!visitedDirs.emplace(st.id()).second) {
+        endJob(job); // already visited, e.g. through a bind mount
+        return;
+      }
+    } else if (isLink || st.nlink > 1) {
+      aliases.push_back({*ent.dirname, *ent.filename, fwdarg(st)});
+      endJob(job);
+      return;
+    } else {
+      visitedFiles.emplace(st.id());
+    }
+    if (considerDirEntry(ent, fwdarg(st))) {
+      endJob(job); // Task completed.
+    } else {
+      // eachFunc signalled "abort!"
+      // Note that we should _not_ mark the job as completed as it's about to be canceled.
+      cancel();
+    }
+  }
+
+  Path entryPath(const Entry& ent) const {
+    Path path{basedir};
+    path.append(*ent.dirname).append(*ent.filename);
+    return path;
+  }
+
+  void dispatchStat(const Entry& ent) {
+    auto job = beginJob();
+    auto path = entryPath(ent);
+    auto fn = [this, job, ent](Error err, fs::Stat&& st) {
+      if (!err && st.isSymlink()) {
+        // Resolve the link as a new job. Begin it before ending this one, or the group might end.
+        dispatchLinkStat(ent);
+        endJob(job);
       } else {
-        // Task completed. We ignore stat errors
-        asyncGroup.end(job);
+        statEntry(job, err, ent, fwdarg(st), false);
+      }
+    };
+    static_assert(sizeof(fn) <= fs::StatCallback::kInlineSize, "stat closure would allocate");
+    asyncGroup[job] = fs::lstat(path, async, std::move(fn));
+  }
+
+  void dispatchLinkStat(const Entry& ent) {
+    auto job = beginJob();
+    auto path = entryPath(ent);
+    auto fn = [this, job, ent](Error err, fs::Stat&& st) {
+      statEntry(job, err, ent, fwdarg(st), true);
+    };
+    static_assert(sizeof(fn) <= fs::StatCallback::kInlineSize, "stat closure would allocate");
+    asyncGroup[job] = fs::stat(path, async, std::move(fn));
+  }
+
+  void dispatchReadDir(const Path& reldir, size_t depth) {
+    auto job = beginJob();
+    auto* dirname = &*dirnames.emplace(reldir.c_str(), reldir.size()).first;
+    Path dirpath{basedir};
+    dirpath.append(reldir);
+    asyncGroup[job] = fs::readdir(dirpath, async, [=](Error err, const fs::DirEnts& entries) {
+      if (err) {
+        endJob(job, fwdarg(err));
+        return;
+      }
+      Path relpath{*dirname};
+      auto relpathz = relpath.size();
+      for (auto ent : entries) {
+        auto m = IgnoreRules::Match::Keep;
+        if (!ignore.empty()) {
+          relpath.append(ent.c_str());
+          m = ignore.match(relpath.c_str(), relpath.size(), IgnoreRules::Kind::Unknown);
+          relpath.truncate(relpathz);
+        }
+        if (m != IgnoreRules::Match::Ignore) {
+          filenames.emplace_back(ent);
+          bool recheck = m == IgnoreRules::Match::Unknown;
+          dispatchStat({dirname, &filenames.back(), (uint32_t)depth, recheck});
+        }
       }
+      endJob(job, fwdarg(err));
     });
   }
 
-  void dispatchReadDir(const string& path, size_t depth) {
-    auto job = asyncGroup.begin();
-    *job = fs::readdir(pathJoin(basedir,path), async, [=](Error err, const fs::DirEnts& entries) {
-      if (!err) for (auto ent : entries) {
-        auto filename = string(ent);
-        dispatchStat(path, filename, depth);
+  void dispatchRoot() {
+    // Record the identity of the base directory so that links back to it are recognized
+    auto job = beginJob();
+    asyncGroup[job] = fs::stat(basedir, async, [=](Error err, fs::Stat&& st) {
+      if (!err) {
+        visitedDirs.emplace(st.id());
+        dispatchReadDir(Path{}, 0);
       }
-      asyncGroup.end(job, fwdarg(err));
+      endJob(job, fwdarg(err));
     });
   }
 };
 
 
-AsyncCanceler scandir(const string& dirname, Async& a, size_t d, ScanDirFunc&& f, ScanDirCB&& cb) {
-  ScanDirCtx::Ref ctx{new ScanDirCtx{dirname, a, d, fwdarg(f), fwdarg(cb)}};
+AsyncCanceler scandir(
+    const string& dirname,
+    Async&        a,
+    size_t        d,
+    IgnoreRules&& ignore,
+    ScanDirFunc&& f,
+    ScanDirCB&&   cb)
+{
+  ScanDirCtx::Ref ctx{new ScanDirCtx{dirname, a, d, fwdarg(ignore), fwdarg(f), fwdarg(cb)}};
   ctx->retainRef(); // we release this when invoking cb or cancel
-  ctx->dispatchReadDir({}, 0);
-  return [ctx]{
+  ctx->dispatchRoot();
+  return [ctx = std::move(ctx)]{
     if (ctx && ctx->cancel()) {
       ctx.resetSelf(); // clear ref held by this closure
     }
@@ -508,5 +1103,10 @@ AsyncCanceler scandir(const string& dirname, Async& a, size_t d, ScanDirFunc&& f
 }
 
 
+AsyncCanceler scandir(const string& dirname, Async& a, size_t d, ScanDirFunc&& f, ScanDirCB&& cb) {
+  return scandir(dirname, a, d, IgnoreRules{}, fwdarg(f), fwdarg(cb));
+}
+
+
 
 }} // namespace
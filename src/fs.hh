@@ -4,6 +4,8 @@
 #include "asynccanceler.hh"
 #include "error.hh"
 #include "util.hh"
+#include "ignore.hh"
+#include "path.hh"
 
 namespace rx {
 namespace fs {
@@ -16,6 +18,9 @@ string pathJoin(std::initializer_list<const string>);
 template <typename... Args> string pathJoin(Args...);
   // E.g. ("a/b","c/d") -> "a/b/c/d", ("","c/d") -> "c/d", ("a/b","") -> "a/b"
 
+// Functions below that accept a `Path` fail with UV_ENAMETOOLONG, without making any system call,
+// when the path has overflowed.
+
 // stat
 struct Stat;
 using StatCallback = func<void(Error,Stat&&)>;
@@ -23,6 +28,10 @@ AsyncCanceler stat(const string& path, Async&, StatCallback&&);
 Error         stat(const string& path, Stat&); // sync
 AsyncCanceler lstat(const string& path, Async&, StatCallback&&);
 Error         lstat(const string& path, Stat&); // sync
+AsyncCanceler stat(const Path&, Async&, StatCallback&&);
+Error         stat(const Path&, Stat&); // sync
+AsyncCanceler lstat(const Path&, Async&, StatCallback&&);
+Error         lstat(const Path&, Stat&); // sync
   // Retrieve file status. `stat` automatically traverses symlinks while `lstat` doesn't.
 
 // readdir
@@ -30,12 +39,16 @@ struct DirEnts;
 using ReadDirCallback = func<void(Error,const DirEnts&)>;
 AsyncCanceler readdir(const string& path, Async&, ReadDirCallback&&);
 Error         readdir(const string& path, DirEnts&); // sync
+AsyncCanceler readdir(const Path&, Async&, ReadDirCallback&&);
+Error         readdir(const Path&, DirEnts&); // sync
   // Read list of directory contents.
 
 // scandir
 using ScanDirCB = func<void(Error)>;
 using ScanDirFunc = func<bool(const string& dirname, const string& filename, const fs::Stat&)>;
 AsyncCanceler scandir(const string& path, Async&, size_t depth, ScanDirFunc&&, ScanDirCB&&);
+AsyncCanceler scandir(const string& path, Async&, size_t depth, IgnoreRules&&, ScanDirFunc&&,
+                      ScanDirCB&&);
   // Perform a deep search for directory entries starting in directory at `path`, calling
   // ScanDirFunc for each file entry found.
   // `depth` limits subdirectory traversal. When depth=0 no subdirectories are traversed.
@@ -44,6 +57,13 @@ AsyncCanceler scandir(const string& path, Async&, size_t depth, ScanDirFunc&&, S
   // If ScanDirFunc returns false, digging stops immediately.
   // As usual with invoking cancelers, the callback will not be invoked so take care to clean up
   // any resources used during find (e.g. collections on the heap) when canceling.
+  // Entries matching `IgnoreRules` (paths relative to `path`) are skipped without being stat'ed,
+  // and ignored directories are never read.
+  // Symlinks are followed, but each physical file and directory is visited only once, which
+  // also guards against symlink cycles. When a file or directory is reachable through several
+  // names, the non-symlink name is preferred, followed by the lowest ordered name, regardless of
+  // the order in which I/O completes. Directories reached through symlinks are therefore read
+  // after all others.
 
 // readlink
 struct SymLink;
@@ -63,12 +83,92 @@ Error         readfile(const string& path, FileData&);
   // If `size` is zero, the size is calculated automatically at the expense of one stat call.
   // The forms w/o a `size` argument are simply convenience wrappers for `size=0`.
 
+// writefile
+enum class FSync;
+struct SyncBatch;
+using WriteFileCallback = func<void(Error)>;
+AsyncCanceler writefile(Async&, const string& path, string&& data, FSync, SyncBatch*,
+                        WriteFileCallback&&);
+AsyncCanceler writefile(Async&, const string& path, std::vector<iovec>&& bufs, FSync, SyncBatch*,
+                        WriteFileCallback&&);
+Error         writefile(const string& path, const char* p, size_t z, FSync, SyncBatch* =nullptr);
+Error         writefile(const string& path, const iovec*, int iovcnt, FSync, SyncBatch* =nullptr);
+  // Atomically replace the contents of the file at `path` by writing to a temporary file in the
+  // same directory and renaming it into place. Readers never observe a partially written file.
+  // Missing parent directories are created. The async forms perform all I/O on a pool thread;
+  // the memory referenced by `bufs` must stay valid until the callback has been invoked.
+
+// materialize
+enum class Materialize {
+  Copy, // Reflink if the file system supports it, otherwise copy
+  Link, // Reflink, else hardlink, else copy. Only for immutable (e.g. content-addressed) files.
+};
+using MaterializeCallback = func<void(Error)>;
+AsyncCanceler materialize(Async&, const string& src, const string& dst, Materialize,
+                          MaterializeCallback&&);
+Error         materialize(const string& src, const string& dst, Materialize=Materialize::Copy);
+  // Make the contents of file `src` appear at `dst` as cheaply as the file system allows. A
+  // reflink (copy-on-write clone) shares data blocks and is constant-time; a hardlink shares the
+  // inode itself, so writing to either name modifies both, which is why it's opt-in. The final
+  // fallback copies data in-kernel where possible. `dst` is replaced atomically either way.
+
+enum class FSync {
+  None,  // No fsync. Fastest, but a crash might leave a stale or empty file behind.
+  File,  // fsync the file before renaming it, and its directory after renaming it.
+  Batch, // Defer syncing to a SyncBatch, which is flushed once e.g. at the end of a build.
+};
+
+struct AtomicWriter {
+  // Incrementally writes a file which is atomically moved into place by `commit()`.
+  AtomicWriter(const string& path, FSync=FSync::None, SyncBatch* =nullptr);
+  ~AtomicWriter(); // Discards any uncommitted data
+  AtomicWriter(const AtomicWriter&) = delete;
+  AtomicWriter& operator=(const AtomicWriter&) = delete;
+
+  Error open();
+    // Create the temporary file. Must be called before writing.
+  Error write(const char* p, size_t z);
+  Error write(const iovec*, int iovcnt);
+    // Append data. The vectored form issues as few writev calls as possible.
+  Error commit();
+    // Sync according to the FSync policy and rename the temporary file to `path()`.
+  void discard();
+    // Close and remove the temporary file. Called automatically if commit() was never called.
+
+  const string& path() const { return _path; }
+  const string& tempPath() const { return _tmppath; }
+  int fd() const { return _fd; } // of the temporary file, or -1
+
+private:
+  string     _path;
+  string     _tmppath;
+  int        _fd = -1;
+  FSync      _sync;
+  SyncBatch* _batch;
+};
+
+struct SyncBatch {
+  // Collects files written with FSync::Batch. `flush` fsyncs each file and then each distinct
+  // directory exactly once, making all writes in the batch durable. Thread safe.
+  SyncBatch();
+  ~SyncBatch();
+  void  add(const string& filename);
+  Error flush(); // sync
+  AsyncCanceler flush(Async&, func<void(Error)>&&);
+private:
+  uv_mutex_t           _mu;
+  std::vector<string>  _files;
+};
+
 struct FileData {
   FileData() {}
   FileData(char* p, size_t z, int fd) : p{p}, z{z}, fd{fd} {}
   ~FileData();
   FileData(const FileData&) = delete;
-  FileData(FileData&&) = default;
+  FileData(FileData&& other) : p{other.p}, z{other.z}, fd{other.fd} {
+    other.p = nullptr;
+    other.fd = -1;
+  }
   FileData& operator=(const FileData&) = delete;
   FileData& operator=(FileData&&);
   size_t size() const { return z; }
@@ -80,6 +180,16 @@ struct FileData {
   int    fd = -1;
 };
 
+struct FileID {
+  // Identifies a physical file, no matter how many names (links) it's reachable through
+  uint64_t dev;
+  uint64_t ino;
+  bool operator==(const FileID& other) const { return ino == other.ino && dev == other.dev; }
+  struct Hash { size_t operator()(const FileID& v) const { return v.ino ^ (v.dev << 32); } };
+};
+
+using FileIDSet = std::unordered_set<FileID,FileID::Hash>;
+
 struct Stat {
   Stat() {};
   Stat(const uv_fs_t&);
@@ -87,6 +197,7 @@ struct Stat {
   bool isSymlink() const;
   bool isDir() const;
   bool isSocket() const;
+  FileID id() const { return {dev, ino}; }
 
   uint64_t dev;     // ID of device containing file
   uint64_t ino;     // inode number
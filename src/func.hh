@@ -1,6 +1,123 @@
 #pragma once
 namespace rx {
 
-template<class T> using func = std::function<T>;
+template <class T> struct func;
+
+template <class R, class... Args>
+struct func<R(Args...)> {
+  // Move-only function object. Callables up to `kInlineSize` bytes (e.g. a lambda capturing a
+  // few pointers and a string) are stored inline, and larger ones on the heap. Unlike
+  // std::function, copying is not supported, so captured state is never duplicated behind our
+  // back; move a func into a closure with an init-capture, e.g. `[cb = std::move(cb)]{ cb(); }`.
+  enum : size_t { kInlineSize = 56 }; // sizeof(func) is 64
+
+  func() noexcept : _ops{nullptr} {}
+  func(std::nullptr_t) noexcept : _ops{nullptr} {}
+  template <class F, class = typename std::enable_if<
+    !std::is_same<typename std::decay<F>::type, func>::value &&
+    !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value
+  >::type>
+  func(F&& f) : _ops{nullptr} { _init(std::forward<F>(f)); }
+  func(func&& other) noexcept;
+  func(const func&) = delete;
+  ~func() { _reset(); }
+
+  func& operator=(func&& other) noexcept;
+  func& operator=(std::nullptr_t) noexcept { _reset(); return *this; }
+  template <class F> func& operator=(F&& f) { return *this = func{std::forward<F>(f)}; }
+  func& operator=(const func&) = delete;
+
+  R operator()(Args... args) const {
+    assert(_ops != nullptr);
+    return _ops->call(const_cast<void*>((const void*)&_buf), std::forward<Args>(args)...);
+  }
+  explicit operator bool() const { return _ops != nullptr; }
+  bool operator==(std::nullptr_t) const { return _ops == nullptr; }
+  bool operator!=(std::nullptr_t) const { return _ops != nullptr; }
+
+// ------------------------------------------------------------------------------------------------
+private:
+  struct Ops {
+    R    (*call)(void*, Args&&...);
+    void (*move)(void* dst, void* src); // move-construct dst from src and destroy src
+    void (*destroy)(void*);
+  };
+
+  template <class F> struct Inline {
+    static R call(void* p, Args&&... args) { return (*(F*)p)(std::forward<Args>(args)...); }
+    static void move(void* dst, void* src) { new (dst) F{std::move(*(F*)src)}; ((F*)src)->~F(); }
+    static void destroy(void* p) { ((F*)p)->~F(); }
+    static constexpr Ops ops{&call, &move, &destroy};
+  };
+
+  template <class F> struct Boxed {
+    static R call(void* p, Args&&... args) { return (**(F**)p)(std::forward<Args>(args)...); }
+    static void move(void* dst, void* src) { *(F**)dst = *(F**)src; }
+    static void destroy(void* p) { delete *(F**)p; }
+    static constexpr Ops ops{&call, &move, &destroy};
+  };
+
+  template <class T> using FitsInline = std::integral_constant<bool,
+    sizeof(T) <= kInlineSize &&
+    alignof(T) <= alignof(void*) &&
+    std::is_nothrow_move_constructible<T>::value
+  >;
+
+  template <class F> void _init(F&& f) {
+    using T = typename std::decay<F>::type;
+    _init<T>(std::forward<F>(f), FitsInline<T>{});
+  }
+  template <class T, class F> void _init(F&& f, std::true_type) {
+    new (&_buf) T(std::forward<F>(f));
+    _ops = &Inline<T>::ops;
+  }
+  template <class T, class F> void _init(F&& f, std::false_type) {
+    *(T**)&_buf = new T(std::forward<F>(f));
+    _ops = &Boxed<T>::ops;
+  }
+
+  void _reset() {
+    if (_ops) {
+      _ops->destroy(&_buf);
+      _ops = nullptr;
+    }
+  }
+
+  typename std::aligned_storage<kInlineSize, alignof(void*)>::type _buf;
+  const Ops* _ops;
+};
+
+template <class R, class... Args>
+template <class F>
+constexpr typename func<R(Args...)>::Ops func<R(Args...)>::Inline<F>::ops;
+
+template <class R, class... Args>
+template <class F>
+constexpr typename func<R(Args...)>::Ops func<R(Args...)>::Boxed<F>::ops;
+
+template <class R, class... Args>
+inline func<R(Args...)>::func(func&& other) noexcept : _ops{other._ops} {
+  if (_ops) {
+    _ops->move(&_buf, &other._buf);
+    other._ops = nullptr;
+  }
+}
+
+template <class R, class... Args>
+inline func<R(Args...)>& func<R(Args...)>::operator=(func&& other) noexcept {
+  if (this != &other) {
+    _reset();
+    if ((_ops = other._ops)) {
+      _ops->move(&_buf, &other._buf);
+      other._ops = nullptr;
+    }
+  }
+  return *this;
+}
+
+template <class R, class... Args>
+inline bool operator==(std::nullptr_t, const func<R(Args...)>& f) { return f == nullptr; }
+template <class R, class... Args>
+inline bool operator!=(std::nullptr_t, const func<R(Args...)>& f) { return f != nullptr; }
 
 } // namespace
@@ -94,6 +94,10 @@ void murmur3_128(const std::string& ins, B16& result, uint32_t seed) {
   MurmurHash3_x64_128((const void*)ins.data(), (int)ins.size(), seed, (void*)&result);
 }
 
+void murmur3_128(const void* p, size_t size, B16& result, uint32_t seed) {
+  MurmurHash3_x64_128(p, (int)size, seed, (void*)&result);
+}
+
 
 void encode_128(const B16& r, char buf[22]) {
   base64_encode_B16(r, buf);
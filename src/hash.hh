@@ -8,6 +8,7 @@ namespace hash {
 struct B16 { unsigned char bytes[16]; };
 
 void murmur3_128(const std::string& s, B16& result, uint32_t seed=0);
+void murmur3_128(const void* p, size_t size, B16& result, uint32_t seed=0);
 void encode_128(const B16&, char buf[22]);
 std::string encode_128(const B16&);
 
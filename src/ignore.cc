@@ -0,0 +1,216 @@
+#include "ignore.hh"
+#include "fs.hh"
+namespace rx {
+namespace fs {
+
+
+static bool isGlobChar(char c) {
+  return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+
+static bool hasGlobChars(const char* p, const char* e) {
+  for (; p != e; ++p) if (isGlobChar(*p)) return true;
+  return false;
+}
+
+
+static bool classMatch(const char*& p, const char* pe, char c) {
+  // Enter with `p` just past '['. On return `p` is just past the closing ']'.
+  bool negate = (p != pe && (*p == '!' || *p == '^'));
+  if (negate) ++p;
+  bool matched = false;
+  bool first = true;
+  while (p != pe && (*p != ']' || first)) {
+    first = false;
+    char lo = *p++;
+    if (lo == '\\' && p != pe) lo = *p++;
+    char hi = lo;
+    if (p + 1 < pe && *p == '-' && p[1] != ']') {
+      hi = p[1];
+      p += 2;
+    }
+    if (c >= lo && c <= hi) matched = true;
+  }
+  if (p != pe) ++p; // ']'
+  return matched != negate;
+}
+
+
+static bool globMatch(const char* p, const char* pe, const char* s, const char* se) {
+  // "*" matches any run of characters except "/", "**" any run including "/" and "?" any single
+  // character except "/".
+  while (p != pe) {
+    char c = *p;
+    if (c == '*') {
+      if (p + 1 != pe && p[1] == '*') {
+        p += 2;
+        bool segments = (p != pe && *p == '/');
+        if (segments) ++p;
+        if (p == pe) return true;
+        for (const char* t = s; ; ++t) {
+          // "**/" matches zero or more whole directories, so only try at segment starts
+          if ((!segments || t == s || t[-1] == '/') && globMatch(p, pe, t, se)) return true;
+          if (t == se) return false;
+        }
+      }
+      ++p;
+      for (const char* t = s; ; ++t) {
+        if (globMatch(p, pe, t, se)) return true;
+        if (t == se || *t == '/') return false;
+      }
+    }
+    if (s == se) return false;
+    switch (c) {
+      case '?': {
+        if (*s == '/') return false;
+        ++p;
+        break;
+      }
+      case '[': {
+        const char* cp = p + 1;
+        if (!classMatch(cp, pe, *s)) return false;
+        p = cp;
+        break;
+      }
+      case '\\': {
+        if (p + 1 != pe) c = *++p;
+        // fallthrough
+      }
+      default: {
+        if (c != *s) return false;
+        ++p;
+        break;
+      }
+    }
+    ++s;
+  }
+  return s == se;
+}
+
+
+void IgnoreRules::add(const string& pattern) {
+  const char* p = pattern.data();
+  const char* e = p + pattern.size();
+
+  // Trailing unescaped whitespace is ignored
+  while (e != p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r') &&
+         !(e - 1 != p && e[-2] == '\\')) {
+    --e;
+  }
+  if (p == e || *p == '#') return;
+
+  Rule r;
+  r.negate = (*p == '!');
+  if (r.negate) ++p;
+  else if (*p == '\\' && p + 1 != e && (p[1] == '#' || p[1] == '!')) ++p;
+
+  r.dirOnly = (e != p && e[-1] == '/');
+  if (r.dirOnly) --e;
+
+  r.anchored = false;
+  if (p != e && *p == '/') {
+    r.anchored = true;
+    ++p;
+  }
+  if (p == e) return;
+  if (!r.anchored) r.anchored = (std::find(p, e, '/') != e);
+
+  if (!hasGlobChars(p, e)) {
+    r.type = Type::Literal;
+    r.text.assign(p, e);
+  } else if (!r.anchored && *p == '*' && e - p > 1 && !hasGlobChars(p + 1, e)) {
+    r.type = Type::Suffix;
+    r.text.assign(p + 1, e);
+  } else if (!r.anchored && e[-1] == '*' && e - p > 1 && !hasGlobChars(p, e - 1)) {
+    r.type = Type::Prefix;
+    r.text.assign(p, e - 1);
+  } else {
+    r.type = Type::Glob;
+    r.text.assign(p, e);
+  }
+
+  r.indexed = (r.type == Type::Literal && !r.anchored && !r.negate && !r.dirOnly);
+  if (r.indexed) _literals.emplace(r.text);
+  if (r.negate) _hasNegations = true;
+  _rules.emplace_back(std::move(r));
+}
+
+
+void IgnoreRules::parse(const char* p, size_t z) {
+  const char* e = p + z;
+  while (p != e) {
+    auto* nl = (const char*)memchr(p, '\n', e - p);
+    if (nl == nullptr) nl = e;
+    add(string{p, nl});
+    p = (nl == e) ? e : nl + 1;
+  }
+}
+
+
+Error IgnoreRules::load(const string& filename) {
+  Stat st;
+  auto err = stat(filename, st);
+  if (err) return (err.code() == (Error::Code)UV_ENOENT) ? Error{} : err;
+  if (st.size == 0) return nullptr; // can't mmap an empty file
+  FileData d;
+  err = readfile(filename, st.size, d);
+  if (!err) parse(d.data(), d.size());
+  return err;
+}
+
+
+bool IgnoreRules::ruleMatches(
+    const Rule& r, const char* path, const char* pathEnd, const char* base) const
+{
+  const char* s = r.anchored ? path : base;
+  size_t z = pathEnd - s;
+  auto& t = r.text;
+  switch (r.type) {
+    case Type::Literal: return z == t.size() && memcmp(s, t.data(), z) == 0;
+    case Type::Suffix:  return z >= t.size() && memcmp(pathEnd-t.size(), t.data(), t.size()) == 0;
+    case Type::Prefix:  return z >= t.size() && memcmp(s, t.data(), t.size()) == 0;
+    case Type::Glob:    return globMatch(t.data(), t.data() + t.size(), s, pathEnd);
+  }
+  return false;
+}
+
+
+IgnoreRules::Match IgnoreRules::match(const char* path, size_t z, Kind kind) const {
+  if (_rules.empty()) return Match::Keep;
+  const char* pathEnd = path + z;
+  const char* base = pathEnd;
+  while (base != path && base[-1] != '/') --base;
+
+  if (!_hasNegations) {
+    // Without negations the order of rules doesn't matter: any match ignores the path
+    if (!_literals.empty() && _literals.find(string{base, pathEnd}) != _literals.end()) {
+      return Match::Ignore;
+    }
+    auto m = Match::Keep;
+    for (auto& r : _rules) {
+      if (r.indexed || !ruleMatches(r, path, pathEnd, base)) continue;
+      if (r.dirOnly && kind != Kind::Dir) {
+        if (kind == Kind::Unknown) m = Match::Unknown;
+        continue;
+      }
+      return Match::Ignore;
+    }
+    return m;
+  }
+
+  // The last matching rule wins
+  for (auto I = _rules.rbegin(), E = _rules.rend(); I != E; ++I) {
+    auto& r = *I;
+    if (!ruleMatches(r, path, pathEnd, base)) continue;
+    if (r.dirOnly && kind != Kind::Dir) {
+      if (kind == Kind::Unknown) return Match::Unknown;
+      continue;
+    }
+    return r.negate ? Match::Keep : Match::Ignore;
+  }
+  return Match::Keep;
+}
+
+
+}} // namespace
@@ -0,0 +1,63 @@
+#pragma once
+#include "error.hh"
+namespace rx {
+namespace fs {
+using std::string;
+
+// Gitignore-style path patterns, as read from .rxignore files. Used by `scandir` to prune
+// directory entries before they are stat'ed, and whole subtrees before they are read.
+//
+// Syntax, one pattern per line:
+//   # comment        Lines starting with "#" are ignored, as are blank lines
+//   name             Matches a file or directory called "name" at any depth
+//   *.o              "*" matches anything except "/", "?" any single character except "/"
+//   [a-z]*.tmp       Character classes, negated with "[!...]" or "[^...]"
+//   gen/             A trailing "/" only matches directories
+//   /build           A leading or inner "/" anchors the pattern to the base directory
+//   docs/**/*.png    "**" matches any number of directories
+//   !keep.o          "!" re-includes something excluded by an earlier pattern
+//
+// The last matching pattern decides, just like with git.
+//
+struct IgnoreRules {
+  enum class Kind { File, Dir, Unknown };
+  enum class Match { Keep, Ignore, Unknown };
+
+  void parse(const char* p, size_t z);
+    // Add patterns from text in .rxignore format
+  void add(const string& pattern);
+    // Add a single pattern
+  Error load(const string& filename);
+    // Read and parse a file. A missing file is not an error.
+
+  bool empty() const { return _rules.empty(); }
+
+  Match match(const char* relpath, size_t z, Kind) const;
+  Match match(const string& relpath, Kind k) const { return match(relpath.data(), relpath.size(), k); }
+    // Match a path relative to the directory the rules apply to. When `Kind::Unknown` is passed,
+    // `Match::Unknown` is returned if the outcome depends on whether the path is a directory.
+
+private:
+  enum class Type : uint8_t {
+    Literal, // "name"  -- compared to the basename
+    Suffix,  // "*.ext" -- basename ends with `text`
+    Prefix,  // "name*" -- basename starts with `text`
+    Glob,    // anything else
+  };
+  struct Rule {
+    string text;
+    Type   type;
+    bool   negate;   // "!pattern"
+    bool   dirOnly;  // "pattern/"
+    bool   anchored; // matched against the full relative path rather than the basename
+    bool   indexed;  // also in _literals
+  };
+  bool ruleMatches(const Rule&, const char* path, const char* pathEnd, const char* base) const;
+
+  std::vector<Rule>          _rules;
+  std::unordered_set<string> _literals; // Unanchored literal rules, used when there are no negations
+  bool                       _hasNegations = false;
+};
+
+
+}} // namespace
@@ -0,0 +1,162 @@
+#include "importscan.hh"
+namespace rx {
+namespace importscan {
+
+// The scanner looks at 16 bytes at a time with SSE2 where available: to skip whitespace, to find
+// the end of comments and quoted paths, and to match keywords with a single compare.
+
+static inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+
+static const char* SkipSpace(const char* p, const char* end) {
+  #if defined(__SSE2__)
+  const __m128i sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+    unsigned other = ~(unsigned)_mm_movemask_epi8(m) & 0xFFFF;
+    if (other != 0) {
+      p += __builtin_ctz(other);
+      break; // might still be \f or \v, which the loop below takes care of
+    }
+    p += 16;
+  }
+  #endif
+  while (p != end && IsSpace(*p)) ++p;
+  return p;
+}
+
+
+static const char* Find(const char* p, const char* end, char c) {
+  // Returns `end` if `c` isn't found
+  #if defined(__SSE2__)
+  const __m128i cv = _mm_set1_epi8(c);
+  while (end - p >= 16) {
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), cv));
+    if (m != 0) return p + __builtin_ctz(m);
+    p += 16;
+  }
+  #endif
+  while (p != end && *p != c) ++p;
+  return p;
+}
+
+
+struct Keyword {
+  alignas(16) char s[16]; // NUL padded
+  size_t           z;
+};
+
+static const Keyword kPackage{"package", 7};
+static const Keyword kImport{"import", 6};
+
+
+static bool Match(const char* p, const char* end, const Keyword& kw) {
+  // True if `p` starts with the keyword followed by whitespace
+  if ((size_t)(end - p) <= kw.z) return false;
+  #if defined(__SSE2__)
+  if (end - p >= 16) {
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p),
+                                                  _mm_load_si128((const __m128i*)kw.s)));
+    unsigned want = (1u << kw.z) - 1;
+    if ((m & want) != want) return false;
+  } else
+  #endif
+  if (memcmp(p, kw.s, kw.z) != 0) {
+    return false;
+  }
+  return p[kw.z] == ' ' || p[kw.z] == '\t';
+}
+
+
+static Error ErrorAt(const char* begin, const char* p, const string& msg) {
+  size_t line = 1;
+  const char* lineBegin = begin;
+  for (const char* q = begin; q != p; ++q) {
+    if (*q == '\n') { ++line; lineBegin = q + 1; }
+  }
+  return Error{std::to_string(line) + ":" + std::to_string(p - lineBegin + 1) + ": " + msg};
+}
+
+
+static const char* ReadName(const char* p, const char* end, string& name) {
+  // Reads a name that's either quoted or runs to the next whitespace or ";". Returns nullptr if
+  // the quote isn't closed on the same line.
+  while (p != end && (*p == ' ' || *p == '\t')) ++p;
+  if (p != end && *p == '"') {
+    auto q = Find(p + 1, end, '"');
+    auto lf = Find(p + 1, q, '\n');
+    if (q == end || lf != q) return nullptr;
+    name.assign(p + 1, q);
+    return q + 1;
+  }
+  auto q = p;
+  while (q != end && !IsSpace(*q) && *q != ';') ++q;
+  name.assign(p, q);
+  return q;
+}
+
+
+static bool IsValidPkgName(const string& name) {
+  return !name.empty() && name.front() != '/' && name.back() != '/';
+}
+
+
+Error scan(const char* begin, size_t z, Result& r) {
+  const char* p = begin;
+  const char* end = begin + z;
+  while (true) {
+    p = SkipSpace(p, end);
+    if (p == end) break;
+
+    if (*p == ';') {
+      ++p;
+      continue;
+    }
+
+    if (*p == '/' && end - p > 1 && (p[1] == '/' || p[1] == '*')) {
+      if (p[1] == '/') {
+        p = Find(p + 2, end, '\n');
+      } else {
+        auto q = p + 2;
+        while ((q = Find(q, end, '*')) != end && (end - q < 2 || q[1] != '/')) ++q;
+        if (q == end) return ErrorAt(begin, p, "unterminated comment");
+        p = q + 2;
+      }
+      continue;
+    }
+
+    const char* kw = (*p == '#') ? p + 1 : p;
+    string name;
+    if (Match(kw, end, kPackage)) {
+      auto q = ReadName(kw + kPackage.z, end, name);
+      if (!q || !IsValidPkgName(name)) return ErrorAt(begin, p, "expected package name");
+      if (!r.package.empty() && r.package != name) {
+        return ErrorAt(begin, p, "package " + name + " declared in package " + r.package);
+      }
+      r.package = std::move(name);
+      r.directives = r.directives || (kw != p);
+      p = q;
+    } else if (Match(kw, end, kImport)) {
+      auto q = ReadName(kw + kImport.z, end, name);
+      if (!q || !IsValidPkgName(name)) return ErrorAt(begin, p, "expected import path");
+      r.imports.emplace_back(std::move(name));
+      r.directives = r.directives || (kw != p);
+      p = q;
+    } else {
+      break; // first thing that's not a declaration
+    }
+  }
+  r.end = p - begin;
+  return nullptr;
+}
+
+
+} // namespace
+} // namespace
@@ -0,0 +1,30 @@
+#pragma once
+#include "error.hh"
+namespace rx {
+namespace importscan {
+using std::string;
+
+// Reads the declarations at the top of a source file -- the package it belongs to and the
+// packages it imports -- without lexing the rest of the file, which is all that's needed to
+// discover the dependency graph. Both .rx declarations and the directives of C++ sources are
+// understood:
+//
+//   package bar           #package bar
+//   import "foo/util"     #import foo/util
+//
+// Declarations may be separated by whitespace, ";", line comments and block comments. Scanning
+// stops at the first thing that's none of these, so only the head of a file is read; for a
+// mapped file that's usually a single page.
+
+struct Result {
+  string              package; // empty if the file doesn't declare one
+  std::vector<string> imports; // in the order they are declared
+  size_t              end = 0; // offset at which scanning stopped
+  bool                directives = false; // some declaration was a directive, e.g. "#package"
+};
+
+Error scan(const char* p, size_t z, Result&);
+  // The message of an error for a malformed declaration starts with its one-based "line:column:"
+
+} // namespace
+} // namespace
@@ -54,7 +54,7 @@ struct Lex::Imp {
   SrcLocation _srcLoc;
   rx::Error   _err;
 
-  Imp(const char* p, size_t z) : _begin{p}, _end{p+z}, _p{p}, _tok{Tokens::End} {}
+  Imp(const char* p, size_t z) : _begin{p}, _end{p+z}, _p{p}, _tok{Tokens::End}, _lineBegin{p} {}
 
 
   void undoChar() {
@@ -103,7 +103,12 @@ struct Lex::Imp {
     #define ENDSYM_OR if (isReadingSym) { undoChar(); return setTok(Symbol); } else
 
     FOREACH_CHAR {
-      CTRL_CASES  WHITESPACE_CASES  ENDSYM_OR break; // ignore
+      CTRL_CASES  WHITESPACE_CASES  ENDSYM_OR {
+        // Ignored, so the token starts after it
+        _srcLoc.offset = _p - _begin;
+        _srcLoc.column = _p - _lineBegin;
+        break;
+      }
 
       case '\n':
         ENDSYM_OR {
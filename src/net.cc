@@ -26,7 +26,7 @@ void getAddrInfo(
     AddrInfoCallback cb)
 {
   auto* req = (uv_getaddrinfo_t*)malloc(sizeof(uv_getaddrinfo_t));
-  req->data = (void*)new AddrInfoCallback{cb};
+  req->data = (void*)new AddrInfoCallback{std::move(cb)};
 
   addrinfo hints;
   memset((void*)&hints, 0, sizeof(addrinfo));
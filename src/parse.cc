@@ -0,0 +1,359 @@
+#include "ast.hh"
+#include "lex.hh"
+#include "utf8/unchecked.h"
+namespace rx {
+
+// Recursive descent parser for declarations and statements, with operator precedence parsing of
+// expressions. Nodes are appended to the tree straight from the token stream; the items of a list
+// are collected on a scratch stack while the list is parsed, and copied to the tree's list table
+// in one go when it's done, so lists of nested nodes don't interleave.
+//
+//   File      = { ( Package | Import | Func | Stmt ) ";" }
+//   Package   = "package" Symbol
+//   Import    = "import" TextLit
+//   Func      = "func" Symbol "(" [ Symbol { "," Symbol } ] ")" Block
+//   Block     = "{" { Stmt ";" } "}"
+//   Stmt      = "return" [ Expr ] | Symbol ":" Expr | Expr
+//   Expr      = Operand { Call | "." Symbol | "[" Expr "]" | BinaryOp Expr }
+//   Call      = "(" [ Expr { "," Expr } ] ")"
+//   Operand   = Symbol | Literal | "(" Expr ")" | ( "-" | "+" ) Expr
+//   BinaryOp  = "=" | "==" | "<" | ">" | "+" | "-" | "*" | "/"
+//
+// The lexer inserts ";" at the end of lines, and a ";" may be left out before "}".
+//
+struct Parser {
+  using NodeID = Ast::NodeID;
+  using Node = Ast::Node;
+
+  enum : int { kUnaryPrec = 5 };
+  enum : uint32_t { kMaxExprDepth = 500 }; // see parseExpr
+
+  Parser(Ast& ast, const char* p, size_t z) : _ast(ast), _lex{p, z} {}
+
+  Error parseFile() {
+    add(Ast::File, 0, 0); // the root is always node 0
+    size_t mark = _scratch.size();
+    next();
+    while (_tok != Lex::End && _tok != Lex::Error) {
+      if (_tok == ';') { next(); continue; }
+      NodeID n;
+      if (isKeyword(U"package")) {
+        n = parsePackage();
+      } else if (isKeyword(U"import")) {
+        n = parseImport();
+      } else if (isKeyword(U"func")) {
+        n = parseFunc();
+      } else {
+        n = parseStmt();
+      }
+      if (!n || !endStmt()) break;
+      _scratch.push_back(n);
+    }
+    if (_err) {
+      return _err;
+    }
+    setList(0, mark);
+    return nullptr;
+  }
+
+private:
+  // --- tokens ---
+
+  void next() {
+    do {
+      _tok = _lex.next(_value);
+    } while (_tok == '\n' || _tok == Lex::LineComment);
+    _pos = (uint32_t)_lex.srcLocation().offset;
+    if (_tok == Lex::Error && !_err) {
+      _err = Error{location() + _lex.lastError().message()};
+    }
+  }
+
+  bool isKeyword(const char32_t* kw) const {
+    return _tok == Lex::Symbol && _value == kw;
+  }
+
+  bool expect(Lex::Token t, const char* what) {
+    if (_tok != t) {
+      error(string{"expected "} + what);
+      return false;
+    }
+    next();
+    return true;
+  }
+
+  bool endStmt() {
+    // Statements end with ";" (usually inserted by the lexer at the end of a line) or "}"
+    if (_tok == ';') { next(); return true; }
+    if (_tok == '}' || _tok == Lex::End) return true;
+    error("expected end of line or ';'");
+    return false;
+  }
+
+  string location() const {
+    auto& loc = _lex.srcLocation();
+    return std::to_string(loc.line + 1) + ":" + std::to_string(loc.column + 1) + ": ";
+  }
+
+  NodeID error(const string& msg) {
+    if (!_err) {
+      _err = Error{location() + msg + ", got " +
+                   (_tok == Lex::End ? string{"end of input"} : Lex::repr(_tok, _value))};
+    }
+    _tok = Lex::Error; // stops all loops
+    return 0;
+  }
+
+  // --- nodes ---
+
+  NodeID add(Ast::Kind kind, uint32_t pos, uint32_t a, uint32_t b=0, uint8_t op=0) {
+    NodeID id = (NodeID)_ast._nodes.size();
+    _ast._nodes.push_back(Node{kind, op, 0, pos, a, b});
+    return id;
+  }
+
+  NodeID addStr(Ast::Kind kind, uint8_t op=0) {
+    // Node with the current token's value as its string
+    auto& s = _ast._strings;
+    auto offs = (uint32_t)s.size();
+    for (auto c : _value) {
+      utf8::unchecked::append(c, std::back_inserter(s));
+    }
+    return add(kind, _pos, offs, (uint32_t)s.size() - offs, op);
+  }
+
+  void setList(NodeID id, size_t mark) {
+    // Move the items on the scratch stack from `mark` up into the list table
+    auto& lists = _ast._lists;
+    auto& n = _ast._nodes[id];
+    n.a = (uint32_t)lists.size();
+    n.b = (uint32_t)(_scratch.size() - mark);
+    lists.insert(lists.end(), _scratch.begin() + mark, _scratch.end());
+    _scratch.resize(mark);
+  }
+
+  NodeID addList(Ast::Kind kind, uint32_t pos, size_t mark) {
+    auto id = add(kind, pos, 0);
+    setList(id, mark);
+    return id;
+  }
+
+  // --- declarations and statements ---
+
+  NodeID parsePackage() {
+    auto pos = _pos;
+    next();
+    if (_tok != Lex::Symbol) return error("expected package name");
+    auto n = addStr(Ast::Package);
+    _ast._nodes[n].pos = pos;
+    next();
+    return n;
+  }
+
+  NodeID parseImport() {
+    auto pos = _pos;
+    next();
+    if (_tok != Lex::TextLit) return error("expected import path");
+    auto n = addStr(Ast::Import);
+    _ast._nodes[n].pos = pos;
+    next();
+    return n;
+  }
+
+  NodeID parseFunc() {
+    auto pos = _pos;
+    next();
+    if (_tok != Lex::Symbol) return error("expected function name");
+    size_t mark = _scratch.size();
+    _scratch.push_back(addStr(Ast::Ident));
+    _scratch.push_back(0); // body, once parsed
+    next();
+    if (!expect('(', "'('")) return 0;
+    if (_tok != ')') {
+      while (true) {
+        if (_tok != Lex::Symbol) return error("expected parameter name");
+        _scratch.push_back(addStr(Ast::Ident));
+        next();
+        if (_tok != ',') break;
+        next();
+      }
+    }
+    if (!expect(')', "')'")) return 0;
+    auto body = parseBlock();
+    if (!body) return 0;
+    _scratch[mark + 1] = body;
+    return addList(Ast::Func, pos, mark);
+  }
+
+  NodeID parseBlock() {
+    auto pos = _pos;
+    if (!expect('{', "'{'")) return 0;
+    size_t mark = _scratch.size();
+    while (_tok != '}') {
+      if (_tok == ';') { next(); continue; }
+      if (_tok == Lex::End) return error("expected '}'");
+      auto n = parseStmt();
+      if (!n || !endStmt()) return 0;
+      _scratch.push_back(n);
+    }
+    next();
+    return addList(Ast::Block, pos, mark);
+  }
+
+  NodeID parseStmt() {
+    if (isKeyword(U"return")) {
+      auto pos = _pos;
+      next();
+      NodeID value = 0;
+      if (_tok != ';' && _tok != '}' && _tok != Lex::End) {
+        if (!(value = parseExpr(0))) return 0;
+      }
+      return add(Ast::Return, pos, value);
+    }
+    auto n = parseExpr(0);
+    if (n && _tok == ':' && _ast._nodes[n].kind == Ast::Ident) {
+      next();
+      auto value = parseExpr(0);
+      if (!value) return 0;
+      return add(Ast::Label, _ast._nodes[n].pos, n, value);
+    }
+    return n;
+  }
+
+  // --- expressions ---
+
+  static Ast::Op binaryOp(Lex::Token t, int& prec) {
+    switch (t) {
+      case '=':       prec = 1; return Ast::Assign;
+      case Lex::EqEq: prec = 2; return Ast::Eq;
+      case '<':       prec = 2; return Ast::Lt;
+      case '>':       prec = 2; return Ast::Gt;
+      case '+':       prec = 3; return Ast::Add;
+      case '-':       prec = 3; return Ast::Sub;
+      case '*':       prec = 4; return Ast::Mul;
+      case '/':       prec = 4; return Ast::Div;
+      default:        return Ast::NoOp;
+    }
+  }
+
+  NodeID parseExpr(int minPrec) {
+    // Every nested expression (parenthesized, unary operand, call argument, index or right hand
+    // side) passes through here. Limiting their depth bounds the parser's recursion, as files are
+    // parsed on executor threads with limited stacks.
+    if (_exprDepth == kMaxExprDepth) return error("expression nested too deeply");
+    ++_exprDepth;
+    auto n = parseExprOps(minPrec);
+    --_exprDepth;
+    return n;
+  }
+
+  NodeID parseExprOps(int minPrec) {
+    NodeID lhs = parseOperand();
+    while (lhs) {
+      auto pos = _ast._nodes[lhs].pos;
+      switch (_tok) {
+        case '(': {
+          size_t mark = _scratch.size();
+          _scratch.push_back(lhs);
+          next();
+          if (_tok != ')') {
+            while (true) {
+              auto arg = parseExpr(0);
+              if (!arg) return 0;
+              _scratch.push_back(arg);
+              if (_tok != ',') break;
+              next();
+            }
+          }
+          if (!expect(')', "')'")) return 0;
+          lhs = addList(Ast::Call, pos, mark);
+          break;
+        }
+        case '.': {
+          next();
+          if (_tok != Lex::Symbol) return error("expected member name");
+          auto name = addStr(Ast::Ident);
+          next();
+          lhs = add(Ast::Member, pos, lhs, name);
+          break;
+        }
+        case '[': {
+          next();
+          auto index = parseExpr(0);
+          if (!index || !expect(']', "']'")) return 0;
+          lhs = add(Ast::Index, pos, lhs, index);
+          break;
+        }
+        default: {
+          int prec = 0;
+          auto op = binaryOp(_tok, prec);
+          if (op == Ast::NoOp || prec < minPrec) {
+            return lhs;
+          }
+          next();
+          auto rhs = parseExpr(op == Ast::Assign ? prec : prec + 1); // "=" is right associative
+          if (!rhs) return 0;
+          lhs = add(Ast::Binary, pos, lhs, rhs, op);
+          break;
+        }
+      }
+    }
+    return 0;
+  }
+
+  NodeID parseOperand() {
+    NodeID n;
+    switch (_tok) {
+      case Lex::Symbol:    n = addStr(Ast::Ident); break;
+      case Lex::DecIntLit: n = addStr(Ast::IntLit, 10); break;
+      case Lex::OctIntLit: n = addStr(Ast::IntLit, 8); break;
+      case Lex::HexIntLit: n = addStr(Ast::IntLit, 16); break;
+      case Lex::FloatLit:  n = addStr(Ast::FloatLit); break;
+      case Lex::CharLit:   n = addStr(Ast::CharLit); break;
+      case Lex::TextLit:   n = addStr(Ast::TextLit); break;
+      case '(': {
+        next();
+        n = parseExpr(0);
+        return (n && expect(')', "')'")) ? n : 0;
+      }
+      case '-': case '+': {
+        auto pos = _pos;
+        auto op = (_tok == '-') ? Ast::Sub : Ast::Add;
+        next();
+        auto operand = parseExpr(kUnaryPrec);
+        return operand ? add(Ast::Unary, pos, operand, 0, op) : 0;
+      }
+      case Lex::Error: return 0;
+      default:         return error("expected expression");
+    }
+    next();
+    return n;
+  }
+
+  Ast&                _ast;
+  Lex                 _lex;
+  Lex::Token          _tok = Lex::End;
+  Text                _value;
+  uint32_t            _pos = 0; // source offset of the current token
+  uint32_t            _exprDepth = 0; // of parseExpr calls
+  std::vector<NodeID> _scratch;
+  Error               _err;
+};
+
+
+Error Ast::parse(const char* p, size_t z) {
+  // Drop the old tree and size the new one for typical source. Most nodes take at least a few
+  // bytes of source, so this is rarely exceeded.
+  decltype(_nodes){&_arena}.swap(_nodes);
+  decltype(_lists){&_arena}.swap(_lists);
+  ArenaString{&_arena}.swap(_strings); // assigning might keep the old buffer
+  _arena.reset();
+  _nodes.reserve(z / 8 + 16);
+  _lists.reserve(z / 32 + 16);
+  _strings.reserve(z / 8 + 16);
+  Parser parser{*this, p, z};
+  return parser.parseFile();
+}
+
+
+} // namespace
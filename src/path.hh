@@ -0,0 +1,127 @@
+#pragma once
+#include "error.hh"
+#include "async.hh"
+namespace rx {
+namespace fs {
+using std::string;
+
+// File system path with inline storage. Building a path, or deriving one path from another, never
+// allocates memory. Appending past PATH_MAX sets `overflow()` instead of truncating silently, and
+// fs functions that take a Path fail with UV_ENAMETOOLONG for such a path.
+//
+// Example:
+//   Path p{rxDir};
+//   p.append("src").append(pkg.name());  // "rxdir/src/foo/bar"
+//   auto z = p.size();
+//   for (auto& fn : filenames) {
+//     p.append(fn);                      // "rxdir/src/foo/bar/fn"
+//     ...
+//     p.truncate(z);                     // back to "rxdir/src/foo/bar"
+//   }
+//
+struct Path {
+  Path() { _buf[0] = 0; }
+  explicit Path(const char* p, size_t z) { _buf[0] = 0; concat(p, z); }
+  explicit Path(const char* s) : Path{s, strlen(s)} {}
+  explicit Path(const string& s) : Path{s.data(), s.size()} {}
+  Path(const Path&);
+  Path& operator=(const Path&);
+
+  Path& append(const char* p, size_t z);
+  Path& append(const char* s) { return append(s, strlen(s)); }
+  Path& append(const string& s) { return append(s.data(), s.size()); }
+  Path& append(const Path& p) { return append(p.c_str(), p.size()); }
+    // Add a path component, inserting a "/" separator when needed. Like with pathJoin, empty
+    // components are ignored, e.g. Path{"a"}.append("").append("b") -> "a/b"
+
+  Path& concat(const char* p, size_t z);
+  Path& concat(const char* s) { return concat(s, strlen(s)); }
+  Path& concat(const string& s) { return concat(s.data(), s.size()); }
+    // Add characters verbatim, e.g. Path{"foo"}.concat(".pch") -> "foo.pch"
+
+  Path& parent();
+    // Remove the last component, e.g. "a/b/c" -> "a/b", "/a" -> "/", "a" -> ""
+  void truncate(size_t z);
+    // Shorten the path to `z` bytes, which must be <= size(). Clears `overflow()`.
+
+  const char* basename() const;  // e.g. "a/b.c" -> "b.c", "a" -> "a"
+  const char* extension() const; // e.g. "a/b.c" -> "c", "a.b/c" -> "", ".profile" -> ""
+    // Both return a pointer into the path's storage, valid until the path is modified.
+
+  const char* c_str() const { return _buf; }
+  size_t size() const { return _z; }
+  bool empty() const { return _z == 0; }
+  string str() const { return {_buf, _z}; }
+  bool overflow() const { return _overflow; }
+  Error error() const { return _overflow ? UVError(UV_ENAMETOOLONG) : Error{}; }
+
+private:
+  uint32_t _z = 0;
+  bool     _overflow = false;
+  char     _buf[PATH_MAX]; // NUL terminated
+};
+
+// ================================================================================================
+
+inline Path::Path(const Path& other) : _z{other._z}, _overflow{other._overflow} {
+  memcpy(_buf, other._buf, _z + 1);
+}
+
+inline Path& Path::operator=(const Path& other) {
+  _z = other._z;
+  _overflow = other._overflow;
+  memmove(_buf, other._buf, _z + 1);
+  return *this;
+}
+
+inline Path& Path::concat(const char* p, size_t z) {
+  if (_z + z >= PATH_MAX) {
+    _overflow = true;
+    z = PATH_MAX - 1 - _z;
+  }
+  memcpy(&_buf[_z], p, z);
+  _z += z;
+  _buf[_z] = 0;
+  return *this;
+}
+
+inline Path& Path::append(const char* p, size_t z) {
+  if (z == 0) return *this;
+  if (_z != 0 && _buf[_z-1] != '/') concat("/", 1);
+  return concat(p, z);
+}
+
+inline Path& Path::parent() {
+  auto z = _z;
+  while (z && _buf[z-1] == '/') --z;  // trailing slashes
+  while (z && _buf[z-1] != '/') --z;  // last component
+  while (z > 1 && _buf[z-1] == '/') --z;  // separator, but keep a leading "/"
+  truncate(z);
+  return *this;
+}
+
+inline void Path::truncate(size_t z) {
+  assert(z <= _z);
+  _z = z;
+  _buf[_z] = 0;
+  _overflow = false;
+}
+
+inline const char* Path::basename() const {
+  auto z = _z;
+  while (z && _buf[z-1] != '/') --z;
+  return &_buf[z];
+}
+
+inline const char* Path::extension() const {
+  const char* base = basename();
+  const char* p = &_buf[_z];
+  while (p != base && p[-1] != '.') --p;
+  return (p - 1 > base) ? p : &_buf[_z];
+}
+
+inline std::ostream& operator<< (std::ostream& os, const Path& v) {
+  return os << v.c_str();
+}
+
+}} // namespace
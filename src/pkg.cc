@@ -0,0 +1,121 @@
+#include "pkg.hh"
+#include "arena.hh"
+#include "async.hh" // uv_mutex_t
+
+namespace rx {
+
+
+struct PkgRegistry {
+  // Maps package names to entries, which are never freed so that Pkg handles stay valid for the
+  // life of the process
+  using Entry = Pkg::Entry;
+
+  PkgRegistry() { uv_mutex_init(&_mu); }
+
+  static PkgRegistry& get() {
+    static PkgRegistry* r = new PkgRegistry; // never destroyed; packages outlive static dtors
+    return *r;
+  }
+
+  const Entry* intern(const string& name) {
+    uv_mutex_lock(&_mu);
+    auto I = _entries.find(&name);
+    const Entry* e;
+    if (I != _entries.end()) {
+      e = I->second;
+    } else {
+      auto* ne = _arena.make<Entry>();
+      ne->name = name;
+      hash::murmur3_128(name, ne->hash);
+      memcpy(&ne->order, ne->hash.bytes, sizeof(ne->order));
+      ne->id = (uint32_t)_entries.size();
+      _entries.emplace(&ne->name, ne);
+      e = ne;
+    }
+    uv_mutex_unlock(&_mu);
+    return e;
+  }
+
+private:
+  struct NameHash {
+    size_t operator()(const string* s) const { return std::hash<string>()(*s); }
+  };
+  struct NameEq {
+    bool operator()(const string* a, const string* b) const { return *a == *b; }
+  };
+
+  uv_mutex_t _mu;
+  Arena      _arena;
+  std::unordered_map<const string*, const Entry*, NameHash, NameEq> _entries;
+    // keyed by the entry's own name, so that names are only stored once
+};
+
+
+const Pkg::Entry* Pkg::intern(const string& name) {
+  assert(!name.empty());
+  assert(name.front() != '/');
+  assert(name.back() != '/');
+  // TODO: instead of asserts, clean up string or provide a "pkg name validation" function.
+  return PkgRegistry::get().intern(name);
+}
+
+
+PkgImports& PkgImports::operator=(const PkgImports& other) {
+  if (this != &other) {
+    _size = 0;
+    while (_cap < other._size) grow();
+    std::copy(other.begin(), other.end(), _p);
+    _size = other._size;
+  }
+  return *this;
+}
+
+
+PkgImports& PkgImports::operator=(PkgImports&& other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  if (other._p == other._inline) {
+    std::copy(other.begin(), other.end(), _inline);
+    if (_p != _inline) ::free(_p);
+    _p = _inline;
+    _cap = kInlineCap;
+  } else {
+    // Take the other set's heap memory
+    if (_p != _inline) ::free(_p);
+    _p = other._p;
+    _cap = other._cap;
+    other._p = other._inline;
+    other._cap = kInlineCap;
+  }
+  _size = other._size;
+  other._size = 0;
+  return *this;
+}
+
+
+void PkgImports::grow() {
+  uint32_t cap = _cap * 2;
+  auto* p = (Pkg*)::malloc(sizeof(Pkg) * cap);
+  std::copy(begin(), end(), p);
+  if (_p != _inline) ::free(_p);
+  _p = p;
+  _cap = cap;
+}
+
+
+bool PkgImports::insert(const Pkg& pkg) {
+  auto I = std::lower_bound(begin(), end(), pkg);
+  if (I != end() && *I == pkg) {
+    return false;
+  }
+  size_t i = I - begin();
+  if (_size == _cap) grow();
+  std::copy_backward(_p + i, _p + _size, _p + _size + 1);
+  _p[i] = pkg;
+  ++_size;
+  return true;
+}
+
+
+} // namespace
@@ -5,11 +5,9 @@
 namespace rx {
 
 struct Pkg;
+struct PkgImports;
 using std::string;
 
-using PkgImports = std::set<Pkg>;
-  // Imports need to be ordered and unique -- both properties of std::set :)
-
 
 struct PkgUnionID {
   // Identifier for a union of packages.
@@ -23,30 +21,99 @@ private:
 
 
 struct Pkg {
-  Pkg(string&& name);
-  Pkg(const string& name) : Pkg{std::move(string{name})} {}
-  Pkg(const char* name) : Pkg{std::move(string{name})} {}
-
-  string::const_iterator cbegin() const { return _name.cbegin(); }
-  string::const_iterator cend() const { return _name.cend(); }
-  const string& name() const { return _name; } // "foo/a/bar"
+  // A package, e.g. "foo/a/bar". Package names are interned in a process-wide registry the first
+  // time they are seen, so a Pkg is a pointer-sized handle that is free to copy and compare, and
+  // the hash of its name is computed only once. Thread safe.
+  Pkg(const string& name);
+  Pkg(const char* name) : Pkg{string{name}} {}
+
+  string::const_iterator cbegin() const { return name().cbegin(); }
+  string::const_iterator cend() const { return name().cend(); }
+  const string& name() const { return _e->name; } // "foo/a/bar"
   string basename() const; // "bar"
+  uint32_t id() const { return _e->id; }
+    // Dense, starting at 0 in the order packages are first seen. Differs between processes.
+  const hash::B16& hash() const { return _e->hash; } // Murmur3 of the name
+
+  bool operator==(const Pkg& other) const { return _e == other._e; }
+  bool operator!=(const Pkg& other) const { return _e != other._e; }
+  bool operator==(const string& name) const { return _e->name == name; }
+  bool operator<(const Pkg& other) const {
+    // Canonical order, which unlike IDs is the same in every process
+    return _e->order < other._e->order || (_e->order == other._e->order && _e != other._e &&
+                                           _e->name < other._e->name);
+  }
+  operator std::string() const { return _e->name; }
+
+private:
+  friend struct PkgImports;
+  friend struct PkgRegistry;
+  struct Entry {
+    string    name;
+    hash::B16 hash;
+    uint64_t  order; // leading bytes of `hash`
+    uint32_t  id;
+  };
+  Pkg() : _e{nullptr} {}
+  static const Entry* intern(const string& name);
+  const Entry* _e;
+};
+
 
-  bool operator==(const string& name) const { return _name == name; }
-  int operator<(const Pkg& other) const { return _name < other._name; }
-  operator std::string() const { return _name; }
+struct PkgImports {
+  // Set of packages in canonical order, stored as a sorted vector of handles. Small sets, which is
+  // what most source files import, don't allocate. The first package is the base of a union.
+  enum : uint32_t { kInlineCap = 4 };
+
+  PkgImports() : _p{_inline}, _size{0}, _cap{kInlineCap} {}
+  PkgImports(std::initializer_list<Pkg>);
+  PkgImports(const PkgImports&);
+  PkgImports(PkgImports&&) noexcept;
+  PkgImports& operator=(const PkgImports&);
+  PkgImports& operator=(PkgImports&&) noexcept;
+  ~PkgImports() { if (_p != _inline) ::free(_p); }
+
+  bool insert(const Pkg&); // false if the package was already in the set
+  bool contains(const Pkg&) const;
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  const Pkg* begin() const { return _p; }
+  const Pkg* end() const { return _p + _size; }
+  const Pkg* cbegin() const { return _p; }
+  const Pkg* cend() const { return _p + _size; }
+  const Pkg& operator[](size_t i) const { return _p[i]; }
+
+  bool operator==(const PkgImports&) const;
+  bool operator!=(const PkgImports& other) const { return !(*this == other); }
 
 private:
-  string _name;
+  void grow();
+  Pkg*     _p;
+  uint32_t _size;
+  uint32_t _cap;
+  Pkg      _inline[kInlineCap];
 };
 
 // ================================================================================================
 
 
 inline PkgUnionID::PkgUnionID(const PkgImports& packages) {
+  // Combines the precomputed hashes of the packages rather than hashing their names again.
+  // Murmur3 has a very good key distribution.
+  hash::B16 buf[PkgImports::kInlineCap];
+  std::unique_ptr<hash::B16[]> heapbuf;
+  hash::B16* hashes = buf;
+  if (packages.size() > PkgImports::kInlineCap) {
+    heapbuf.reset(new hash::B16[packages.size()]);
+    hashes = heapbuf.get();
+  }
+  size_t i = 0;
+  for (auto& pkg : packages) {
+    hashes[i++] = pkg.hash();
+  }
   hash::B16 r;
-  hash::murmur3_128(join(packages, string{1,'\0'}, [](const Pkg& v) { return v.name(); }), r);
-  // Murmur3 has a very good key distribution
+  hash::murmur3_128(hashes, sizeof(hash::B16) * i, r);
   hash::encode_128(r, _s);
 }
 
@@ -54,21 +121,36 @@ inline string PkgUnionID::toString() const {
   return string{(const char*)_s, 22};
 }
 
-inline Pkg::Pkg(string&& name) : _name{std::forward<decltype(name)>(name)} {
-  assert(!_name.empty());
-  assert(_name.front() != '/');
-  assert(_name.back() != '/');
-  // TODO: instead of asserts, clean up string or provide a "pkg name validation" function.
-}
+inline Pkg::Pkg(const string& name) : _e{intern(name)} {}
 
 inline string Pkg::basename() const {
-  assert(_name.back() != '/');
-  auto z = _name.rfind('/');
-  return (z == string::npos) ? _name : _name.substr(z+1);
+  auto z = name().rfind('/');
+  return (z == string::npos) ? name() : name().substr(z+1);
 }
 
 inline std::ostream& operator<< (std::ostream& os, const Pkg& v) {
   return os << v.name();
 }
 
+inline PkgImports::PkgImports(std::initializer_list<Pkg> pkgs) : PkgImports{} {
+  for (auto& pkg : pkgs) insert(pkg);
+}
+
+inline PkgImports::PkgImports(const PkgImports& other) : PkgImports{} {
+  *this = other;
+}
+
+inline PkgImports::PkgImports(PkgImports&& other) noexcept : PkgImports{} {
+  *this = std::move(other);
+}
+
+inline bool PkgImports::contains(const Pkg& pkg) const {
+  auto I = std::lower_bound(begin(), end(), pkg);
+  return I != end() && *I == pkg;
+}
+
+inline bool PkgImports::operator==(const PkgImports& other) const {
+  return _size == other._size && std::equal(begin(), end(), other.begin());
+}
+
 } // namespace
@@ -0,0 +1,233 @@
+#include "pkgiface.hh"
+namespace rx {
+
+// File layout. Integers are in host byte order, like other files in the package directory.
+//
+//   Header
+//   SymRec[nsyms]      sorted by name, compared bytewise
+//   ParamRec[nparams]  the parameters of each symbol are consecutive
+//   strings            names, not NUL terminated
+//
+// Records are 8-byte aligned within the file, so in a mapped file they are naturally aligned.
+
+static const uint8_t kVersion = 1;
+static const char    kMagic[8] = {'r','x','i','f','a','c','e',(char)kVersion};
+
+struct Header {
+  char      magic[8];
+  uint32_t  nsyms;
+  uint32_t  nparams;
+  hash::B16 interfaceHash; // of everything after the header
+};
+
+struct SymRec {
+  uint32_t nameOffs; // in the string table
+  uint16_t nameSize;
+  uint8_t  kind;
+  uint8_t  nparams;
+  uint32_t params;   // index of the first parameter in the parameter table
+  uint32_t _reserved;
+};
+
+struct ParamRec {
+  uint32_t nameOffs;
+  uint32_t nameSize;
+};
+
+static_assert(sizeof(Header) == 32 && sizeof(SymRec) == 16 && sizeof(ParamRec) == 8,
+              "PkgInterface records should not have implicit padding");
+
+
+static int Compare(const char* a, size_t az, const char* b, size_t bz) {
+  int c = memcmp(a, b, std::min(az, bz));
+  return (c != 0) ? c : (az < bz) ? -1 : (az > bz) ? 1 : 0;
+}
+
+
+static bool IsExported(const string& name) {
+  return !name.empty() && name[0] >= 'A' && name[0] <= 'Z';
+}
+
+
+// ------------------------------------------------------------------------------------------------
+
+void PkgInterface::Writer::add(const Ast& ast) {
+  for (auto id : ast.list(ast[ast.root()])) {
+    auto& n = ast[id];
+    if (n.kind != Ast::Func) continue;
+    auto l = ast.list(n); // name, body, parameters...
+    auto name = ast.str(ast[l[0]]);
+    if (!IsExported(name)) continue;
+    Decl d{Func, std::move(name), {}};
+    for (size_t i = 2; i != l.size(); ++i) {
+      d.params.emplace_back(ast.str(ast[l[i]]));
+    }
+    _decls.emplace_back(std::move(d));
+  }
+}
+
+
+Error PkgInterface::Writer::finish(string& data, hash::B16& interfaceHash) {
+  std::sort(_decls.begin(), _decls.end(), [](const Decl& a, const Decl& b) {
+    return a.name < b.name;
+  });
+  size_t nparams = 0;
+  for (size_t i = 0; i != _decls.size(); ++i) {
+    auto& d = _decls[i];
+    if (i != 0 && _decls[i - 1].name == d.name) {
+      return Error{"duplicate declaration of " + d.name};
+    }
+    if (d.name.size() > UINT16_MAX || d.params.size() > UINT8_MAX) {
+      return Error{"declaration of " + d.name + " is too large"};
+    }
+    nparams += d.params.size();
+  }
+
+  string strings;
+  std::vector<SymRec> syms;
+  std::vector<ParamRec> params;
+  syms.reserve(_decls.size());
+  params.reserve(nparams);
+  for (auto& d : _decls) {
+    syms.push_back(SymRec{(uint32_t)strings.size(), (uint16_t)d.name.size(), d.kind,
+                          (uint8_t)d.params.size(), (uint32_t)params.size(), 0});
+    strings += d.name;
+    for (auto& p : d.params) {
+      params.push_back(ParamRec{(uint32_t)strings.size(), (uint32_t)p.size()});
+      strings += p;
+    }
+  }
+
+  Header h;
+  memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.nsyms = (uint32_t)syms.size();
+  h.nparams = (uint32_t)params.size();
+  data.assign(sizeof(Header), '\0');
+  data.append((const char*)syms.data(), syms.size() * sizeof(SymRec));
+  data.append((const char*)params.data(), params.size() * sizeof(ParamRec));
+  data += strings;
+  hash::murmur3_128(data.data() + sizeof(Header), data.size() - sizeof(Header), h.interfaceHash);
+  memcpy(&data[0], &h, sizeof(h));
+  interfaceHash = h.interfaceHash;
+  return nullptr;
+}
+
+
+// ------------------------------------------------------------------------------------------------
+
+Error PkgInterface::open(const string& filename, const hash::B16* expectedHash) {
+  fs::FileData d;
+  auto err = fs::readfile(filename, d);
+  if (err) return err;
+  Header h;
+  if (d.size() < sizeof(h)) {
+    return Error{filename + ": not a package interface"};
+  }
+  memcpy(&h, d.data(), sizeof(h));
+  if (memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) {
+    return Error{filename + ": not a package interface, or written by another version"};
+  }
+  if (sizeof(h) + (uint64_t)h.nsyms * sizeof(SymRec) + (uint64_t)h.nparams * sizeof(ParamRec) >
+      d.size())
+  {
+    return Error{filename + ": truncated package interface"};
+  }
+  if (expectedHash &&
+      memcmp(h.interfaceHash.bytes, expectedHash->bytes, sizeof(expectedHash->bytes)) != 0)
+  {
+    return Error{filename + ": package interface is outdated"};
+  }
+  _data = std::move(d);
+  return nullptr;
+}
+
+
+size_t PkgInterface::size() const {
+  if (_data.size() == 0) return 0;
+  uint32_t nsyms;
+  memcpy(&nsyms, _data.data() + offsetof(Header, nsyms), sizeof(nsyms));
+  return nsyms;
+}
+
+
+const hash::B16& PkgInterface::interfaceHash() const {
+  static const hash::B16 kNone{};
+  if (_data.size() == 0) return kNone;
+  return *(const hash::B16*)(_data.data() + offsetof(Header, interfaceHash));
+}
+
+
+const char* PkgInterface::strings() const {
+  Header h;
+  memcpy(&h, _data.data(), sizeof(h));
+  return _data.data() + sizeof(h) + h.nsyms * sizeof(SymRec) + h.nparams * sizeof(ParamRec);
+}
+
+
+bool PkgInterface::str(uint32_t offs, uint32_t size, const char*& p) const {
+  // Strings are bounds checked as they are used rather than when the file is opened, which would
+  // mean reading all of it
+  auto* s = strings();
+  auto avail = (size_t)(_data.data() + _data.size() - s);
+  if ((uint64_t)offs + size > avail) return false;
+  p = s + offs;
+  return true;
+}
+
+
+PkgInterface::Symbol PkgInterface::lookup(const char* name, size_t size) const {
+  Symbol sym;
+  auto* syms = (const SymRec*)(_data.data() + sizeof(Header));
+  size_t lo = 0, hi = this->size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    auto& r = syms[mid];
+    const char* s;
+    if (!str(r.nameOffs, r.nameSize, s)) break;
+    int c = Compare(s, r.nameSize, name, size);
+    if (c == 0) {
+      sym._iface = this;
+      sym._rec = &r;
+      break;
+    }
+    if (c < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return sym;
+}
+
+
+PkgInterface::Kind PkgInterface::Symbol::kind() const {
+  return (Kind)((const SymRec*)_rec)->kind;
+}
+
+
+string PkgInterface::Symbol::name() const {
+  auto& r = *(const SymRec*)_rec;
+  const char* p;
+  return _iface->str(r.nameOffs, r.nameSize, p) ? string{p, r.nameSize} : string{};
+}
+
+
+size_t PkgInterface::Symbol::paramCount() const {
+  return ((const SymRec*)_rec)->nparams;
+}
+
+
+string PkgInterface::Symbol::paramName(size_t i) const {
+  auto& r = *(const SymRec*)_rec;
+  auto* base = _iface->_data.data();
+  uint32_t nparams;
+  memcpy(&nparams, base + offsetof(Header, nparams), sizeof(nparams));
+  if (i >= r.nparams || (uint64_t)r.params + i >= nparams) return string{};
+  auto* params = (const ParamRec*)(base + sizeof(Header) + _iface->size() * sizeof(SymRec));
+  auto& pr = params[r.params + i];
+  const char* p;
+  return _iface->str(pr.nameOffs, pr.nameSize, p) ? string{p, pr.nameSize} : string{};
+}
+
+
+} // namespace
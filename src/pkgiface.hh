@@ -0,0 +1,71 @@
+#pragma once
+#include "ast.hh"
+#include "fs.hh"
+#include "hash.hh"
+namespace rx {
+using std::string;
+
+// The exported declarations of a .rx package, in a binary file that's stored next to the
+// package's PCH ("foo/bar.rxi") and read by packages that import it. A declaration is exported
+// when its name starts with an upper-case letter, e.g. `func ImportanceOfLOL()`.
+//
+// The file is memory-mapped and used in place: a fixed-size header is followed by a table of
+// fixed-size symbol records sorted by name, a table of parameter names and a string table.
+// Looking up a symbol is a binary search of the symbol table, so only the pages holding the
+// symbols that are actually used are ever read.
+//
+// The header carries a hash of everything after it, the package's interface hash, which changes
+// only when the exported declarations do. Importers can check it against the hash they were
+// last built with, and the dependency database (DepsDB) records it per package.
+//
+struct PkgInterface {
+  enum Kind : uint8_t {
+    Func = 1,
+  };
+
+  struct Symbol {
+    // A declaration in a mapped interface. Valid while the interface is open.
+    operator bool() const { return _iface != nullptr; }
+    Kind kind() const;
+    string name() const;
+    size_t paramCount() const;
+    string paramName(size_t i) const;
+  private:
+    friend struct PkgInterface;
+    const PkgInterface* _iface = nullptr;
+    const void*         _rec = nullptr;
+  };
+
+  struct Writer {
+    // Collects the exported declarations of a package's syntax trees and serializes them
+    void add(const Ast&);
+    Error finish(string& data, hash::B16& interfaceHash);
+      // Fails if a name is declared more than once. Sources are added in any order; the output
+      // only depends on the set of declarations.
+  private:
+    struct Decl {
+      Kind                kind;
+      string              name;
+      std::vector<string> params;
+    };
+    std::vector<Decl> _decls;
+  };
+
+  Error open(const string& filename, const hash::B16* expectedHash=nullptr);
+    // Map an interface file. Only the header is checked, which is enough to tell files of other
+    // versions and, when `expectedHash` is given, stale files apart.
+  Symbol lookup(const char* name, size_t size) const;
+  Symbol lookup(const string& name) const { return lookup(name.data(), name.size()); }
+    // Find an exported declaration by name. The returned symbol is false if there's none.
+
+  size_t size() const; // number of symbols
+  const hash::B16& interfaceHash() const;
+
+private:
+  const char* strings() const;
+  bool str(uint32_t offs, uint32_t size, const char*& p) const;
+
+  fs::FileData _data;
+};
+
+} // namespace
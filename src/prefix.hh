@@ -1,14 +1,23 @@
 // libc
 extern "C" {
+#include <limits.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 }
 
+// SIMD intrinsics
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // libc++
 #include <algorithm>
+#include <cstddef>
+#include <deque>
 #include <forward_list>
 #include <functional>
 #include <initializer_list>
@@ -22,6 +31,9 @@ extern "C" {
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 
 // clang
 #include "clang/AST/ASTConsumer.h"
@@ -42,6 +54,7 @@ extern "C" {
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Lex/HeaderSearch.h"
 #include "clang/Lex/Preprocessor.h"
+#include "clang/Serialization/ASTWriter.h" /* PCHGenerator */
 
 // llvm
 #include "llvm/ADT/OwningPtr.h"
@@ -61,3 +74,4 @@ extern "C" {
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
@@ -0,0 +1,69 @@
+#include "ref.hh"
+#include "async.hh"
+
+namespace rx {
+
+
+BiasedRefCount::BiasedRefCount(Async& owner)
+  : _owner{&owner}
+  , _ownerThread{(unsigned long)uv_thread_self()}
+{}
+
+
+bool BiasedRefCount::isOwnerThread() const {
+  return (unsigned long)uv_thread_self() == _ownerThread;
+}
+
+
+void BiasedRefCount::retainShared() {
+  // Whoever takes a reference already holds one, so the count can't drop to zero meanwhile
+  __atomic_fetch_add(&_shared, (uint32_t)kOne, __ATOMIC_RELAXED);
+}
+
+
+bool BiasedRefCount::releaseSlow(void* obj, Destroy destroy) {
+  if (isOwnerThread()) {
+    return releaseOnOwner(obj, destroy);
+  }
+  uint32_t v = __atomic_load_n(&_shared, __ATOMIC_RELAXED);
+  while (v >= kOne) {
+    if (__atomic_compare_exchange_n(&_shared, &v, v - kOne, /*weak=*/true,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      if (v - kOne == kMerged) {
+        destroy(obj); // the owner has let go already and this was the last reference
+        return true;
+      }
+      return false;
+    }
+  }
+  // Every reference is counted in `_local`, which only the owner thread may change
+  assert(v == 0);
+  auto* self = this;
+  _owner->post([self, obj, destroy]{ self->releaseOnOwner(obj, destroy); });
+  return false;
+}
+
+
+bool BiasedRefCount::releaseOnOwner(void* obj, Destroy destroy) {
+  if (_local == 0) {
+    // The owner dropped its local references earlier and has since been handed a shared one
+    if (__atomic_sub_fetch(&_shared, (uint32_t)kOne, __ATOMIC_ACQ_REL) == kMerged) {
+      destroy(obj);
+      return true;
+    }
+    return false;
+  }
+  if (--_local != 0) {
+    return false;
+  }
+  // Let other threads know that the owner is done, so that whoever drops the last shared
+  // reference deletes the object
+  if (__atomic_fetch_or(&_shared, (uint32_t)kMerged, __ATOMIC_ACQ_REL) == 0) {
+    destroy(obj);
+    return true;
+  }
+  return false;
+}
+
+
+} // namespace
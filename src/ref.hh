@@ -1,6 +1,8 @@
 #pragma once
 namespace rx {
 
+struct Async;
+
 struct PlainRefCounter {
   using value_type = uint32_t;
   static void retain(value_type& v) { ++v; }
@@ -8,9 +10,12 @@ struct PlainRefCounter {
 };
 
 struct AtomicRefCounter {
-  using value_type = volatile uint32_t;
-  static void retain(value_type& v) { __sync_add_and_fetch(&v, 1); }
-  static bool release(value_type& v) { return __sync_sub_and_fetch(&v, 1) == 0; }
+  // Taking another reference needs no ordering since whoever takes it already holds one. The
+  // release that drops the count to zero must observe every write made through other references
+  // before the object is deleted, which the acquire-release decrement guarantees.
+  using value_type = uint32_t;
+  static void retain(value_type& v) { __atomic_fetch_add(&v, 1, __ATOMIC_RELAXED); }
+  static bool release(value_type& v) { return __atomic_sub_fetch(&v, 1, __ATOMIC_ACQ_REL) == 0; }
 };
 
 
@@ -22,7 +27,8 @@ struct Ref {
   explicit Ref(T* p, bool add_ref=false) : self{p} { if (add_ref && p) { self->retainRef(); } }
   Ref(const Ref& rhs) : self{rhs.self} { if (self) self->retainRef(); }
   Ref(const Ref* rhs) : self{rhs->self} { if (self) self->retainRef(); }
-  Ref(Ref&& rhs) { self = std::move(rhs.self); rhs.self = 0; }
+  Ref(Ref&& rhs) noexcept : self{rhs.self} { rhs.self = nullptr; }
+    // noexcept lets `func` store closures that capture a Ref inline instead of on the heap
   ~Ref() { if (self) self->releaseRef(); }
   void resetSelf(std::nullptr_t=nullptr) const {
     if (self) {
@@ -41,8 +47,8 @@ struct Ref {
   Ref& operator=(const Ref& rhs) {  return resetSelf(rhs.self); }
   Ref& operator=(T* rhs) {          return resetSelf(rhs); }
   Ref& operator=(const T* rhs) {    return resetSelf(rhs); }
-  Ref& operator=(std::nullptr_t) {  return resetSelf(nullptr); }
-  Ref& operator=(Ref&& rhs) {
+  Ref& operator=(std::nullptr_t) {  resetSelf(); return *this; }
+  Ref& operator=(Ref&& rhs) noexcept {
     if (self != rhs.self && self) {
       self->releaseRef();
       self = nullptr;
@@ -57,26 +63,84 @@ struct Ref {
 
 template <typename T, class C>
 struct RefCounted {
-  typename C::value_type __refc = 1;
-  virtual ~RefCounted() = default;
+  // Deletes the object as a `T`, so T needs no virtual destructor and RefCounted adds nothing but
+  // the count to it. T must be the type that was allocated.
   void retainRef() { C::retain(__refc); }
-  bool releaseRef() { return C::release(__refc) && ({ delete this; true; }); }
+  bool releaseRef() { return C::release(__refc) && ({ delete static_cast<T*>(this); true; }); }
   using Ref = Ref<T>;
+  typename C::value_type __refc = 1;
+protected:
+  ~RefCounted() = default;
 };
 
 template <typename T> using UnsafeRefCounted = RefCounted<T, PlainRefCounter>;
 template <typename T> using SafeRefCounted = RefCounted<T, AtomicRefCounter>;
 
+
+struct BiasedRefCount {
+  // Reference count biased towards the thread of a loop, see BiasedRefCounted.
+  using Destroy = void(*)(void*);
+  explicit BiasedRefCount(Async& owner);
+  BiasedRefCount(const BiasedRefCount&) = delete;
+
+  void retain() {
+    if (isOwnerThread() && _local != 0) ++_local; else retainShared();
+  }
+  bool release(void* obj, Destroy destroy) {
+    // Returns true if the object was destroyed
+    if (isOwnerThread() && _local > 1) { --_local; return false; }
+    return releaseSlow(obj, destroy);
+  }
+
+private:
+  enum : uint32_t { kMerged = 1, kOne = 2 };
+    // `_shared` is the count of references held outside of `_local` times kOne, plus kMerged once
+    // the owner has dropped its last local reference
+
+  bool isOwnerThread() const;
+  void retainShared();
+  bool releaseSlow(void* obj, Destroy);
+  bool releaseOnOwner(void* obj, Destroy);
+
+  Async*            _owner;
+  unsigned long     _ownerThread;
+  uint32_t          _local = 1;  // only touched by the owner thread
+  volatile uint32_t _shared = 0;
+};
+
+
+template <typename T>
+struct BiasedRefCounted {
+  // Reference counted object which lives on the thread of a loop: it must be created on, and is
+  // normally only used from, the thread that runs `owner`. Retaining and releasing on that thread
+  // are plain, non-atomic operations. Other threads may still take and drop references, at the
+  // cost of an atomic operation, and a reference they drop which the owner thread took is handed
+  // back to it with `Async::post`. The object is always deleted on the owner thread, or on the
+  // thread that drops the last reference when the owner thread holds none.
+  explicit BiasedRefCounted(Async& owner) : __refc{owner} {}
+  void retainRef() { __refc.retain(); }
+  bool releaseRef() { return __refc.release(static_cast<T*>(this), &destroy); }
+  using Ref = Ref<T>;
+  BiasedRefCount __refc;
+protected:
+  ~BiasedRefCounted() = default;
+private:
+  static void destroy(void* p) { delete static_cast<T*>(p); }
+};
+
 // Example:
 //
 //   struct ReqBase {
 //     uv_fs_t uvreq;
 //   };
-//  
-//   struct StatReq final : ReqBase, SafeRefCounted<StatReq> {
-//     StatReq(StatCallback&& cb) : Req{}, cb{fwdarg(cb)} {}
+//
+//   struct StatReq final : ReqBase, BiasedRefCounted<StatReq> {
+//     StatReq(Async& a, StatCallback&& cb) : BiasedRefCounted{a}, cb{fwdarg(cb)} {}
 //     StatCallback cb;
 //   };
 //
+//   AsyncCanceler canceler = [req = StatReq::Ref{req, /*add_ref=*/true}]{ ... };
+//     // Moving the Ref into the closure saves a retain and release over capturing a copy
+//
 
 } // namespace
@@ -3,6 +3,9 @@
 #include "net.hh"
 #include "fs.hh"
 #include "deps.hh"
+#include "executor.hh"
+#include "taskgraph.hh"
+#include "trace.hh"
 #include <iostream>
 
 // using namespace llvm;
@@ -15,7 +18,52 @@ using std::string;
 static int ExecuteLLVMModule(llvm::Module*, char*const* envp);
 
 
+static const char* FlagValue(const char* arg, const char* name) {
+  // Returns "V" if arg is "--name=V"
+  auto z = strlen(name);
+  if (strncmp(arg, name, z) != 0 || arg[z] != '=') {
+    return nullptr;
+  }
+  return arg + z + 1;
+}
+
+
 int main(int argc, const char **argv, char*const* envp) {
+  size_t ioThreads = 0, cpuThreads = 0, jobs = 0;
+  const char* traceFile = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    const char* v;
+    if ((v = FlagValue(argv[i], "--io-threads"))) {
+      ioThreads = strtoul(v, nullptr, 10);
+    } else if ((v = FlagValue(argv[i], "--cpu-threads"))) {
+      cpuThreads = strtoul(v, nullptr, 10);
+    } else if (strncmp(argv[i], "-j", 2) == 0) {
+      // -j N or -jN: how many build tasks to run at once. The CPU pool keeps its own size, which
+      // --cpu-threads sets, since other work (e.g. parsing) runs on it too.
+      v = (argv[i][2] != '\0') ? argv[i] + 2 : (i + 1 < argc) ? argv[++i] : "";
+      jobs = strtoul(v, nullptr, 10);
+      if (jobs == 0) {
+        cerr << "-j expects a positive number" << endl;
+        return 1;
+      }
+    } else if ((v = FlagValue(argv[i], "--trace"))) {
+      traceFile = v;
+    } else {
+      cerr << "unknown option " << argv[i] << endl;
+      return 1;
+    }
+  }
+  Executor::configure(ioThreads, cpuThreads);
+  TaskGraph::setDefaultConcurrency(jobs);
+  trace::setThreadName("main");
+  if (traceFile == nullptr) {
+    traceFile = getenv("RX_TRACE");
+  }
+  if (traceFile != nullptr && !trace::start(traceFile)) {
+    cerr << "failed to open trace file " << traceFile << endl;
+    return 1;
+  }
+
   Compiler compiler;
 
   // {
@@ -25,16 +73,25 @@ int main(int argc, const char **argv, char*const* envp) {
   // }
 
   // rx build foo/bar
-  PkgDeps pkgDeps{compiler.rxDir(), compiler.pkgDir(), "foo/bar", [](Error err) {
+  DepsDB depsDB;
+  auto depsDBFilename = compiler.pkgDir() + "/.rxdeps";
+  auto err = depsDB.load(depsDBFilename);
+  if (err) cerr << "Failed to read dependency database " << depsDBFilename << ": " << err << endl;
+  compiler.setDepsDB(&depsDB);
+  PkgDeps pkgDeps{compiler.rxDir(), compiler.pkgDir(), "foo/bar", [&](Error err) {
     if (err) {
       cerr << "pkgDeps failed: " << err << endl;
     } else {
       cerr << "pkgDeps completed successfully" << endl;
     }
+    err = depsDB.save(depsDBFilename);
+    if (err) cerr << "Failed to write dependency database " << depsDBFilename << ": " << err << endl;
   }};
+  pkgDeps.setDB(&depsDB);
   pkgDeps.resolve();
 
   Async::main().run();
+  trace::finish();
   return 0;
 
   // bool ok;
@@ -1,5 +1,5 @@
 #include "srcfile.hh"
-#include "lex.hh"
+#include "trace.hh"
 namespace rx {
 
 using std::cerr;
@@ -9,37 +9,37 @@ using std::endl;
 // #define DBG(...)
 
 
-Error SrcFile::parse() {
-
-  if (_nameext == "rx") {
-    Lex lex{_data.data(), _data.size()};
-    Text tokValue;
-
-    while (lex.isValid()) {
-      auto tok = lex.next(tokValue);
-      switch (tok) {
-        case Lex::Error: return lex.lastError();
-        case Lex::End:   break;
-        default: {
-          cerr << Lex::repr(tok, tokValue)
-               << "  @ "
-               << "offset:" << lex.srcLocation().offset << ", "
-               << "length:" << lex.srcLocation().length << ", "
-               << "line:  " << lex.srcLocation().line << ", "
-               << "column:" << lex.srcLocation().column
-               << endl;
-          break;
-        }
-      }
-    }
+Error SrcFile::parse(string& out) {
+  trace::Scope ts{"srcfile", "parse", _pathname};
+  if (strcmp(nameext(), "rx") != 0) {
+    return nullptr;
   }
-
-  // DBG("parse " << pathname())
-  // DBG("  file[0] = '" << (char)_data[0] << "'")
-  // DBG("  file[1] = '" << (char)_data[1] << "'")
-  // DBG("  file[2] = '" << (char)_data[2] << "'")
+  std::unique_ptr<Ast> ast{new Ast};
+  auto err = ast->parse(_data.data(), _data.size());
+  if (err) {
+    return Error{string{_pathname, _pathnameSize} + ":" + err.message()};
+  }
+  out += string{_pathname, _pathnameSize} + ": " + ast->repr() + "\n";
+  _ast = std::move(ast);
   return nullptr;
 }
 
 
+void SrcFileSet::sort() {
+  std::sort(_files.begin(), _files.end());
+  auto E = std::unique(_files.begin(), _files.end(), [](const SrcFile& a, const SrcFile& b) {
+    return strcmp(a.pathname(), b.pathname()) == 0;
+  });
+  _files.erase(E, _files.end());
+}
+
+
+SrcFile* SrcFileSet::find(const char* pathname) {
+  auto I = std::lower_bound(begin(), end(), pathname, [](const SrcFile& f, const char* pathname) {
+    return strcmp(f.pathname(), pathname) < 0;
+  });
+  return (I != end() && strcmp(I->pathname(), pathname) == 0) ? I : nullptr;
+}
+
+
 } // namespace
@@ -3,39 +3,81 @@
 #include "util.hh"
 #include "error.hh"
 #include "fs.hh"
+#include "arena.hh"
+#include "ast.hh"
 namespace rx {
 using std::string;
 
 
 struct SrcFile {
-  SrcFile(const Pkg&, const fs::Stat&, const string& filename, const string& nameext);
+  // A source file of a package. Only the parts of the file's status that builds look at are kept,
+  // and its names are suffixes of a single pathname string, so records are small and an array of
+  // them is cheap to walk.
+  SrcFile(const Pkg&, const fs::Stat&, const string& filename, const string& nameext, Arena&);
+    // The pathname is allocated in `arena`, which must outlive the file
 
   const Pkg&          pkg() const;      // Package it belongs to
-  const fs::Stat&     stat() const;
-  const string&       filename() const; // e.g. "bar.cc" or "bar.rx"
-  const string&       nameext() const;  // e.g. "cc" or "rx"
-  const string&       pathname() const; // e.g. "bar/bar.cc" or "foo/bar/bar.rx"
+  const fs::FileID&   id() const;
+  uint64_t            size() const;     // in bytes, when the directory was scanned
+  const Time&         mtime() const;
+  const char*         filename() const; // e.g. "bar.cc" or "bar.rx"
+  const char*         nameext() const;  // e.g. "cc" or "rx"
+  const char*         pathname() const; // e.g. "bar/bar.cc" or "foo/bar/bar.rx"
+  size_t              pathnameSize() const;
   const fs::FileData& data() const;
   void setData(fs::FileData&&);
 
-  Error parse();
+  Error parse(string& out);
+    // Parse the file's data. Diagnostic output is appended to `out` instead of being written to
+    // stderr, so that files can be parsed on worker threads and each file's output printed in one
+    // piece. Different files can be parsed concurrently.
+  const Ast* ast() const; // Syntax tree, once parsed
 
-  bool operator<(const SrcFile& other) const { return _pathname > other._pathname; } // for b-trees
-  // bool operator<(const SrcFile& other) const { return stat.ino < other.stat.ino; } // for b-trees
-  // bool operator==(const SrcFile& other) const { return pathname == other.pathname; } // for hashes
-  // struct Hash { size_t operator()(const SrcFile& v) const {
-  //   return std::hash<string>()(v.pathname); } };
+  bool operator<(const SrcFile& other) const { return strcmp(_pathname, other._pathname) < 0; }
 
 private:
   Pkg          _pkg;      // Package it belongs to
-  fs::Stat     _stat;
-  string       _filename; // e.g. "bar.cc" or "bar.rx"
-  string       _nameext;  // e.g. "cc" or "rx"
-  string       _pathname; // e.g. "bar/bar.cc" or "foo/bar/bar.rx"
+  const char*  _pathname; // NUL terminated
+  uint32_t     _pathnameSize;
+  uint16_t     _filenameOffs; // filename and nameext are suffixes of pathname
+  uint16_t     _nameextOffs;
+  fs::FileID   _id;
+  uint64_t     _size;
+  Time         _mtime;
   fs::FileData _data;
+  std::unique_ptr<Ast> _ast;
 };
 
-using SrcFileSet = std::set<SrcFile>;
+
+struct SrcFileSet {
+  // Source files of a package, in a flat array ordered by pathname. Files are added while a
+  // directory is scanned and sorted once when done. Elements can be modified in place and their
+  // addresses are stable as long as no more files are added.
+  using iterator = SrcFile*;
+  using const_iterator = const SrcFile*;
+
+  SrcFileSet(Arena* arena=nullptr) : _files{ArenaAllocator<SrcFile>{arena}} {}
+    // The array is allocated in `arena` when one is given
+
+  template <typename... Args> SrcFile& emplace(Args&&... args) {
+    _files.emplace_back(std::forward<Args>(args)...);
+    return _files.back();
+  }
+  void sort();
+    // Order files by pathname, dropping any duplicates. Call after adding files.
+  SrcFile* find(const char* pathname);
+    // Look up a file by pathname in a sorted set
+
+  size_t size() const { return _files.size(); }
+  bool empty() const { return _files.empty(); }
+  iterator begin() { return _files.data(); }
+  iterator end() { return _files.data() + _files.size(); }
+  const_iterator begin() const { return _files.data(); }
+  const_iterator end() const { return _files.data() + _files.size(); }
+
+private:
+  std::vector<SrcFile, ArenaAllocator<SrcFile>> _files;
+};
 
 // ================================================================================================
 
@@ -43,21 +85,41 @@ inline SrcFile::SrcFile(
     const Pkg& pkg,
     const fs::Stat& st,
     const string& filename,
-    const string& nameext)
+    const string& nameext,
+    Arena& arena)
   : _pkg{pkg}
-  , _stat{st}
-  , _filename{filename}
-  , _nameext{nameext}
-  , _pathname{fs::pathJoin(pkg.name(), filename)}
-{}
+  , _id{st.id()}
+  , _size{st.size}
+  , _mtime{st.mtime}
+{
+  auto& pkgname = pkg.name();
+  assert(pkgname.size() + 1 + filename.size() <= UINT16_MAX);
+  assert(nameext.size() <= filename.size());
+  auto z = pkgname.size() + (filename.empty() ? 0 : 1 + filename.size());
+  auto* p = (char*)arena.alloc(z + 1, 1);
+  memcpy(p, pkgname.data(), pkgname.size());
+  if (!filename.empty()) {
+    p[pkgname.size()] = '/';
+    memcpy(p + pkgname.size() + 1, filename.data(), filename.size());
+  }
+  p[z] = '\0';
+  _pathname = p;
+  _pathnameSize = (uint32_t)z;
+  _filenameOffs = (uint16_t)(z - filename.size());
+  _nameextOffs = (uint16_t)(z - nameext.size());
+}
 
 inline const Pkg&          SrcFile::pkg() const { return _pkg; }
-inline const fs::Stat&     SrcFile::stat() const { return _stat; }
-inline const string&       SrcFile::filename() const { return _filename; }
-inline const string&       SrcFile::nameext() const { return _nameext; }
-inline const string&       SrcFile::pathname() const { return _pathname; }
+inline const fs::FileID&   SrcFile::id() const { return _id; }
+inline uint64_t            SrcFile::size() const { return _size; }
+inline const Time&         SrcFile::mtime() const { return _mtime; }
+inline const char*         SrcFile::filename() const { return _pathname + _filenameOffs; }
+inline const char*         SrcFile::nameext() const { return _pathname + _nameextOffs; }
+inline const char*         SrcFile::pathname() const { return _pathname; }
+inline size_t              SrcFile::pathnameSize() const { return _pathnameSize; }
 inline const fs::FileData& SrcFile::data() const { return _data; }
 inline void SrcFile::setData(fs::FileData&& data) { _data = fwdarg(data); }
+inline const Ast*          SrcFile::ast() const { return _ast.get(); }
 
 
 } // namespace
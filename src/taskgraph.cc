@@ -0,0 +1,321 @@
+#include "taskgraph.hh"
+#include "buildhistory.hh"
+#include "executor.hh"
+#include "trace.hh"
+#include "ref.hh"
+
+using std::cerr;
+using std::endl;
+// #define DBG(...) cerr << "[" << rx::cx_basename(__FILE__) << "] " <<  __VA_ARGS__ << endl;
+#define DBG(...)
+
+namespace rx {
+
+
+struct TaskGraph::Imp : SafeRefCounted<TaskGraph::Imp> {
+  // Each `Done` holds a reference. Tasks capture it in closures that may be destroyed on other
+  // threads, e.g. the work of an Executor request which is canceled before it runs, so the count
+  // is atomic. Everything else is only used on the loop thread.
+  enum class State { Pending, Ready, Running, Succeeded, Failed, Skipped };
+
+  struct Node {
+    Node(Kind kind, const string& name, Action&& action, uint64_t sizeHint)
+      : kind{kind}, name{name}, action{fwdarg(action)}, sizeHint{sizeHint} {}
+    Kind                kind;
+    string              name;
+    Action              action;
+    uint64_t            sizeHint;
+    std::vector<NodeID> dependents;
+    uint32_t            waitingOn = 0; // dependencies that haven't succeeded yet
+    State               state = State::Pending;
+    uint64_t            priority = 0;  // estimated duration of the longest chain starting here
+    AsyncCanceler       canceler;      // while running
+    uint64_t            startTime = 0;
+  };
+
+  Async&              async;
+  size_t              concurrency;
+  BuildHistory*       history = nullptr;
+  std::vector<Node>   nodes;
+  std::vector<NodeID> ready;         // heap ordered by `readyBefore`
+  size_t             running = 0;
+  size_t             finished = 0; // succeeded, failed or skipped
+  Error              firstError;
+  func<void(Error)>  cb;
+  bool               started = false;
+  bool               canceled = false;
+  bool               dispatching = false;
+
+  Imp(Async& a, size_t concurrency) : async{a}, concurrency{concurrency} {}
+
+  Error sortTopologically(std::vector<NodeID>& order) const;
+  void  prioritize(const std::vector<NodeID>& order);
+  bool  readyBefore(NodeID a, NodeID b) const;
+  void  pushReady(NodeID);
+  void  dispatch();
+  void  start(NodeID);
+  void  finish(NodeID, Error);
+  void  skipDependents(NodeID);
+  void  cancel();
+};
+
+
+Error TaskGraph::Imp::sortTopologically(std::vector<NodeID>& order) const {
+  // Kahn's algorithm: if repeatedly removing nodes without dependencies doesn't remove every
+  // node, the rest are on or behind a cycle.
+  std::vector<uint32_t> waiting;
+  std::vector<NodeID> queue;
+  waiting.reserve(nodes.size());
+  order.reserve(nodes.size());
+  for (NodeID i = 0; i != nodes.size(); ++i) {
+    waiting.push_back(nodes[i].waitingOn);
+    if (nodes[i].waitingOn == 0) queue.push_back(i);
+  }
+  while (!queue.empty()) {
+    auto id = queue.back();
+    queue.pop_back();
+    order.push_back(id);
+    for (auto dep : nodes[id].dependents) {
+      if (--waiting[dep] == 0) queue.push_back(dep);
+    }
+  }
+  if (order.size() == nodes.size()) {
+    return nullptr;
+  }
+  for (NodeID i = 0; i != nodes.size(); ++i) {
+    if (waiting[i] != 0) {
+      return Error{"dependency cycle involving " + string{kindName(nodes[i].kind)} + " " +
+                   nodes[i].name};
+    }
+  }
+  static const Error::Static kDependencyCycle{0, "dependency cycle"};
+  return kDependencyCycle;
+}
+
+
+void TaskGraph::Imp::prioritize(const std::vector<NodeID>& order) {
+  // A task's priority is its own estimated duration plus that of the longest chain of tasks which
+  // depend on it, i.e. a lower bound for how long the build takes from the moment it starts.
+  // Dependents come after their dependencies in `order`, so walking it backwards visits them
+  // first.
+  for (auto I = order.rbegin(), E = order.rend(); I != E; ++I) {
+    auto& n = nodes[*I];
+    uint64_t cost = history ? history->estimate(n.kind, n.name, n.sizeHint) : n.sizeHint;
+    uint64_t longest = 0;
+    for (auto dep : n.dependents) {
+      longest = std::max(longest, nodes[dep].priority);
+    }
+    n.priority = std::max<uint64_t>(cost, 1) + longest;
+  }
+}
+
+
+bool TaskGraph::Imp::readyBefore(NodeID a, NodeID b) const {
+  // Higher priority first, then in the order the tasks were added
+  auto pa = nodes[a].priority, pb = nodes[b].priority;
+  return pa != pb ? pa > pb : a < b;
+}
+
+
+void TaskGraph::Imp::pushReady(NodeID id) {
+  nodes[id].state = State::Ready;
+  ready.push_back(id);
+  std::push_heap(ready.begin(), ready.end(), [this](NodeID a, NodeID b) {
+    return readyBefore(b, a);
+  });
+}
+
+
+void TaskGraph::Imp::dispatch() {
+  // Tasks that complete right away finish from within `start`. Rather than recursing once per
+  // task we let the outermost call do the work.
+  if (dispatching) return;
+  dispatching = true;
+  while (!canceled && running < concurrency && !ready.empty()) {
+    std::pop_heap(ready.begin(), ready.end(), [this](NodeID a, NodeID b) {
+      return readyBefore(b, a);
+    });
+    auto id = ready.back();
+    ready.pop_back();
+    start(id);
+  }
+  dispatching = false;
+}
+
+
+void TaskGraph::Imp::start(NodeID id) {
+  auto& n = nodes[id];
+  DBG("start " << kindName(n.kind) << " " << n.name)
+  n.state = State::Running;
+  ++running;
+  n.startTime = trace::now();
+  auto action = std::move(n.action);
+  Ref ref{this, /*add_ref=*/true};
+  auto canceler = action([ref, id](Error err) { ref->finish(id, err); });
+  if (n.state == State::Running) {
+    n.canceler = std::move(canceler);
+  } // else it has already finished
+}
+
+
+void TaskGraph::Imp::finish(NodeID id, Error err) {
+  auto& n = nodes[id];
+  if (canceled || n.state != State::Running) {
+    return;
+  }
+  DBG("finish " << kindName(n.kind) << " " << n.name << " err=" << err)
+  auto endTime = trace::now();
+  if (trace::enabled()) {
+    trace::recordAsync("build", kindName(n.kind), n.startTime, endTime, n.name.c_str());
+  }
+  --running;
+  ++finished;
+  n.canceler = nullptr;
+  if (err) {
+    n.state = State::Failed;
+    if (!firstError) {
+      firstError = Error{string{kindName(n.kind)} + " " + n.name + ": " + err.message()};
+    }
+    skipDependents(id);
+  } else {
+    n.state = State::Succeeded;
+    if (history) {
+      history->record(n.kind, n.name, n.sizeHint, endTime - n.startTime);
+    }
+    for (auto dep : n.dependents) {
+      auto& d = nodes[dep];
+      if (--d.waitingOn == 0 && d.state == State::Pending) {
+        pushReady(dep);
+      }
+    }
+  }
+
+  if (finished == nodes.size()) {
+    auto f = std::move(cb);
+    f(firstError);
+  } else {
+    dispatch();
+  }
+}
+
+
+void TaskGraph::Imp::skipDependents(NodeID id) {
+  std::vector<NodeID> stack{nodes[id].dependents};
+  while (!stack.empty()) {
+    auto& d = nodes[stack.back()];
+    stack.pop_back();
+    if (d.state == State::Pending) {
+      d.state = State::Skipped;
+      d.action = nullptr;
+      ++finished;
+      stack.insert(stack.end(), d.dependents.begin(), d.dependents.end());
+    }
+  }
+}
+
+
+void TaskGraph::Imp::cancel() {
+  if (canceled || finished == nodes.size()) {
+    return;
+  }
+  canceled = true;
+  cb = nullptr;
+  ready.clear();
+  for (auto& n : nodes) {
+    if (n.state == State::Running && n.canceler) {
+      auto canceler = std::move(n.canceler);
+      canceler();
+    }
+    n.action = nullptr;
+  }
+}
+
+
+static size_t gDefaultConcurrency = 0; // set by setDefaultConcurrency
+
+
+void TaskGraph::setDefaultConcurrency(size_t concurrency) {
+  gDefaultConcurrency = concurrency;
+}
+
+
+TaskGraph::TaskGraph(Async& a, size_t concurrency)
+  : self{new Imp{a, concurrency != 0 ? concurrency :
+                    gDefaultConcurrency != 0 ? gDefaultConcurrency :
+                    Executor::cpu().size()}} {}
+
+
+TaskGraph::~TaskGraph() {
+  self->releaseRef(); // running tasks keep the graph alive until they're done
+  self = nullptr;
+}
+
+
+size_t TaskGraph::size() const {
+  return self->nodes.size();
+}
+
+
+TaskGraph::NodeID TaskGraph::add(Kind kind, const string& name, Action&& action,
+                                 uint64_t sizeHint) {
+  assert(!self->started);
+  self->nodes.emplace_back(kind, name, fwdarg(action), sizeHint);
+  return (NodeID)(self->nodes.size() - 1);
+}
+
+
+void TaskGraph::depend(NodeID node, NodeID dependency) {
+  assert(!self->started);
+  assert(node < self->nodes.size() && dependency < self->nodes.size());
+  self->nodes[dependency].dependents.push_back(node);
+  ++self->nodes[node].waitingOn;
+}
+
+
+void TaskGraph::setHistory(BuildHistory* history) {
+  assert(!self->started);
+  self->history = history;
+}
+
+
+AsyncCanceler TaskGraph::run(func<void(Error)>&& cb) {
+  assert(!self->started);
+  self->started = true;
+  std::vector<NodeID> order;
+  auto err = self->sortTopologically(order);
+  if (err || self->nodes.empty()) {
+    cb(err);
+    return []{};
+  }
+  self->prioritize(order);
+  self->cb = fwdarg(cb);
+  for (NodeID i = 0; i != self->nodes.size(); ++i) {
+    if (self->nodes[i].waitingOn == 0) {
+      self->pushReady(i);
+    }
+  }
+  Imp::Ref ref{self, /*add_ref=*/true};
+  self->dispatch();
+  return [ref]{
+    if (ref) {
+      ref->cancel();
+      ref.resetSelf();
+    }
+  };
+}
+
+
+const char* TaskGraph::kindName(Kind kind) {
+  switch (kind) {
+    case Kind::Scan:           return "scan";
+    case Kind::Parse:          return "parse";
+    case Kind::Interface:      return "interface";
+    case Kind::UnionInterface: return "union-interface";
+    case Kind::Compile:        return "compile";
+    case Kind::Link:           return "link";
+  }
+  return "?";
+}
+
+
+} // namespace
@@ -0,0 +1,82 @@
+#pragma once
+#include "async.hh"
+#include "asynccanceler.hh"
+namespace rx {
+using std::string;
+struct BuildHistory;
+
+// Runs a set of build tasks in dependency order. Tasks whose dependencies have all succeeded are
+// started, up to `concurrency` at a time. When a task fails, the tasks that depend on it (directly
+// or not) are skipped while independent ones keep running, and the graph completes with the
+// first error once nothing more can run.
+//
+// Of the tasks that are ready to start, those at the head of the longest remaining chain of
+// dependent work go first, so that the critical path isn't held up by tasks that can just as well
+// run later. How long each task takes is estimated from a BuildHistory when one is set, and
+// measured durations are recorded to it.
+//
+// Tasks are started and completed on the loop thread of the graph's Async. A task does its actual
+// work wherever it likes, normally on an Executor, and reports back through `Done`, which must be
+// called on the loop thread but may be destroyed on any thread.
+//
+struct TaskGraph {
+  enum class Kind {
+    Scan,           // find a package's source files
+    Parse,          // parse source files and discover imports
+    Interface,      // build a package's interface PCH
+    UnionInterface, // build the PCH for a union of packages
+    Compile,        // compile a package's implementation
+    Link,           // link a product
+  };
+  using NodeID = uint32_t;
+  using Done = func<void(Error)>;
+  using Action = func<AsyncCanceler(Done&&)>;
+    // Starts a task and returns its canceler. Must call `Done` exactly once unless canceled.
+
+  explicit TaskGraph(Async&, size_t concurrency=0);
+    // 0 means the default concurrency
+  static void setDefaultConcurrency(size_t);
+    // Set the concurrency of graphs created with 0 from now on, which `rx -j N` does. 0 restores
+    // the initial default of one task per CPU executor thread.
+  TaskGraph(const TaskGraph&) = delete;
+  ~TaskGraph();
+
+  NodeID add(Kind, const string& name, Action&&, uint64_t sizeHint=0);
+    // Add a task. `name` identifies it in errors, traces and the build history. `sizeHint`, e.g.
+    // bytes of source, is used to estimate the duration of a task that has no history.
+
+  void depend(NodeID node, NodeID dependency);
+    // `node` runs only after `dependency` has succeeded
+
+  void setHistory(BuildHistory*);
+    // Estimate durations from and record them to `history`, which must outlive the run. Without
+    // a history, a task's size hint (or 1 when zero) is used as its estimated duration.
+
+  AsyncCanceler run(func<void(Error)>&&);
+    // Start running the graph. `cb` is called with the first error, if any, once every task has
+    // either completed or been skipped. Fails right away if there's a dependency cycle.
+    // Canceling cancels all running tasks, and `cb` will not be called.
+
+  size_t size() const;
+  static const char* kindName(Kind);
+
+private:
+  struct Imp; Imp* self;
+};
+
+/* Example
+
+TaskGraph g{Async::main()};
+auto parse = g.add(TaskGraph::Kind::Parse, "foo/bar", [](TaskGraph::Done&& done) {
+  return Executor::cpu().run(Async::main(), [done = std::move(done)]() mutable -> func<void()> {
+    auto err = parseStuff();
+    return [err, done = std::move(done)]{ done(err); };
+  });
+});
+auto pch = g.add(TaskGraph::Kind::Interface, "foo/bar", buildInterfaceAction);
+g.depend(pch, parse);
+auto canceler = g.run([](Error err) { ... });
+
+*/
+
+} // namespace
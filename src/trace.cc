@@ -0,0 +1,203 @@
+#include "trace.hh"
+#include "async.hh"
+
+namespace rx {
+namespace trace {
+using std::string;
+
+volatile bool _enabled = false;
+
+
+struct Event {
+  const char* cat;
+  const char* name;
+  uint64_t    queued;
+  uint64_t    start;
+  uint64_t    end;
+  string      detail;
+  bool        async; // not tied to the recording thread
+};
+
+
+struct Buffer {
+  // Events recorded by one thread. Only that thread appends, so the lock is uncontended except
+  // while `finish` is writing.
+  Buffer(uint32_t tid, const char* name) : tid{tid}, name{name} { uv_mutex_init(&mu); }
+  uv_mutex_t         mu;
+  uint32_t           tid;
+  const char*        name;
+  std::vector<Event> events;
+};
+
+
+static uv_once_t            gInitOnce = UV_ONCE_INIT;
+static uv_key_t             gBufferKey; // Buffer* of the calling thread
+static uv_key_t             gNameKey;   // const char* name of the calling thread
+static uv_mutex_t           gMu;        // guards the following
+static std::vector<Buffer*> gBuffers;
+static FILE*                gFile = nullptr;
+static uint64_t             gStartTime = 0;
+static volatile long        gNextAsyncID = 0;
+
+
+static void Init() {
+  uv_once(&gInitOnce, []{
+    uv_key_create(&gBufferKey);
+    uv_key_create(&gNameKey);
+    uv_mutex_init(&gMu);
+  });
+}
+
+
+static Buffer* ThreadBuffer() {
+  auto* buf = (Buffer*)uv_key_get(&gBufferKey);
+  if (buf == nullptr) {
+    auto* name = (const char*)uv_key_get(&gNameKey);
+    uv_mutex_lock(&gMu);
+    buf = new Buffer{(uint32_t)gBuffers.size() + 1, name};
+    gBuffers.push_back(buf);
+    uv_mutex_unlock(&gMu);
+    uv_key_set(&gBufferKey, (void*)buf);
+  }
+  return buf;
+}
+
+
+static void Append(Event&& ev) {
+  auto* buf = ThreadBuffer();
+  uv_mutex_lock(&buf->mu);
+  buf->events.emplace_back(std::move(ev));
+  uv_mutex_unlock(&buf->mu);
+}
+
+
+uint64_t now() {
+  return uv_hrtime();
+}
+
+
+bool start(const char* filename) {
+  Init();
+  uv_mutex_lock(&gMu);
+  bool ok = (gFile == nullptr);
+  if (ok) {
+    gFile = fopen(filename, "w");
+    ok = (gFile != nullptr);
+  }
+  if (ok) {
+    gStartTime = now();
+    _enabled = true;
+  }
+  uv_mutex_unlock(&gMu);
+  return ok;
+}
+
+
+void setThreadName(const char* name) {
+  Init();
+  uv_key_set(&gNameKey, (void*)name);
+  auto* buf = (Buffer*)uv_key_get(&gBufferKey);
+  if (buf != nullptr) {
+    buf->name = name;
+  }
+}
+
+
+void record(const char* cat, const char* name, uint64_t queued, uint64_t start, uint64_t end,
+            const char* detail)
+{
+  Append({cat, name, queued, start, end, detail ? string{detail} : string{}, false});
+}
+
+
+void recordAsync(const char* cat, const char* name, uint64_t start, uint64_t end,
+                 const char* detail)
+{
+  Append({cat, name, start, start, end, detail ? string{detail} : string{}, true});
+}
+
+
+static void WriteString(FILE* f, const char* s, size_t z) {
+  fputc('"', f);
+  for (size_t i = 0; i != z; ++i) {
+    auto c = (unsigned char)s[i];
+    switch (c) {
+      case '"':  fputs("\\\"", f); break;
+      case '\\': fputs("\\\\", f); break;
+      case '\n': fputs("\\n", f); break;
+      case '\t': fputs("\\t", f); break;
+      default: {
+        if (c < 0x20) {
+          fprintf(f, "\\u%04x", c);
+        } else {
+          fputc(c, f);
+        }
+      }
+    }
+  }
+  fputc('"', f);
+}
+
+
+static double Micros(uint64_t t) {
+  return (t < gStartTime) ? 0.0 : (double)(t - gStartTime) / 1000.0;
+}
+
+
+static void WriteEvent(FILE* f, const Event& ev, uint32_t tid) {
+  // Thread-bound events become complete ("X") events. Async ones become a begin/end pair, which
+  // tracing UIs group by `cat` and `name` rather than stacking them on the recording thread.
+  if (ev.async) {
+    auto id = __sync_add_and_fetch(&gNextAsyncID, 1);
+    fprintf(f, ",\n{\"ph\":\"b\",\"cat\":\"%s\",\"name\":\"%s\",\"id\":%ld,\"pid\":1,\"tid\":%u,"
+               "\"ts\":%.3f", ev.cat, ev.name, id, tid, Micros(ev.start));
+    if (!ev.detail.empty()) {
+      fputs(",\"args\":{\"detail\":", f);
+      WriteString(f, ev.detail.data(), ev.detail.size());
+      fputc('}', f);
+    }
+    fprintf(f, "},\n{\"ph\":\"e\",\"cat\":\"%s\",\"name\":\"%s\",\"id\":%ld,\"pid\":1,\"tid\":%u,"
+               "\"ts\":%.3f}", ev.cat, ev.name, id, tid, Micros(ev.end));
+    return;
+  }
+  fprintf(f, ",\n{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%u,"
+             "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"queued_us\":%.3f",
+             ev.cat, ev.name, tid, Micros(ev.start),
+             (double)(ev.end - ev.start) / 1000.0, (double)(ev.start - ev.queued) / 1000.0);
+  if (!ev.detail.empty()) {
+    fputs(",\"detail\":", f);
+    WriteString(f, ev.detail.data(), ev.detail.size());
+  }
+  fputs("}}", f);
+}
+
+
+bool finish() {
+  Init();
+  uv_mutex_lock(&gMu);
+  auto* f = gFile;
+  gFile = nullptr;
+  _enabled = false;
+  if (f != nullptr) {
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+          "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"rx\"}}", f);
+    for (auto* buf : gBuffers) {
+      uv_mutex_lock(&buf->mu);
+      if (buf->name != nullptr) {
+        fprintf(f, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{"
+                   "\"name\":\"%s\"}}", buf->tid, buf->name);
+      }
+      for (auto& ev : buf->events) {
+        WriteEvent(f, ev, buf->tid);
+      }
+      buf->events.clear();
+      uv_mutex_unlock(&buf->mu);
+    }
+    fputs("\n]}\n", f);
+  }
+  uv_mutex_unlock(&gMu);
+  return f != nullptr && fclose(f) == 0;
+}
+
+
+}} // namespace
@@ -0,0 +1,50 @@
+#pragma once
+namespace rx {
+namespace trace {
+
+// Records where time goes during a build: fs requests, executor tasks, AsyncGroup jobs and
+// compiler phases. Enabled with `rx --trace=FILE` or RX_TRACE=FILE. The result is written in the
+// Chrome trace event format, which can be opened in chrome://tracing or ui.perfetto.dev.
+//
+// When tracing is off, instrumented code pays for a single load and branch. When on, each thread
+// appends to its own buffer, so threads don't contend with each other while recording.
+//
+// Timestamps are in nanoseconds from an arbitrary point, as returned by `now`.
+
+extern volatile bool _enabled;
+inline bool enabled() { return _enabled; }
+
+bool start(const char* filename);
+  // Start recording. The trace is written to `filename` by `finish`. Returns false if the file
+  // can't be created.
+bool finish();
+  // Stop recording and write the trace. Returns false if tracing wasn't started or if writing
+  // failed.
+
+uint64_t now();
+
+void setThreadName(const char* name);
+  // Label the calling thread in the trace. `name` must outlive the trace, e.g. a string literal.
+
+void record(const char* cat, const char* name, uint64_t queued, uint64_t start, uint64_t end,
+            const char* detail=nullptr);
+  // Record work that ran on the calling thread from `start` to `end` after waiting to run since
+  // `queued`. `cat` and `name` must be string literals; `detail` is copied.
+void recordAsync(const char* cat, const char* name, uint64_t start, uint64_t end,
+                 const char* detail=nullptr);
+  // Record a span that isn't tied to a thread, like an fs request waiting in libuv's pool or an
+  // AsyncGroup job. These are drawn on their own tracks, since they overlap freely.
+
+struct Scope {
+  // Records the lifetime of the scope on the calling thread. `detail` must outlive the scope.
+  //   trace::Scope ts{"compiler", "buildPkgInterface", pkg.name().c_str()};
+  Scope(const char* cat, const char* name, const char* detail=nullptr)
+    : cat{cat}, name{name}, detail{detail}, start{enabled() ? now() : 0} {}
+  ~Scope() { if (start != 0 && enabled()) record(cat, name, start, start, now(), detail); }
+  const char* cat;
+  const char* name;
+  const char* detail;
+  uint64_t    start;
+};
+
+}} // namespace
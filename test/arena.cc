@@ -0,0 +1,61 @@
+#include "test.hh"
+#include "arena.hh"
+
+using std::string;
+using namespace rx;
+
+int main(int argc, const char** argv) {
+
+  { // ==== allocations are aligned and don't overlap ====
+    Arena arena{256};
+    char* prev = nullptr;
+    for (size_t i = 0; i != 1000; ++i) {
+      auto* p = (char*)arena.alloc(1 + i % 13, 8);
+      A(((uintptr_t)p & 7) == 0);
+      memset(p, (int)i, 1 + i % 13);
+      A(p != prev);
+      prev = p;
+    }
+    auto* d = (double*)arena.alloc(sizeof(double), alignof(double));
+    *d = 1.5;
+    A(arena.allocated() >= 1000);
+    A(arena.reserved() >= arena.allocated());
+  }
+
+  { // ==== large allocations get a chunk of their own ====
+    Arena arena{1024};
+    auto* a = (char*)arena.alloc(16);
+    auto* big = (char*)arena.alloc(100000);
+    memset(big, 1, 100000);
+    auto* b = (char*)arena.alloc(16);
+    A(b == a + 16); // still bumping in the first chunk
+  }
+
+  { // ==== reset keeps the largest chunk ====
+    Arena arena{1024};
+    for (int i = 0; i != 100; ++i) arena.alloc(100);
+    auto reserved = arena.reserved();
+    arena.reset();
+    A(arena.allocated() == 0);
+    A(arena.reserved() != 0 && arena.reserved() < reserved);
+    auto r = arena.reserved();
+    arena.alloc(100);
+    A(arena.reserved() == r); // reused
+  }
+
+  { // ==== containers and strings ====
+    Arena arena;
+    std::set<int, std::less<int>, ArenaAllocator<int>> set{&arena};
+    for (int i = 0; i != 100; ++i) set.insert(99 - i);
+    A(set.size() == 100 && *set.begin() == 0);
+    ArenaString s{"a rather long string which doesn't fit inline", &arena};
+    s += " and then some";
+    A(s.size() == 59);
+    A(s == "a rather long string which doesn't fit inline and then some");
+    A(arena.allocated() != 0);
+    ArenaString heap{"also a rather long string, allocated on the heap"};
+    A(heap.get_allocator().arena == nullptr);
+  }
+
+  return 0;
+}
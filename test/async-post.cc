@@ -0,0 +1,119 @@
+#include "test.hh"
+#include "async.hh"
+#include <sched.h>
+
+using namespace rx;
+
+// Stress test of Async::post: producers on several threads post to a loop that drains them.
+// A lost wakeup would leave the loop waiting forever, so a watchdog timer fails the test when no
+// post has been received for a while.
+
+static const size_t kProducers = 8;
+
+struct Consumer {
+  Async*   async;
+  size_t   expected;      // total number of posts to receive
+  size_t   received = 0;
+  size_t   receivedAtLastTick = 0; // for the watchdog
+  uint64_t next[kProducers] = {}; // next sequence number expected from each producer
+  volatile uint64_t acked[kProducers] = {}; // last sequence number run, read by the producers
+
+  void receive(size_t producer, uint64_t seq) {
+    // Runs on the loop's thread
+    A(producer < kProducers);
+    A(seq == next[producer]); // in the order posted by each producer
+    next[producer] = seq + 1;
+    __atomic_store_n(&acked[producer], seq + 1, __ATOMIC_RELEASE);
+    if (++received == expected) {
+      async->unref();
+    }
+  }
+};
+
+struct Producer {
+  Consumer*   c;
+  size_t      id;
+  size_t      count;
+  bool        pingPong; // wait for each post to run before posting the next one
+  uv_thread_t thread;
+};
+
+static void ProducerMain(void* arg) {
+  auto& p = *(Producer*)arg;
+  auto* c = p.c;
+  auto id = p.id;
+  for (uint64_t seq = 0; seq != p.count; ++seq) {
+    c->async->post([=]{ c->receive(id, seq); });
+    if (p.pingPong) {
+      // Every post finds the loop idle (or about to be), so each one depends on its wakeup
+      while (__atomic_load_n(&c->acked[id], __ATOMIC_ACQUIRE) != seq + 1) {
+        sched_yield();
+      }
+    }
+  }
+}
+
+static void Watchdog(uv_timer_t* t) {
+  auto* c = (Consumer*)t->data;
+  if (c->received == c->receivedAtLastTick) {
+    fprintf(stderr, "lost wakeup? received %zu of %zu posts\n", c->received, c->expected);
+    A(false);
+  }
+  c->receivedAtLastTick = c->received;
+}
+
+static void Run(size_t count, bool pingPong) {
+  Async a;
+  Consumer c;
+  c.async = &a;
+  c.expected = count * kProducers;
+
+  uv_timer_t watchdog;
+  uv_timer_init(a.uvloop(), &watchdog);
+  watchdog.data = &c;
+  uv_timer_start(&watchdog, Watchdog, 10 * 1000, 10 * 1000);
+  uv_unref((uv_handle_t*)&watchdog);
+
+  a.ref(); // until all posts have been received
+  Producer producers[kProducers];
+  for (size_t i = 0; i != kProducers; ++i) {
+    producers[i] = Producer{&c, i, count, pingPong, {}};
+    A(uv_thread_create(&producers[i].thread, ProducerMain, &producers[i]) == 0);
+  }
+  a.run();
+  for (auto& p : producers) {
+    uv_thread_join(&p.thread);
+  }
+
+  A(c.received == c.expected);
+  for (size_t i = 0; i != kProducers; ++i) {
+    A(c.next[i] == count);
+  }
+  uv_timer_stop(&watchdog);
+  uv_close((uv_handle_t*)&watchdog, nullptr);
+  uv_run(a.uvloop(), UV_RUN_NOWAIT);
+}
+
+int main(int argc, const char** argv) {
+  // ==== Bursts: all producers post as fast as they can ====
+  Run(200000, false);
+
+  // ==== Ping-pong: each post has to wake up the loop ====
+  Run(20000, true);
+
+  // ==== Posts queued before the loop runs ====
+  {
+    Async a;
+    int n = 0;
+    for (int i = 0; i != 100; ++i) {
+      a.post([&n, i]{ A(n == i); ++n; });
+    }
+    A(n == 0);
+    a.ref();
+    a.post([&]{ a.unref(); });
+    a.run();
+    A(n == 100);
+  }
+
+  return 0;
+}
@@ -0,0 +1,157 @@
+#include "test.hh"
+#include "asyncgroup.hh"
+#include "uv/uv.h"
+
+using std::string;
+using namespace rx;
+
+struct Counter {
+  volatile long n = 0;
+  void inc() { __sync_add_and_fetch(&n, 1L); }
+  long get() const { return __atomic_load_n(&n, __ATOMIC_SEQ_CST); }
+};
+
+
+struct Worker {
+  // Begins, assigns a canceler to and ends `count` jobs, checking that no canceler is called twice
+  AsyncGroup* G;
+  size_t      count;
+  Counter*    canceled;
+  uv_thread_t thread;
+};
+
+static void WorkerMain(void* arg) {
+  auto& w = *(Worker*)arg;
+  auto& G = *w.G;
+  for (size_t i = 0; i != w.count; ++i) {
+    auto job = G.begin();
+    auto* called = new volatile long{0};
+    auto* canceled = w.canceled;
+    G[job] = [=]{
+      A(__sync_add_and_fetch(called, 1L) == 1);
+      canceled->inc();
+    };
+    if (i % 3 == 0) {
+      G[job] = [=]{ // replacing the canceler doesn't call the old one
+        A(__sync_add_and_fetch(called, 1L) == 1);
+        canceled->inc();
+      };
+    }
+    G.end(job);
+    G.end(job); // ending twice has no effect
+    G[job] = []{ A(false); }; // too late
+    delete called;
+  }
+}
+
+
+int main(int argc, const char** argv) {
+
+  { // ==== A handle outlives its job, and its slot is reused ====
+    Counter done;
+    Error doneErr;
+    AsyncGroup G{[&](Error err) { done.inc(); doneErr = err; }};
+    auto j0 = G.begin(); // keeps the group going
+    auto j1 = G.begin();
+    G.end(j1);
+    auto j2 = G.begin();
+    A(j2._index == j1._index && j2._gen != j1._gen); // same slot, new generation
+
+    Counter stale, current;
+    G[j1] = [&]{ stale.inc(); };
+    G[j2] = [&]{ current.inc(); };
+    G.end(j1); // doesn't end j2
+    A(done.get() == 0);
+
+    A(G.cancel());
+    A(stale.get() == 0);
+    A(current.get() == 1);
+    A(done.get() == 0);
+    G.end(j2);
+    G.end(j0);
+    A(done.get() == 0); // not called once canceled
+  }
+
+  { // ==== A canceler assigned after the group was canceled is called right away ====
+    AsyncGroup G{[](Error) { A(false); }};
+    auto job = G.begin();
+    A(G.cancel());
+    A(!G.cancel());
+    Counter c;
+    G[job] = [&]{ c.inc(); };
+    A(c.get() == 1);
+    G.end(job);
+  }
+
+  { // ==== An error ends the group and cancels the other jobs ====
+    Counter done, c;
+    Error doneErr;
+    AsyncGroup G{[&](Error err) { done.inc(); doneErr = err; }};
+    auto j1 = G.begin();
+    auto j2 = G.begin();
+    G[j2] = [&]{ c.inc(); };
+    G.end(j1, Error{"boom"});
+    A(done.get() == 1 && strcmp(doneErr.message(), "boom") == 0);
+    A(c.get() == 1);
+    G.end(j2);
+    A(done.get() == 1);
+  }
+
+  { // ==== 100k jobs in flight at once ====
+    const size_t N = 100000;
+    Counter done;
+    Error doneErr{"not called"};
+    {
+      AsyncGroup G{[&](Error err) { done.inc(); doneErr = err; }};
+      std::vector<AsyncGroup::Job> jobs;
+      jobs.reserve(N);
+      for (size_t i = 0; i != N; ++i) {
+        jobs.push_back(G.begin());
+        G[jobs.back()] = []{ A(false); };
+      }
+      for (size_t i = 0; i != N; ++i) {
+        A(done.get() == 0);
+        G.end(jobs[N - 1 - i]);
+      }
+      A(done.get() == 1 && !doneErr);
+
+      // Slots are reused rather than the slab growing
+      auto job = G.begin();
+      bool reused = false;
+      for (auto& j : jobs) reused = reused || (j._index == job._index);
+      A(reused);
+      G.end(job);
+    }
+    A(done.get() == 1);
+  }
+
+  { // ==== Concurrent begin, end and cancel from several threads ====
+    const size_t kThreads = 8;
+    const size_t kJobs = 20000;
+    for (int round = 0; round != 2; ++round) {
+      bool cancelMidway = (round == 1);
+      Counter done, canceled;
+      AsyncGroup G{[&](Error err) { A(!err); done.inc(); }};
+      auto sentinel = G.begin(); // keeps the group from ending whenever no job happens to be active
+      Worker workers[kThreads];
+      for (auto& w : workers) {
+        w = Worker{&G, kJobs, &canceled, {}};
+        A(uv_thread_create(&w.thread, WorkerMain, &w) == 0);
+      }
+      if (cancelMidway) {
+        A(G.cancel());
+      }
+      for (auto& w : workers) {
+        uv_thread_join(&w.thread);
+      }
+      A(done.get() == 0);
+      G.end(sentinel);
+      A(done.get() == (cancelMidway ? 0 : 1));
+      if (!cancelMidway) {
+        A(canceled.get() == 0);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include "test.hh"
+#include "asyncsemaphore.hh"
+#include "executor.hh"
+
+using std::string;
+using namespace rx;
+using Release = AsyncSemaphore::Release;
+
+struct Op {
+  // An operation started through the semaphore, completed by calling `release`
+  Release release;
+  bool    started = false;
+  bool    canceled = false;
+};
+
+static AsyncCanceler Start(AsyncSemaphore& sem, Op& op) {
+  return sem.run([&op](Release&& release) {
+    op.started = true;
+    op.release = std::move(release);
+    return [&op]{ op.canceled = true; };
+  });
+}
+
+int main(int argc, const char** argv) {
+
+  { // ==== operations beyond the limit wait and start in order ====
+    AsyncSemaphore sem{2};
+    Op ops[4];
+    AsyncCanceler cancelers[4];
+    for (int i = 0; i != 4; ++i) cancelers[i] = Start(sem, ops[i]);
+    A(ops[0].started && ops[1].started && !ops[2].started && !ops[3].started);
+    A(sem.inflight() == 2 && sem.waiting() == 2);
+    ops[1].release();
+    A(ops[2].started && !ops[3].started);
+    ops[1].release(); // releasing twice has no effect
+    A(!ops[3].started);
+    A(sem.inflight() == 2 && sem.waiting() == 1);
+    ops[0].release();
+    ops[2].release();
+    ops[3].release();
+    A(ops[3].started);
+    A(sem.inflight() == 0 && sem.waiting() == 0);
+    for (auto& op : ops) A(!op.canceled);
+  }
+
+  { // ==== operations that complete right away ====
+    AsyncSemaphore sem{1};
+    size_t n = 0;
+    for (int i = 0; i != 10000; ++i) {
+      sem.run([&](Release&& release) {
+        ++n;
+        release();
+        return AsyncCanceler{};
+      });
+    }
+    A(n == 10000);
+    A(sem.inflight() == 0 && sem.waiting() == 0);
+  }
+
+  { // ==== canceling ====
+    AsyncSemaphore sem{1};
+    Op a, b, c;
+    auto ca = Start(sem, a);
+    auto cb = Start(sem, b);
+    auto cc = Start(sem, c);
+    cb(); // waiting: never started
+    A(sem.waiting() == 1);
+    ca(); // started: its canceler is called and its slot is released
+    A(a.canceled);
+    A(!b.started && c.started);
+    A(sem.inflight() == 1 && sem.waiting() == 0);
+    a.release(); // late release of a canceled operation has no effect
+    A(sem.inflight() == 1);
+    c.release();
+    cc(); // canceling a completed operation has no effect
+    A(!c.canceled);
+    A(sem.inflight() == 0);
+  }
+
+  { // ==== a release may be dropped on another thread ====
+    // Operations capture their release in closures that may be destroyed on whichever thread
+    // drops them, e.g. the work closure of an Executor request which is canceled before it runs.
+    AsyncSemaphore sem{4};
+    for (int i = 0; i != 1000; ++i) {
+      auto canceler = sem.run([](Release&& release) {
+        return Executor::io().run(Async::main(), [release = std::move(release)]() mutable {
+          return std::move(release);
+        });
+      });
+      canceler();
+    }
+    Async::main().run();
+    A(sem.inflight() == 0 && sem.waiting() == 0);
+  }
+
+  return 0;
+}
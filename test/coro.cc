@@ -0,0 +1,59 @@
+#include "test.hh"
+#include "coro.hh"
+
+// Only built for real with a compiler that supports coroutines; otherwise there's nothing to test
+
+#if RX_HAVE_COROUTINES
+using std::string;
+using namespace rx;
+
+static AsyncTask ReadSelf(Async& a, string path, int& step, string& text) {
+  fs::Stat st;
+  auto err = co_await fs::statAsync(a, path, st);
+  A(!err && st.isFile());
+  step = 1;
+  fs::FileData d;
+  err = co_await fs::readfileAsync(a, path, st.size, d);
+  A(!err && d.size() == st.size);
+  text.assign(d.data(), d.size());
+  step = 2;
+  err = co_await fs::readfileAsync(a, path + ".nope", d);
+  A(err.code() == (Error::Code)UV_ENOENT);
+  step = 3;
+}
+
+static AsyncTask ReadCanceled(Async& a, string path, int& step) {
+  fs::FileData d;
+  step = 1;
+  auto err = co_await fs::readfileAsync(a, path, d);
+  step = 2; // never reached
+}
+
+int main(int argc, const char** argv) {
+  auto& a = Async::main();
+
+  { // ==== stat, then read on the I/O executor ====
+    int step = 0;
+    string text;
+    auto cancel = ReadSelf(a, "coro.cc", step, text).start();
+    a.run();
+    A(step == 3);
+    A(text.find("RX_HAVE_COROUTINES") != string::npos);
+  }
+
+  { // ==== Canceling a pending read destroys the coroutine without resuming it ====
+    int step = 0;
+    auto cancel = ReadCanceled(a, "coro.cc", step).start();
+    A(step == 1);
+    cancel();
+    cancel(); // no-op
+    a.run();
+    A(step == 1);
+  }
+
+  return 0;
+}
+
+#else
+int main() { return 0; }
+#endif
@@ -0,0 +1,54 @@
+#include "test.hh"
+#include "deps.hh"
+#include "pkgiface.hh"
+
+using std::string;
+using namespace rx;
+
+static Error Resolve(const string& pkgDir, const char* pkg, DepsDB& db) {
+  Error result{"not called"};
+  PkgDeps deps{"../rxdir", pkgDir, Pkg{pkg}, [&](Error err) { result = err; }};
+  deps.setDB(&db);
+  deps.resolve();
+  Async::main().run();
+  return result;
+}
+
+int main(int argc, const char** argv) {
+  const char* tmpdir = getenv("TMPDIR");
+  string pkgDir = string{tmpdir ? tmpdir : "/tmp"} + "/rx-test-deps-" + std::to_string(getpid());
+
+  { // ==== A package with an .rx file written in C++ (glass.rx uses #package and #import) ====
+    DepsDB db;
+    auto err = Resolve(pkgDir, "foo/bar/util", db);
+    if (err) fprintf(stdout, "resolve: %s\n", err.message());
+    A(!err);
+
+    // Both files are recorded along with their imports
+    std::vector<const DepsDB::File*> files;
+    for (auto& pathname : db.pathnames("foo/bar/util")) {
+      files.push_back(db.file(pathname));
+      if (strstr(pathname.c_str(), "glass.rx")) {
+        A(files.back()->imports.size() == 1 && files.back()->imports[0] == "std");
+      }
+    }
+    A(files.size() == 2);
+    A(db.package("foo/bar/util"));
+
+    // The interface is made from util.rx only
+    PkgInterface iface;
+    A(!iface.open(pkgDir + "/foo/bar/util.rxi"));
+    A(iface.size() == 1);
+    A(iface.lookup("ImportanceOfLOL"));
+    A(!iface.lookup("Glass"));
+
+    // Nothing has changed the second time around
+    A(!Resolve(pkgDir, "foo/bar/util", db));
+    unlink((pkgDir + "/foo/bar/util.rxi").c_str());
+    rmdir((pkgDir + "/foo/bar").c_str());
+    rmdir((pkgDir + "/foo").c_str());
+    rmdir(pkgDir.c_str());
+  }
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include "test.hh"
+#include "depsdb.hh"
+
+using std::string;
+using namespace rx;
+
+static DepsDB::File MakeFile(uint64_t ino, uint64_t size, std::vector<string> imports) {
+  DepsDB::File f;
+  f.id = fs::FileID{1, ino};
+  f.size = size;
+  f.mtime = Time{(uint64_t)1400000000000000ull + ino};
+  hash::murmur3_128(std::to_string(ino) + ":" + std::to_string(size), f.contentHash);
+  f.imports = std::move(imports);
+  return f;
+}
+
+static DepsDB::Package MakePkg(const string& s) {
+  DepsDB::Package pkg;
+  hash::murmur3_128(s, pkg.interfaceHash);
+  pkg.artifacts = {s + ".pch", s + ".a"};
+  return pkg;
+}
+
+static uint64_t FileSize(const string& filename) {
+  fs::Stat st;
+  A(!fs::stat(filename, st));
+  return st.size;
+}
+
+int main(int argc, const char** argv) {
+  const char* tmpdir = getenv("TMPDIR");
+  string filename = string{tmpdir ? tmpdir : "/tmp"} + "/rx-test-depsdb-" +
+                    std::to_string(getpid());
+  unlink(filename.c_str());
+
+  { // ==== A missing file loads as an empty database ====
+    DepsDB db;
+    A(!db.load(filename));
+    A(db.fileCount() == 0 && db.packageCount() == 0 && !db.dirty());
+    A(!db.save(filename)); // nothing to save
+    fs::Stat st;
+    A(fs::stat(filename, st).code() == (Error::Code)UV_ENOENT);
+  }
+
+  { // ==== Records survive a save and load ====
+    DepsDB db;
+    A(!db.load(filename));
+    db.putFile("foo/bar/bar.rx", MakeFile(10, 100, {"foo/cat", "std"}));
+    db.putFile("foo/bar/bar.cc", MakeFile(11, 200, {}));
+    db.putFile("foo/cat/cat.rx", MakeFile(12, 300, {"std"}));
+    db.putPackage("foo/bar", MakePkg("foo/bar"));
+    A(db.dirty());
+    A(!db.save(filename));
+    A(!db.dirty());
+    A(FileSize(filename) == db.logSize());
+
+    DepsDB db2;
+    A(!db2.load(filename));
+    A(db2.fileCount() == 3 && db2.packageCount() == 1);
+    auto* f = db2.file("foo/bar/bar.rx");
+    A(f != nullptr && *f == MakeFile(10, 100, {"foo/cat", "std"}));
+    A(f->matches(fs::FileID{1, 10}, 100, f->mtime));
+    A(!f->matches(fs::FileID{1, 10}, 101, f->mtime));
+    A(!f->matches(fs::FileID{2, 10}, 100, f->mtime));
+    A(db2.file("foo/bar/nope.rx") == nullptr);
+    A(db2.package("foo/bar") && *db2.package("foo/bar") == MakePkg("foo/bar"));
+    A((db2.pathnames("foo/bar") == std::vector<string>{"foo/bar/bar.cc", "foo/bar/bar.rx"}));
+    A(db2.pathnames("foo").empty());
+    A(!db2.dirty());
+  }
+
+  { // ==== Changes are appended, and putting an unchanged record appends nothing ====
+    DepsDB db;
+    A(!db.load(filename));
+    auto size1 = FileSize(filename);
+    db.putFile("foo/bar/bar.rx", MakeFile(10, 100, {"foo/cat", "std"}));
+    db.putPackage("foo/bar", MakePkg("foo/bar"));
+    A(!db.dirty());
+    db.putFile("foo/bar/bar.rx", MakeFile(10, 150, {"std"}));
+    db.removeFile("foo/bar/bar.cc");
+    db.removeFile("foo/bar/bar.cc"); // already gone
+    A(db.garbageSize() > 0);
+    A(!db.save(filename));
+    A(FileSize(filename) > size1);
+    A(FileSize(filename) == db.logSize());
+
+    DepsDB db2;
+    A(!db2.load(filename));
+    A(db2.fileCount() == 2);
+    A(db2.file("foo/bar/bar.cc") == nullptr);
+    A(*db2.file("foo/bar/bar.rx") == MakeFile(10, 150, {"std"}));
+    A(db2.garbageSize() == db.garbageSize());
+
+    // Compacting drops the replaced records
+    A(!db2.compact(filename));
+    A(db2.garbageSize() == 0 && FileSize(filename) < db.logSize());
+    DepsDB db3;
+    A(!db3.load(filename));
+    A(db3.fileCount() == 2 && *db3.file("foo/bar/bar.rx") == MakeFile(10, 150, {"std"}));
+  }
+
+  { // ==== A partly written record at the end is dropped, and overwritten by the next save ====
+    DepsDB db;
+    A(!db.load(filename));
+    auto size1 = FileSize(filename);
+    db.putFile("foo/baz/baz.rx", MakeFile(20, 400, {"foo/bar"}));
+    A(!db.save(filename));
+    A(truncate(filename.c_str(), (off_t)(FileSize(filename) - 5)) == 0);
+
+    DepsDB db2;
+    A(!db2.load(filename));
+    A(db2.file("foo/baz/baz.rx") == nullptr);
+    A(db2.fileCount() == 2);
+    A(db2.logSize() == size1);
+    db2.putFile("foo/qux/qux.rx", MakeFile(21, 500, {}));
+    A(!db2.save(filename));
+    A(FileSize(filename) == db2.logSize());
+
+    DepsDB db3;
+    A(!db3.load(filename));
+    A(db3.fileCount() == 3 && db3.file("foo/qux/qux.rx") != nullptr);
+  }
+
+  { // ==== A corrupt record ends the log ====
+    DepsDB db;
+    string s{"rxdeps\0\1", 8};
+    s.append(16, '\xff');
+    A(!fs::writefile(filename, s.data(), s.size(), fs::FSync::None));
+    A(!db.load(filename));
+    A(db.fileCount() == 0);
+  }
+
+  { // ==== The log is compacted once it's mostly replaced records ====
+    DepsDB db;
+    A(!db.load(filename));
+    for (uint64_t i = 0; i != 2000; ++i) {
+      db.putFile("foo/bar/bar.rx", MakeFile(10, i, {"std"}));
+      A(!db.save(filename));
+    }
+    A(db.fileCount() == 1);
+    A(db.garbageSize() < db.logSize());
+    A(FileSize(filename) == db.logSize());
+    A(FileSize(filename) < 200 * 1024);
+    DepsDB db2;
+    A(!db2.load(filename));
+    A(*db2.file("foo/bar/bar.rx") == MakeFile(10, 1999, {"std"}));
+  }
+
+  unlink(filename.c_str());
+  return 0;
+}
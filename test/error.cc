@@ -0,0 +1,53 @@
+#include "test.hh"
+#include "async.hh"
+
+using std::string;
+using namespace rx;
+
+int main(int argc, const char** argv) {
+
+  { // ==== OK ====
+    Error e;
+    A(e.ok() && !e);
+    A(e.code() == 0);
+    A(strcmp(e.message(), "") == 0);
+    A(Error{nullptr}.ok());
+  }
+
+  { // ==== code only ====
+    Error e{UV_ENOENT};
+    A(!e.ok() && e);
+    A(e.code() == (Error::Code)UV_ENOENT);
+    A(strcmp(e.message(), uv_strerror(UV_ENOENT)) == 0);
+    A(UVError(UV_ENOENT).code() == e.code());
+    A(!UVError(0));
+    Error e2{42};
+    A(e2.code() == 42 && strcmp(e2.message(), "") == 0);
+    A(Error{0}); // an error, even though its code is zero
+  }
+
+  { // ==== static message ====
+    static const Error::Static kBoom{7, "boom"};
+    Error e = kBoom;
+    A(e && e.code() == 7 && strcmp(e.message(), "boom") == 0);
+    Error e2 = e;
+    A(e2.message() == e.message());
+  }
+
+  { // ==== dynamic message, shared by copies ====
+    Error e{3, string{"dynamic "} + "message"};
+    A(e.code() == 3 && strcmp(e.message(), "dynamic message") == 0);
+    Error copy = e;
+    A(copy.message() == e.message());
+    Error moved = std::move(copy);
+    A(!copy && moved.message() == e.message());
+    e = Error{UV_EIO};
+    A(strcmp(moved.message(), "dynamic message") == 0);
+    moved = moved;
+    A(strcmp(moved.message(), "dynamic message") == 0);
+    Error str{"just a message"};
+    A(str.code() == 0 && strcmp(str.message(), "just a message") == 0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "test.hh"
+#include "fs.hh"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using namespace rx;
+
+int main(int argc, const char** argv) {
+
+  #define A_Path(path, expected) A(strcmp((path).c_str(), expected) == 0 && \
+                                   (path).size() == strlen(expected))
+
+  { // ==== append and concat ====
+    fs::Path p{"rxdir"};
+    p.append("src").append(string{"foo/bar"});
+    A_Path(p, "rxdir/src/foo/bar");
+    p.append("").concat(".pch");
+    A_Path(p, "rxdir/src/foo/bar.pch");
+
+    fs::Path p2;
+    A(p2.empty());
+    p2.append("").append("a");
+    A_Path(p2, "a");
+
+    fs::Path p3{"/"};
+    p3.append("usr");
+    A_Path(p3, "/usr");
+    A(p3.str() == "/usr");
+  }
+
+  { // ==== truncate ====
+    fs::Path p{"a/b"};
+    auto z = p.size();
+    p.append("c.rx");
+    A_Path(p, "a/b/c.rx");
+    p.truncate(z);
+    A_Path(p, "a/b");
+  }
+
+  { // ==== parent ====
+    fs::Path p{"a/b/c"};
+    p.parent(); A_Path(p, "a/b");
+    p.parent(); A_Path(p, "a");
+    p.parent(); A_Path(p, "");
+    fs::Path p2{"/a"};
+    p2.parent(); A_Path(p2, "/");
+    fs::Path p3{"a/b/"};
+    p3.parent(); A_Path(p3, "a");
+  }
+
+  { // ==== basename and extension ====
+    fs::Path p{"foo.app/bar.lol.baz"};
+    A(strcmp(p.basename(), "bar.lol.baz") == 0);
+    A(strcmp(p.extension(), "baz") == 0);
+    A(strcmp(fs::Path{"a.b/c"}.extension(), "") == 0);
+    A(strcmp(fs::Path{".profile"}.extension(), "") == 0);
+    A(strcmp(fs::Path{"nothing"}.basename(), "nothing") == 0);
+  }
+
+  { // ==== overflow ====
+    string component(200, 'x');
+    fs::Path p{"root"};
+    while (!p.overflow()) p.append(component);
+    A(p.size() == PATH_MAX - 1);
+    A(p.c_str()[p.size()] == 0);
+    A(p.error().code() == (Error::Code)UV_ENAMETOOLONG);
+    fs::Stat st;
+    A(fs::stat(p, st).code() == (Error::Code)UV_ENAMETOOLONG);
+    p.truncate(4);
+    A(!p.overflow());
+    A(!p.error());
+  }
+
+  { // ==== copy ====
+    fs::Path a{"x/y"};
+    fs::Path b{a};
+    b.append("z");
+    A_Path(a, "x/y");
+    A_Path(b, "x/y/z");
+    a = b;
+    A_Path(a, "x/y/z");
+  }
+
+  return 0;
+}
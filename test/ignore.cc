@@ -0,0 +1,96 @@
+#include "test.hh"
+#include "ignore.hh"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using namespace rx;
+using Kind = fs::IgnoreRules::Kind;
+using Match = fs::IgnoreRules::Match;
+
+int main(int argc, const char** argv) {
+
+  #define A_Match(rules, path, kind, expected) \
+    A(rules.match(path, Kind::kind) == Match::expected)
+
+  { // ==== Literals, suffixes and prefixes ====
+    const char* src =
+      "# comment\n"
+      "\n"
+      "node_modules\n"
+      "*.o\n"
+      "tmp*\n"
+    ;
+    fs::IgnoreRules rules; rules.parse(src, strlen(src));
+    A_Match(rules, "node_modules", Unknown, Ignore);
+    A_Match(rules, "a/b/node_modules", Unknown, Ignore);
+    A_Match(rules, "node_modules2", Unknown, Keep);
+    A_Match(rules, "bar.o", File, Ignore);
+    A_Match(rules, "x/bar.o", File, Ignore);
+    A_Match(rules, "bar.oo", File, Keep);
+    A_Match(rules, "tmpfile", File, Ignore);
+    A_Match(rules, "x/tmp", File, Ignore);
+    A_Match(rules, "# comment", File, Keep);
+    A_Match(rules, "bar.cc", Unknown, Keep);
+  }
+
+  { // ==== Directory-only and anchored patterns ====
+    const char* src =
+      "gen/\n"
+      "/build\n"
+      "docs/*.png\n"
+    ;
+    fs::IgnoreRules rules; rules.parse(src, strlen(src));
+    A_Match(rules, "gen", Unknown, Unknown);
+    A_Match(rules, "gen", Dir, Ignore);
+    A_Match(rules, "gen", File, Keep);
+    A_Match(rules, "a/gen", Dir, Ignore);
+    A_Match(rules, "build", Unknown, Ignore);
+    A_Match(rules, "a/build", Unknown, Keep);
+    A_Match(rules, "docs/x.png", File, Ignore);
+    A_Match(rules, "docs/a/x.png", File, Keep);
+    A_Match(rules, "a/docs/x.png", File, Keep);
+  }
+
+  { // ==== Globs ====
+    const char* src =
+      "data/**/*.bin\n"
+      "**/cache\n"
+      "v[0-9]?.rx\n"
+      "[!a]z\n"
+    ;
+    fs::IgnoreRules rules; rules.parse(src, strlen(src));
+    A_Match(rules, "data/x.bin", File, Ignore);
+    A_Match(rules, "data/a/b/x.bin", File, Ignore);
+    A_Match(rules, "datax.bin", File, Keep);
+    A_Match(rules, "cache", Dir, Ignore);
+    A_Match(rules, "a/b/cache", Dir, Ignore);
+    A_Match(rules, "v1a.rx", File, Ignore);
+    A_Match(rules, "vxa.rx", File, Keep);
+    A_Match(rules, "bz", File, Ignore);
+    A_Match(rules, "az", File, Keep);
+  }
+
+  { // ==== Negations: the last match wins ====
+    const char* src =
+      "*.rx\n"
+      "!keep.rx\n"
+      "out/\n"
+      "!out\n"
+    ;
+    fs::IgnoreRules rules; rules.parse(src, strlen(src));
+    A_Match(rules, "a.rx", File, Ignore);
+    A_Match(rules, "keep.rx", File, Keep);
+    A_Match(rules, "x/keep.rx", File, Keep);
+    A_Match(rules, "out", Unknown, Keep);
+    A_Match(rules, "out", Dir, Keep);
+  }
+
+  { // ==== Empty rules ====
+    fs::IgnoreRules rules;
+    A(rules.empty());
+    A_Match(rules, "anything", Unknown, Keep);
+  }
+
+  return 0;
+}
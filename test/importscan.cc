@@ -0,0 +1,63 @@
+#include "test.hh"
+#include "importscan.hh"
+
+using std::string;
+using namespace rx;
+
+static importscan::Result Scan(const string& src, Error* errOut=nullptr) {
+  importscan::Result r;
+  auto err = importscan::scan(src.data(), src.size(), r);
+  if (errOut) *errOut = err; else A(!err);
+  return r;
+}
+
+int main(int argc, const char** argv) {
+
+  { // ==== .rx declarations ====
+    auto r = Scan("package bar\n\nimport \"foo/bar/util\"\n\n0\n42\nimport \"not/me\"\n");
+    A(r.package == "bar");
+    A(r.imports.size() == 1 && r.imports[0] == "foo/bar/util");
+    A(r.end == 36); // at "0"
+    A(!r.directives);
+  }
+
+  { // ==== C++ directives ====
+    auto r = Scan("#package bar\n#import std\n#import foo/cat\n\nint DrinksNeeded(int n) {}\n");
+    A(r.package == "bar");
+    A(r.imports.size() == 2 && r.imports[0] == "std" && r.imports[1] == "foo/cat");
+    A(r.directives);
+  }
+
+  { // ==== comments, whitespace and semicolons ====
+    string src = "/* A long license header\n" + string(100, '*') + "\n*/\n" +
+                 string(40, ' ') + "// line comment\n\t\r\n" +
+                 "package a; import \"x\"; import \"y\" // trailing\n" +
+                 "func f() {}\n";
+    auto r = Scan(src);
+    A(r.package == "a");
+    A(r.imports.size() == 2 && r.imports[1] == "y");
+    A(src.compare(r.end, 4, "func") == 0);
+  }
+
+  { // ==== stops at the first non-declaration ====
+    A(Scan("").package.empty());
+    A(Scan("packages x").package.empty());
+    A(Scan("#include <x>\n#import y\n").imports.empty());
+    A(Scan("importance").imports.empty());
+    A(Scan("import \"short\"").imports[0] == "short"); // less than 16 bytes left
+  }
+
+  { // ==== errors ====
+    Error err;
+    Scan("package bar\nimport \"foo\n\"\n", &err);
+    A(err && strcmp(err.message(), "2:1: expected import path") == 0);
+    Scan("package a\npackage b\n", &err);
+    A(err && strcmp(err.message(), "2:1: package b declared in package a") == 0);
+    Scan("#import /abs\n", &err);
+    A(err);
+    Scan("/* never ends *", &err);
+    A(err);
+  }
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include "test.hh"
+#include "ast.hh"
+
+using std::string;
+using namespace rx;
+
+static string Parse(const char* src) {
+  Ast ast;
+  auto err = ast.parse(src, strlen(src));
+  return err ? string{"error: "} + err.message() : ast.repr();
+}
+
+int main(int argc, const char** argv) {
+
+  { // ==== declarations ====
+    A(Parse("package bar\n"
+            "import \"foo/bar/util\"\n"
+            "func NumberOfLOLs() {\n"
+            "  util.ImportanceOfLOL() * 2\n"
+            "}\n") ==
+      "(file (package bar) (import \"foo/bar/util\") "
+      "(func NumberOfLOLs () (block (* (call (. util ImportanceOfLOL)) 2))))");
+    A(Parse("func f(a, b) { return a }") == "(file (func f (a b) (block (return a))))");
+    A(Parse("func f() {\n  return\n}\n") == "(file (func f () (block (return))))");
+    A(Parse("") == "(file)");
+    A(Parse("// just a comment\n") == "(file)");
+  }
+
+  { // ==== expressions ====
+    A(Parse("1 + 2 * 3") == "(file (+ 1 (* 2 3)))");
+    A(Parse("(1 + 2) * 3") == "(file (* (+ 1 2) 3))");
+    A(Parse("a - b - c") == "(file (- (- a b) c))");
+    A(Parse("a = b = c") == "(file (= a (= b c)))");
+    A(Parse("-a.b(1, x[2]) < 3") == "(file (< (- (call (. a b) 1 (index x 2))) 3))");
+    A(Parse("\"a\" == 'b'") == "(file (== \"a\" 'b'))");
+    A(Parse("0600\n0xBadFace\n1.5e3") == "(file 0600 0xBadFace 1.5e3)");
+    A(Parse("f: .25") == "(file (label f .25))");
+  }
+
+  { // ==== errors ====
+    A(Parse("func (") == "error: 1:6: expected function name, got '('");
+    A(Parse("a +") == "error: 1:4: expected expression, got end of input");
+    A(Parse("x\nf(1 2)") == "error: 2:5: expected ')', got DecIntLit \"2\"");
+    A(Parse("func f() {\n  1\n") == "error: 3:1: expected '}', got end of input");
+  }
+
+  { // ==== deeply nested expressions ====
+    auto nested = [](const char* open, const char* close, int depth) {
+      string s;
+      for (int i = 0; i != depth; ++i) s += open;
+      s += "x";
+      for (int i = 0; i != depth; ++i) s += close;
+      return s;
+    };
+    auto tooDeep = [](const string& result) {
+      return result.find("expression nested too deeply") != string::npos;
+    };
+    A(Parse(nested("(", ")", 100).c_str()) == "(file x)");
+    A(tooDeep(Parse(nested("(", ")", 100000).c_str())));
+    A(tooDeep(Parse(nested("-", "", 100000).c_str())));
+    A(tooDeep(Parse(nested("f(", ")", 100000).c_str())));
+    A(tooDeep(Parse(nested("x[", "]", 100000).c_str())));
+    A(tooDeep(Parse(nested("x = ", "", 100000).c_str())));
+    A(Parse(nested("(", ")", 100000).c_str()) ==
+      "error: 1:501: expression nested too deeply, got '('");
+  }
+
+  { // ==== compact nodes ====
+    A(sizeof(Ast::Node) == 16);
+    string src;
+    for (int i = 0; i != 1000; ++i) {
+      src += "func f" + std::to_string(i) + "(a, b) {\n  return a.x(b * 2) + 1\n}\n";
+    }
+    Ast ast;
+    A(!ast.parse(src.data(), src.size()));
+    A(ast.list(ast[ast.root()]).size() == 1000);
+    A(ast.size() == 1 + 1000 * 15);
+    A(ast.memoryUsage() < ast.size() * 20); // nodes plus a little for lists and names
+    A(!ast.parse("1", 1)); // reuse
+    A(ast.repr() == "(file 1)");
+  }
+
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include "test.hh"
+#include "pkg.hh"
+
+using std::string;
+using namespace rx;
+
+int main(int argc, const char** argv) {
+
+  { // ==== names are interned ====
+    Pkg a{"foo/a/bar"};
+    Pkg b{string{"foo/a/bar"}};
+    Pkg c{"lol/cat"};
+    A(a == b);
+    A(a.id() == b.id());
+    A(a != c && a.id() != c.id());
+    A(a.name() == "foo/a/bar");
+    A(&a.name() == &b.name());
+    A(a.basename() == "bar");
+    A(Pkg{"std"}.basename() == "std");
+  }
+
+  { // ==== imports are unique and in canonical order ====
+    PkgImports a{"std", "foo/bar", "foo/baz"};
+    PkgImports b{"foo/baz", "std", "foo/bar", "std"};
+    A(a.size() == 3);
+    A(a == b);
+    A(std::is_sorted(a.begin(), a.end()));
+    A(a.contains("foo/bar"));
+    A(!a.contains("foo"));
+    A(!b.insert("std"));
+    A(b.insert("foo"));
+    A(a != b);
+    A(b.size() == 4);
+  }
+
+  { // ==== growing past the inline capacity, copying and moving ====
+    PkgImports a;
+    for (int i = 0; i != 20; ++i) A(a.insert(string{"p/"} + std::to_string(i)));
+    A(a.size() == 20);
+    A(std::is_sorted(a.begin(), a.end()));
+    PkgImports b{a};
+    A(a == b);
+    PkgImports c{std::move(b)};
+    A(c == a && b.empty());
+    PkgImports d{"x"};
+    d = std::move(c);
+    A(d == a);
+    d = PkgImports{"y"};
+    A(d.size() == 1 && d[0].name() == "y");
+  }
+
+  { // ==== union IDs ====
+    PkgImports a{"std", "foo/bar"};
+    PkgImports b{"foo/bar", "std"};
+    PkgImports c{"std", "foo/baz"};
+    A(PkgUnionID{a}.toString() == PkgUnionID{b}.toString());
+    A(PkgUnionID{a}.toString() != PkgUnionID{c}.toString());
+    A(PkgUnionID{a}.toString().size() == 22);
+  }
+
+  return 0;
+}
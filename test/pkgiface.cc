@@ -0,0 +1,117 @@
+#include "test.hh"
+#include "pkgiface.hh"
+
+using std::string;
+using namespace rx;
+
+static void Parse(Ast& ast, const char* src) {
+  auto err = ast.parse(src, strlen(src));
+  if (err) fprintf(stdout, "parse error: %s\n", err.message());
+  A(!err);
+}
+
+int main(int argc, const char** argv) {
+  const char* tmpdir = getenv("TMPDIR");
+  string filename = string{tmpdir ? tmpdir : "/tmp"} + "/rx-test-pkgiface-" +
+                    std::to_string(getpid()) + ".rxi";
+
+  Ast a, b;
+  Parse(a,
+    "package util\n"
+    "func ImportanceOfLOL() {\n"
+    "  2\n"
+    "}\n"
+    "func helper(x) {\n"
+    "  x\n"
+    "}\n");
+  Parse(b,
+    "package util\n"
+    "func Add(x, y) {\n"
+    "  x + y\n"
+    "}\n"
+    "func Zero() { 0 }\n");
+
+  string data;
+  hash::B16 h;
+  { // ==== Only exported declarations are written, in an order independent of the sources ====
+    PkgInterface::Writer w;
+    w.add(a);
+    w.add(b);
+    A(!w.finish(data, h));
+
+    string data2;
+    hash::B16 h2;
+    PkgInterface::Writer w2;
+    w2.add(b);
+    w2.add(a);
+    A(!w2.finish(data2, h2));
+    A(data == data2);
+    A(memcmp(h.bytes, h2.bytes, sizeof(h.bytes)) == 0);
+
+    // A change to a function body doesn't change the interface, but a change to its signature does
+    Ast c;
+    Parse(c, "func ImportanceOfLOL() { 3 }\n");
+    PkgInterface::Writer w3;
+    w3.add(c);
+    w3.add(b);
+    A(!w3.finish(data2, h2));
+    A(memcmp(h.bytes, h2.bytes, sizeof(h.bytes)) == 0);
+    Parse(c, "func ImportanceOfLOL(n) { 3 }\n");
+    PkgInterface::Writer w4;
+    w4.add(c);
+    w4.add(b);
+    A(!w4.finish(data2, h2));
+    A(memcmp(h.bytes, h2.bytes, sizeof(h.bytes)) != 0);
+  }
+
+  { // ==== Duplicate declarations ====
+    PkgInterface::Writer w;
+    w.add(b);
+    w.add(b);
+    string data2;
+    hash::B16 h2;
+    auto err = w.finish(data2, h2);
+    A(err && strcmp(err.message(), "duplicate declaration of Add") == 0);
+  }
+
+  { // ==== Symbols are looked up in the mapped file ====
+    A(!fs::writefile(filename, data.data(), data.size(), fs::FSync::None));
+    PkgInterface iface;
+    A(!iface.open(filename, &h));
+    A(iface.size() == 3);
+    A(memcmp(iface.interfaceHash().bytes, h.bytes, sizeof(h.bytes)) == 0);
+
+    auto sym = iface.lookup("Add");
+    A(sym);
+    A(sym.kind() == PkgInterface::Func);
+    A(sym.name() == "Add");
+    A(sym.paramCount() == 2);
+    A(sym.paramName(0) == "x" && sym.paramName(1) == "y");
+    A(sym.paramName(2) == "");
+
+    sym = iface.lookup("ImportanceOfLOL");
+    A(sym && sym.paramCount() == 0);
+    A(iface.lookup("Zero"));
+    A(!iface.lookup("helper"));
+    A(!iface.lookup("Ad"));
+    A(!iface.lookup("Adds"));
+    A(!iface.lookup(""));
+  }
+
+  { // ==== Stale and malformed files ====
+    PkgInterface iface;
+    hash::B16 other{};
+    A(strstr(iface.open(filename, &other).message(), "outdated") != nullptr);
+    A(!iface.lookup("Add"));
+
+    A(!fs::writefile(filename, data.data(), 40, fs::FSync::None));
+    A(strstr(iface.open(filename).message(), "truncated") != nullptr);
+
+    string junk(64, 'x');
+    A(!fs::writefile(filename, junk.data(), junk.size(), fs::FSync::None));
+    A(iface.open(filename));
+  }
+
+  unlink(filename.c_str());
+  return 0;
+}
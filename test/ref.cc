@@ -0,0 +1,163 @@
+#include "test.hh"
+#include "async.hh"
+
+using namespace rx;
+
+struct Deletion {
+  volatile long count = 0;
+  uv_thread_t   thread; // that deleted the object
+};
+
+struct Obj : BiasedRefCounted<Obj> {
+  Obj(Async& a, Deletion* d) : BiasedRefCounted{a}, d{d} {}
+  ~Obj() {
+    d->thread = uv_thread_self();
+    A(__sync_add_and_fetch(&d->count, 1L) == 1);
+  }
+  Deletion* d;
+};
+
+static bool IsThread(const uv_thread_t& t) {
+  auto self = uv_thread_self();
+  return uv_thread_equal(&t, &self);
+}
+
+template <typename F>
+static void OnThread(F&& fn) {
+  // Run fn on a new thread and wait for it to finish
+  uv_thread_t t;
+  A(uv_thread_create(&t, [](void* arg) { (*(F*)arg)(); }, (void*)&fn) == 0);
+  uv_thread_join(&t);
+}
+
+
+struct Worker {
+  // Takes and drops shared references to all objects, and drops the references it was handed
+  Async*                    async;
+  std::vector<Obj*>*        objs;
+  std::vector<Obj::Ref>     handed;  // references taken on the owner thread
+  std::vector<Obj::Ref>     kept;    // shared references, dropped last
+  volatile long*            done;
+  uv_thread_t               thread;
+};
+
+static void WorkerMain(void* arg) {
+  auto& w = *(Worker*)arg;
+  for (int round = 0; round != 50; ++round) {
+    for (auto* obj : *w.objs) {
+      Obj::Ref r{obj, /*add_ref=*/true};
+      Obj::Ref r2 = r;
+    }
+  }
+  for (auto& r : w.handed) {
+    r = nullptr; // handed back to the owner thread
+  }
+  for (auto& r : w.kept) {
+    r = nullptr; // deletes the object if the owner thread has let go of it
+  }
+  // Posted after our releases, which are run first
+  auto* a = w.async;
+  auto* done = w.done;
+  a->post([=]{ if (--*done == 0) a->unref(); });
+}
+
+
+int main(int argc, const char** argv) {
+  auto mainThread = uv_thread_self();
+
+  { // ==== Only the owner thread ====
+    Async a;
+    Deletion d;
+    Obj::Ref r{new Obj{a, &d}};
+    {
+      Obj::Ref r2 = r;
+      Obj::Ref r3 = r2;
+    }
+    A(d.count == 0);
+    r = nullptr;
+    A(d.count == 1 && IsThread(mainThread));
+  }
+
+  { // ==== A reference taken by the owner and dropped elsewhere is handed back ====
+    Async a;
+    Deletion d;
+    Obj::Ref r{new Obj{a, &d}};
+    Obj::Ref r2 = r;
+    a.ref();
+    OnThread([&]{
+      r2 = nullptr; // counted in the owner's local count, so posted to the owner
+      a.post([&]{ a.unref(); });
+    });
+    r = nullptr;
+    A(d.count == 0); // the posted release is still pending
+    a.run();
+    A(d.count == 1);
+    A(uv_thread_equal(&d.thread, &mainThread));
+  }
+
+  { // ==== The owner drops its last reference while another thread holds one ====
+    Async a;
+    Deletion d;
+    auto* obj = new Obj{a, &d};
+    Obj::Ref shared;
+    OnThread([&]{ shared = Obj::Ref{obj, /*add_ref=*/true}; });
+    { Obj::Ref owner{obj}; } // adopt and drop the owner's reference
+    A(d.count == 0);
+    uv_thread_t releaser;
+    OnThread([&]{
+      releaser = uv_thread_self();
+      shared = nullptr;
+    });
+    A(d.count == 1);
+    A(uv_thread_equal(&d.thread, &releaser)); // not the owner, which holds no reference
+  }
+
+  { // ==== Many threads retaining and releasing at once ====
+    const size_t kObjs = 64, kWorkers = 8;
+    Async a;
+    std::vector<Deletion> deletions(kObjs);
+    std::vector<Obj*> objs;
+    std::vector<Obj::Ref> owned;
+    for (size_t i = 0; i != kObjs; ++i) {
+      objs.push_back(new Obj{a, &deletions[i]});
+      owned.emplace_back(objs.back());
+    }
+
+    volatile long done = kWorkers;
+    std::vector<Worker> workers(kWorkers);
+    for (size_t i = 0; i != kWorkers; ++i) {
+      auto& w = workers[i];
+      w.async = &a;
+      w.objs = &objs;
+      w.done = &done;
+      for (auto* obj : objs) {
+        w.handed.emplace_back(obj, /*add_ref=*/true);
+      }
+    }
+    for (size_t i = 0; i != kWorkers; ++i) {
+      // Every other worker also takes a shared reference before the owner lets go of the objects
+      auto& w = workers[i];
+      if (i % 2 == 0) {
+        OnThread([&]{
+          for (auto* obj : objs) w.kept.emplace_back(obj, /*add_ref=*/true);
+        });
+      }
+    }
+
+    a.ref(); // until every worker is done
+    for (auto& w : workers) {
+      A(uv_thread_create(&w.thread, WorkerMain, &w) == 0);
+    }
+    owned.clear(); // the owner's own references; the handed ones are still counted locally
+    a.run();
+    for (auto& w : workers) {
+      uv_thread_join(&w.thread);
+    }
+
+    for (auto& d : deletions) {
+      A(d.count == 1);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+#include "test.hh"
+#include "fs.hh"
+
+using std::string;
+using namespace rx;
+
+static string gBase;
+
+static void Mkdir(const char* path) { A(mkdir((gBase + path).c_str(), 0755) == 0); }
+static void Touch(const char* path) { A(!fs::writefile(gBase + path, "x", 1, fs::FSync::None)); }
+static void Symlink(const char* target, const char* path) {
+  A(symlink(target, (gBase + path).c_str()) == 0);
+}
+
+static std::vector<string> Scan(const string& dir, size_t depth=10) {
+  // Returns the path of every entry visited, relative to `dir`, with a "/" suffix for directories
+  std::vector<string> found;
+  Error result{"not called"};
+  fs::scandir(dir, Async::main(), depth,
+    [&](const string& dirname, const string& filename, const fs::Stat& st) {
+      found.push_back((dirname.empty() ? filename : dirname + "/" + filename) +
+                      (st.isDir() ? "/" : ""));
+      return true;
+    },
+    [&](Error err) { result = err; });
+  Async::main().run();
+  A(!result);
+  std::sort(found.begin(), found.end());
+  return found;
+}
+
+int main(int argc, const char** argv) {
+  const char* tmpdir = getenv("TMPDIR");
+  string root = string{tmpdir ? tmpdir : "/tmp"} + "/rx-test-scandir-" + std::to_string(getpid());
+  gBase = root;
+  A(mkdir(root.c_str(), 0755) == 0);
+
+  // root/
+  //   ext/e.rx            outside of the scanned directory
+  //   ext2/x.rx
+  //   base/
+  //     a -> z/deep       sorts before the real name
+  //     b1 -> ../ext2     two links to the same directory outside of base
+  //     b2 -> ../ext2
+  //     cyc -> .          link back to base
+  //     g.rx
+  //     h.rx -> g.rx      symlinked file
+  //     outside -> ../ext
+  //     z/deep/f1.rx
+  //     z/deep/up -> ../..
+  Mkdir("/ext"); Touch("/ext/e.rx");
+  Mkdir("/ext2"); Touch("/ext2/x.rx");
+  Mkdir("/base");
+  Mkdir("/base/z"); Mkdir("/base/z/deep"); Touch("/base/z/deep/f1.rx");
+  Symlink("../..", "/base/z/deep/up");
+  Symlink("z/deep", "/base/a");
+  Symlink("../ext2", "/base/b1");
+  Symlink("../ext2", "/base/b2");
+  Symlink(".", "/base/cyc");
+  Touch("/base/g.rx");
+  Symlink("g.rx", "/base/h.rx");
+  Symlink("../ext", "/base/outside");
+
+  { // ==== Real names win, whatever the order in which I/O completes ====
+    std::vector<string> expected = {
+      "b1/", "b1/x.rx",           // lowest ordered link to ext2
+      "g.rx",                     // not h.rx
+      "outside/", "outside/e.rx", // only reachable through the link
+      "z/", "z/deep/", "z/deep/f1.rx", // not a/..., and neither cyc nor up are followed
+    };
+    for (int i = 0; i != 20; ++i) {
+      auto found = Scan(root + "/base");
+      if (found != expected) {
+        for (auto& s : found) fprintf(stdout, "  %s\n", s.c_str());
+      }
+      A(found == expected);
+    }
+  }
+
+  { // ==== The depth limit applies to directories reached through a link too ====
+    auto found = Scan(root + "/base", 0);
+    std::vector<string> expected = {
+      "a/", // z/deep is never reached under its real name
+      "b1/", "g.rx", "outside/", "z/",
+    };
+    A(found == expected);
+    found = Scan(root + "/base", 1);
+    expected = {
+      "b1/", "b1/x.rx", "g.rx", "outside/", "outside/e.rx", "z/",
+      "z/deep/", // visited under its real name, although not read, so a/ isn't read either
+    };
+    A(found == expected);
+  }
+
+  for (auto* path : {"/base/z/deep/up", "/base/z/deep/f1.rx", "/base/a", "/base/b1", "/base/b2",
+                     "/base/cyc", "/base/g.rx", "/base/h.rx", "/base/outside", "/ext/e.rx",
+                     "/ext2/x.rx"}) {
+    unlink((root + path).c_str());
+  }
+  for (auto* path : {"/base/z/deep", "/base/z", "/base", "/ext", "/ext2", ""}) {
+    rmdir((root + path).c_str());
+  }
+  return 0;
+}
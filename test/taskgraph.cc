@@ -0,0 +1,184 @@
+#include "test.hh"
+#include "taskgraph.hh"
+#include "buildhistory.hh"
+#include "executor.hh"
+
+using std::string;
+using namespace rx;
+using Kind = TaskGraph::Kind;
+
+static TaskGraph::Action Work(std::vector<string>& log, const string& name, Error err=nullptr) {
+  // Does its work on the CPU executor and logs its name on the loop thread when done
+  return [&log, name, err](TaskGraph::Done&& done) {
+    return Executor::cpu().run(Async::main(), [&log, name, err, done = std::move(done)]() mutable
+                                              -> func<void()> {
+      return [&log, name, err, done = std::move(done)]{
+        log.push_back(name);
+        done(err);
+      };
+    });
+  };
+}
+
+static size_t IndexOf(const std::vector<string>& v, const string& s) {
+  return std::find(v.begin(), v.end(), s) - v.begin();
+}
+
+int main(int argc, const char** argv) {
+
+  { // ==== dependencies run before dependents ====
+    std::vector<string> log;
+    TaskGraph g{Async::main(), 2};
+    auto a = g.add(Kind::Interface, "a", Work(log, "a"));
+    auto b = g.add(Kind::Interface, "b", Work(log, "b"));
+    auto u = g.add(Kind::UnionInterface, "a+b", Work(log, "a+b"));
+    auto c = g.add(Kind::Compile, "c", Work(log, "c"));
+    g.depend(u, a);
+    g.depend(u, b);
+    g.depend(c, u);
+    bool called = false;
+    g.run([&](Error err) { A(!err); called = true; });
+    Async::main().run();
+    A(called);
+    A(log.size() == 4);
+    A(IndexOf(log, "a+b") > IndexOf(log, "a"));
+    A(IndexOf(log, "a+b") > IndexOf(log, "b"));
+    A(log.back() == "c");
+  }
+
+  { // ==== a failure skips dependents but not independent tasks ====
+    std::vector<string> log;
+    TaskGraph g{Async::main()};
+    auto a = g.add(Kind::Interface, "a", Work(log, "a", Error{"boom"}));
+    auto b = g.add(Kind::Compile, "b", Work(log, "b"));
+    auto c = g.add(Kind::Link, "c", Work(log, "c"));
+    g.add(Kind::Interface, "d", Work(log, "d"));
+    g.depend(b, a);
+    g.depend(c, b);
+    Error result;
+    g.run([&](Error err) { result = err; });
+    Async::main().run();
+    A(result);
+    A(strcmp(result.message(), "interface a: boom") == 0);
+    A(log.size() == 2);
+    A(IndexOf(log, "d") != log.size());
+  }
+
+  { // ==== tasks that complete right away ====
+    TaskGraph g{Async::main(), 1};
+    size_t n = 0;
+    TaskGraph::NodeID prev = 0;
+    for (int i = 0; i != 10000; ++i) {
+      auto id = g.add(Kind::Parse, "p", [&](TaskGraph::Done&& done) {
+        ++n;
+        done(nullptr);
+        return AsyncCanceler{};
+      });
+      if (i != 0) g.depend(id, prev);
+      prev = id;
+    }
+    bool called = false;
+    g.run([&](Error err) { A(!err); called = true; });
+    A(called);
+    A(n == 10000);
+  }
+
+  { // ==== the default concurrency limits graphs created without one ====
+    TaskGraph::setDefaultConcurrency(2);
+    TaskGraph g{Async::main()};
+    size_t running = 0, maxRunning = 0, n = 0;
+    for (int i = 0; i != 8; ++i) {
+      g.add(Kind::Compile, "c" + std::to_string(i), [&](TaskGraph::Done&& done) {
+        maxRunning = std::max(maxRunning, ++running);
+        return Executor::cpu().run(Async::main(), [&, done = std::move(done)]() mutable
+                                                  -> func<void()> {
+          return [&, done = std::move(done)]{
+            --running;
+            ++n;
+            done(nullptr);
+          };
+        });
+      });
+    }
+    TaskGraph::setDefaultConcurrency(0); // only affects graphs created from now on
+    bool called = false;
+    g.run([&](Error err) { A(!err); called = true; });
+    Async::main().run();
+    A(called);
+    A(n == 8);
+    A(maxRunning == 2);
+  }
+
+  { // ==== canceling while tasks are queued on an executor ====
+    // The work of canceled requests, which holds their Done, is destroyed on executor threads
+    std::vector<string> log;
+    for (int i = 0; i != 200; ++i) {
+      TaskGraph g{Async::main(), 8};
+      for (int j = 0; j != 8; ++j) {
+        g.add(Kind::Compile, "c" + std::to_string(j), Work(log, "c"));
+      }
+      bool called = false;
+      auto canceler = g.run([&](Error err) { called = true; });
+      canceler();
+      Async::main().run();
+      A(!called);
+    }
+    A(log.empty());
+  }
+
+  { // ==== the longest chain starts first ====
+    std::vector<string> log;
+    BuildHistory history;
+    history.record(Kind::Interface, "small", 0, 10);
+    history.record(Kind::Interface, "big", 0, 1000);
+    history.record(Kind::Compile, "c", 0, 10);
+    TaskGraph g{Async::main(), 1};
+    g.setHistory(&history);
+    auto small = g.add(Kind::Interface, "small", Work(log, "small"));
+    g.add(Kind::Interface, "big", Work(log, "big"));
+    auto a = g.add(Kind::Compile, "c", Work(log, "c"));
+    auto b = g.add(Kind::Link, "new", Work(log, "new"), 2000);
+    g.depend(a, small);
+    g.depend(b, a);
+    bool called = false;
+    g.run([&](Error err) { A(!err); called = true; });
+    Async::main().run();
+    A(called);
+    A(log.size() == 4);
+    A(log.front() == "small"); // 10 + 10 + default estimate for "new" > 1000
+    A(history.estimate(Kind::Link, "new", 0) != 0);
+  }
+
+  { // ==== build history ====
+    BuildHistory h;
+    A(h.estimate(Kind::Compile, "x", 0) > 0);
+    h.record(Kind::Compile, "x", 100, 1000);
+    h.record(Kind::Compile, "x", 100, 2000);
+    A(h.estimate(Kind::Compile, "x", 0) == 1250);
+    A(h.estimate(Kind::Compile, "y", 200) == 2500); // from x's speed
+    A(h.estimate(Kind::Link, "y", 200) != 2500);
+    auto s = h.serialize();
+    BuildHistory h2;
+    h2.parse(s.data(), s.size());
+    A(h2.size() == 1);
+    A(h2.estimate(Kind::Compile, "x", 0) == 1250);
+    A(!h2.dirty());
+    h2.parse("garbage", 7);
+    A(h2.size() == 1);
+  }
+
+  { // ==== cycles are detected ====
+    std::vector<string> log;
+    TaskGraph g{Async::main()};
+    auto a = g.add(Kind::Scan, "a", Work(log, "a"));
+    auto b = g.add(Kind::Parse, "b", Work(log, "b"));
+    g.depend(a, b);
+    g.depend(b, a);
+    Error result;
+    g.run([&](Error err) { result = err; });
+    A(result);
+    A(log.empty());
+  }
+
+  return 0;
+}